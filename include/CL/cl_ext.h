@@ -175,6 +175,47 @@ typedef CL_API_ENTRY cl_int (CL_API_CALL *clTerminateContextKHR_fn)(cl_context /
 *********************************/
 #define CL_DEVICE_PROFILING_TIMER_OFFSET_AMD        0x4036
 
+/******************************
+* cl_pocl_mem_policy extension *
+******************************/
+/* cl_mem_flags */
+#define CL_MEM_HUGE_PAGES_POCL                      (1 << 24)
+#define CL_MEM_NO_HUGE_PAGES_POCL                   (1 << 25)
+#define CL_MEM_NUMA_INTERLEAVE_POCL                 (1 << 26)
+#define CL_MEM_NUMA_FIRST_TOUCH_POCL                (1 << 27)
+#define CL_MEM_NUMA_BIND_POCL                       (1 << 28)
+
+/*******************************
+* cl_pocl_file_buffer extension *
+*******************************/
+#define cl_pocl_file_buffer 1
+
+typedef cl_uint cl_mem_file_advice_pocl;
+
+/* cl_mem_file_advice_pocl */
+#define CL_MEM_FILE_ADVICE_NORMAL_POCL              0
+#define CL_MEM_FILE_ADVICE_SEQUENTIAL_POCL          1
+#define CL_MEM_FILE_ADVICE_RANDOM_POCL              2
+#define CL_MEM_FILE_ADVICE_WILLNEED_POCL            3
+
+extern CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBufferFromFilePOCL(cl_context              /* context */,
+                           cl_mem_flags            /* flags */,
+                           const char *            /* file_name */,
+                           size_t                  /* offset */,
+                           size_t                  /* size */,
+                           cl_mem_file_advice_pocl /* advice */,
+                           cl_int *                /* errcode_ret */) CL_EXT_SUFFIX__VERSION_1_2;
+
+typedef CL_API_ENTRY cl_mem
+(CL_API_CALL *clCreateBufferFromFilePOCL_fn)(cl_context              /* context */,
+                                             cl_mem_flags            /* flags */,
+                                             const char *            /* file_name */,
+                                             size_t                  /* offset */,
+                                             size_t                  /* size */,
+                                             cl_mem_file_advice_pocl /* advice */,
+                                             cl_int *                /* errcode_ret */) CL_EXT_SUFFIX__VERSION_1_2;
+
 #ifdef CL_VERSION_1_1
    /***********************************
     * cl_ext_device_fission extension *
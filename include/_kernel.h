@@ -419,6 +419,39 @@ size_t _CL_OVERLOADABLE get_global_offset(uint);
 
 void _CL_OVERLOADABLE barrier (cl_mem_fence_flags flags);
 
+
+/* Work-Group Functions (OpenCL 2.0). These have no definitions in the
+   kernel library, the kernel compiler lowers them to barriers and an
+   accumulation over the work-items (lib/llvmopencl/WorkgroupCollectives.cc). */
+
+int _CL_OVERLOADABLE work_group_all (int predicate);
+int _CL_OVERLOADABLE work_group_any (int predicate);
+
+#define _CL_DECLARE_WORK_GROUP_FUNCS(GENTYPE)                           \
+  GENTYPE _CL_OVERLOADABLE work_group_broadcast (GENTYPE a,             \
+                                                 size_t local_id);      \
+  GENTYPE _CL_OVERLOADABLE work_group_broadcast (GENTYPE a,             \
+                                                 size_t x, size_t y);   \
+  GENTYPE _CL_OVERLOADABLE work_group_broadcast (GENTYPE a,             \
+                                                 size_t x, size_t y,    \
+                                                 size_t z);             \
+  GENTYPE _CL_OVERLOADABLE work_group_reduce_add (GENTYPE x);           \
+  GENTYPE _CL_OVERLOADABLE work_group_reduce_min (GENTYPE x);           \
+  GENTYPE _CL_OVERLOADABLE work_group_reduce_max (GENTYPE x);           \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_exclusive_add (GENTYPE x);   \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_exclusive_min (GENTYPE x);   \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_exclusive_max (GENTYPE x);   \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_inclusive_add (GENTYPE x);   \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_inclusive_min (GENTYPE x);   \
+  GENTYPE _CL_OVERLOADABLE work_group_scan_inclusive_max (GENTYPE x);
+
+_CL_DECLARE_WORK_GROUP_FUNCS(int)
+_CL_DECLARE_WORK_GROUP_FUNCS(uint)
+__IF_INT64(_CL_DECLARE_WORK_GROUP_FUNCS(long))
+__IF_INT64(_CL_DECLARE_WORK_GROUP_FUNCS(ulong))
+_CL_DECLARE_WORK_GROUP_FUNCS(float)
+__IF_FP64(_CL_DECLARE_WORK_GROUP_FUNCS(double))
+
 
 /* Math Constants */
 
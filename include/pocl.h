@@ -67,6 +67,8 @@ typedef struct
   void *data;
   char *tmp_dir; 
   pocl_workgroup wg;
+  /* NULL in case the kernel has work-group barriers. */
+  pocl_workgroup_range wg_range;
   cl_kernel kernel;
   /* A list of argument buffers to free after the command has 
      been executed. */
@@ -77,6 +79,10 @@ typedef struct
   size_t local_z;
   struct pocl_context pc;
   struct pocl_argument *arguments;
+  /* The local size autotuning entry to record the execution time of
+     the command to, NULL if the command is not a measurement. */
+  struct pocl_autotune_entry *autotune;
+  unsigned autotune_candidate;
 } _cl_command_run;
 
 // clEnqueueNativeKernel
@@ -160,11 +166,31 @@ typedef struct
   size_t pixel_size;
 } _cl_command_fill_image;
 
+/* clEnqueueFillBuffer */
+typedef struct
+{
+  void *data;
+  void *device_ptr;
+  size_t size;
+  void *pattern;
+  size_t pattern_size;
+  cl_mem buffer;
+} _cl_command_fill;
+
 typedef struct
 {
   void *data;
 } _cl_command_marker;
 
+/* clEnqueueMigrateMemObjects */
+typedef struct
+{
+  void *data;
+  cl_mem *mem_objects;
+  unsigned num_mem_objects;
+  cl_mem_migration_flags flags;
+} _cl_command_migrate;
+
 typedef union
 {
   _cl_command_run run;
@@ -173,10 +199,12 @@ typedef union
   _cl_command_write write;
   _cl_command_copy copy;
   _cl_command_map map;
+  _cl_command_fill fill;
   _cl_command_fill_image fill_image;
   _cl_command_rw_image rw_image;
   _cl_command_marker marker;
   _cl_command_unmap unmap;
+  _cl_command_migrate migrate;
 } _cl_command_t;
 
 // one item in the command queue
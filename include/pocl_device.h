@@ -41,6 +41,11 @@ struct pocl_context {
 
 typedef void (*pocl_workgroup) (void **, struct pocl_context *);
 
+/* Executes the given number of work-groups in the x dimension starting
+   from the group id in the context. Generated only for kernels without
+   work-group barriers. */
+typedef void (*pocl_workgroup_range) (void **, struct pocl_context *, size_t);
+
 #define MAX_KERNEL_ARGS 64
 #define MAX_KERNEL_NAME_LENGTH 64
 
@@ -100,6 +100,15 @@ build_program_compute_hash(cl_program program)
   /*devices may include their own information to hash */
   for (i = 0; i < program->num_devices; ++i)
     {
+      /* The kernels are compiled for the CPU variant and the ISA
+         features detected at runtime. */
+      cl_device_id dev = program->devices[i];
+      if (dev->llvm_cpu)
+        pocl_SHA1_Update (&hash_ctx, (uint8_t*) dev->llvm_cpu,
+                          strlen (dev->llvm_cpu));
+      if (dev->llvm_cpu_features)
+        pocl_SHA1_Update (&hash_ctx, (uint8_t*) dev->llvm_cpu_features,
+                          strlen (dev->llvm_cpu_features));
       if (program->devices[i]->ops->build_hash)
         program->devices[i]->ops->build_hash (program->devices[i]->data, 
                                               &hash_ctx);
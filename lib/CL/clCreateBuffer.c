@@ -23,14 +23,22 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_util.h"
 #include "devices.h"
 
-CL_API_ENTRY cl_mem CL_API_CALL
-POname(clCreateBuffer)(cl_context context,
-               cl_mem_flags flags,
-               size_t size,
-               void *host_ptr,
-               cl_int *errcode_ret) CL_API_SUFFIX__VERSION_1_0
+/**
+ * Creates a buffer object.
+ *
+ * @param file_map The mapping of a file the buffer is backed by (the
+ * host_ptr points inside it), NULL if not file-backed. The mapping is
+ * unmapped when the buffer is released. The devices sharing the host
+ * memory can have file-backed buffers larger than their allocation size
+ * limit, as the data lives in the page cache.
+ */
+cl_mem
+pocl_create_buffer (cl_context context, cl_mem_flags flags, size_t size,
+                    void *host_ptr, void *file_map, size_t file_map_size,
+                    cl_int *errcode_ret)
 {
   cl_mem mem = NULL;
   cl_device_id device;
@@ -48,13 +56,22 @@ POname(clCreateBuffer)(cl_context context,
       goto ERROR;
     }
 
-  if (flags == 0)
-    flags = CL_MEM_READ_WRITE;
+  if ((flags & ~POCL_MEM_EXT_FLAGS) == 0)
+    flags |= CL_MEM_READ_WRITE;
   
   /* validate flags */
   
-  POCL_GOTO_ERROR_ON((flags > (1<<10)-1), CL_INVALID_VALUE, "Flags must "
-    "be < 1024 (there are only 10 flags)\n");
+  POCL_GOTO_ERROR_ON(((flags & ~POCL_MEM_EXT_FLAGS) > (1<<10)-1),
+    CL_INVALID_VALUE, "Flags must be < 1024 (there are only 10 flags) "
+    "besides the cl_pocl_mem_policy ones\n");
+
+  POCL_GOTO_ERROR_ON(((flags & CL_MEM_HUGE_PAGES_POCL) &&
+    (flags & CL_MEM_NO_HUGE_PAGES_POCL)), CL_INVALID_VALUE, "Invalid flags: "
+    "can't have both CL_MEM_HUGE_PAGES_POCL and CL_MEM_NO_HUGE_PAGES_POCL\n");
+
+  POCL_GOTO_ERROR_ON((((flags & POCL_MEM_NUMA_FLAGS) &
+    ((flags & POCL_MEM_NUMA_FLAGS) - 1)) != 0), CL_INVALID_VALUE,
+    "Invalid flags: only one of the CL_MEM_NUMA_*_POCL flags can be used\n");
 
   POCL_GOTO_ERROR_ON(((flags & CL_MEM_READ_WRITE) &&
     (flags & CL_MEM_WRITE_ONLY || flags & CL_MEM_READ_ONLY)),
@@ -96,6 +113,8 @@ POname(clCreateBuffer)(cl_context context,
     {
       cl_ulong max_alloc;
       
+      if (file_map != NULL && context->devices[i]->host_unified_memory)
+        continue;
       POname(clGetDeviceInfo) (context->devices[i], 
                                CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), 
                                &max_alloc, NULL);
@@ -131,6 +150,8 @@ POname(clCreateBuffer)(cl_context context,
   mem->mem_host_ptr = host_ptr; 
   mem->size = size;
   mem->context = context;
+  mem->file_map = file_map;
+  mem->file_map_size = file_map_size;
   
   for (i = 0; i < context->num_devices; ++i)
     {
@@ -166,4 +187,15 @@ ERROR:
     }
   return NULL;
 }
+
+CL_API_ENTRY cl_mem CL_API_CALL
+POname(clCreateBuffer)(cl_context context,
+               cl_mem_flags flags,
+               size_t size,
+               void *host_ptr,
+               cl_int *errcode_ret) CL_API_SUFFIX__VERSION_1_0
+{
+  return pocl_create_buffer (context, flags, size, host_ptr, NULL, 0,
+                             errcode_ret);
+}
 POsym(clCreateBuffer)
@@ -0,0 +1,70 @@
+/* OpenCL runtime library: clCreateBufferFromFilePOCL()
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "pocl_cl.h"
+#include "pocl_util.h"
+
+/* Creates a buffer backed by a mmap()ed range of a file. The buffer
+   uses the mapping as its host pointer, thus the devices sharing the
+   host memory access the page cache directly instead of a copy of the
+   file. Writes to the buffer are private to the process. */
+CL_API_ENTRY cl_mem CL_API_CALL
+POname(clCreateBufferFromFilePOCL)(cl_context              context,
+                                   cl_mem_flags            flags,
+                                   const char *            file_name,
+                                   size_t                  offset,
+                                   size_t                  size,
+                                   cl_mem_file_advice_pocl advice,
+                                   cl_int *                errcode_ret)
+CL_EXT_SUFFIX__VERSION_1_2
+{
+  cl_mem mem;
+  void *ptr, *map = NULL;
+  size_t map_size = 0;
+  int errcode;
+
+  POCL_GOTO_ERROR_COND((file_name == NULL), CL_INVALID_VALUE);
+
+  POCL_GOTO_ERROR_ON((flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR |
+                               CL_MEM_COPY_HOST_PTR)), CL_INVALID_VALUE,
+    "Host pointer flags are not allowed for file-backed buffers\n");
+
+  POCL_GOTO_ERROR_ON((advice > CL_MEM_FILE_ADVICE_WILLNEED_POCL),
+    CL_INVALID_VALUE, "Unknown file access advice %u\n", advice);
+
+  ptr = pocl_map_file (file_name, offset, &size, advice, &map, &map_size);
+  POCL_GOTO_ERROR_ON((ptr == NULL), CL_INVALID_VALUE,
+    "Could not map %zu bytes at offset %zu of file %s\n", size, offset,
+    file_name);
+
+  mem = pocl_create_buffer (context, flags | CL_MEM_USE_HOST_PTR, size, ptr,
+                            map, map_size, errcode_ret);
+  if (mem == NULL)
+    pocl_unmap_file (map, map_size);
+  return mem;
+
+ERROR:
+  if (errcode_ret)
+    *errcode_ret = errcode;
+  return NULL;
+}
+POsym(clCreateBufferFromFilePOCL)
@@ -100,6 +100,11 @@ POname(clCreateKernel)(cl_program program,
 
   kernel->context = program->context;
   kernel->program = program;
+  kernel->spec_values = NULL;
+  kernel->spec_repeats = NULL;
+  kernel->wg_cachedir = NULL;
+  kernel->wg_device = NULL;
+  kernel->autotune = NULL;
   kernel->next = NULL;
 
   POCL_LOCK_OBJ (program);
@@ -66,6 +66,8 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
   POCL_INIT_OBJECT(mem);
   mem->mappings = NULL;
   mem->parent = buffer;
+  mem->file_map = NULL;
+  mem->file_map_size = 0;
 
   mem->type = CL_MEM_OBJECT_BUFFER;
   mem->size = info->size;
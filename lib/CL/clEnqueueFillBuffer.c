@@ -0,0 +1,107 @@
+/* OpenCL runtime library: clEnqueueFillBuffer()
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "pocl_cl.h"
+#include "pocl_util.h"
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clEnqueueFillBuffer)(cl_command_queue  command_queue,
+                            cl_mem            buffer,
+                            const void *      pattern,
+                            size_t            pattern_size,
+                            size_t            offset,
+                            size_t            size,
+                            cl_uint           num_events_in_wait_list,
+                            const cl_event*   event_wait_list,
+                            cl_event*         event)
+CL_API_SUFFIX__VERSION_1_2
+{
+  _cl_command_node *cmd = NULL;
+  void *pattern_copy = NULL;
+  cl_device_id device;
+  int errcode;
+
+  POCL_RETURN_ERROR_COND((command_queue == NULL), CL_INVALID_COMMAND_QUEUE);
+
+  POCL_RETURN_ERROR_COND((buffer == NULL), CL_INVALID_MEM_OBJECT);
+
+  POCL_RETURN_ERROR_ON((buffer->type != CL_MEM_OBJECT_BUFFER),
+    CL_INVALID_MEM_OBJECT, "buffer is not a CL_MEM_OBJECT_BUFFER\n");
+
+  POCL_RETURN_ERROR_ON((command_queue->context != buffer->context),
+    CL_INVALID_CONTEXT, "buffer and command_queue are not from the same "
+    "context\n");
+
+  POCL_RETURN_ERROR_COND((pattern == NULL), CL_INVALID_VALUE);
+
+  /* The pattern must be the size of an OpenCL scalar or vector type. */
+  POCL_RETURN_ERROR_ON((pattern_size == 0 || pattern_size > 128 ||
+    (pattern_size & (pattern_size - 1)) != 0), CL_INVALID_VALUE,
+    "pattern_size (%zu) must be 1, 2, 4, 8, 16, 32, 64 or 128\n",
+    pattern_size);
+
+  POCL_RETURN_ERROR_ON((offset % pattern_size != 0 ||
+    size % pattern_size != 0), CL_INVALID_VALUE,
+    "offset (%zu) and size (%zu) must be multiples of pattern_size (%zu)\n",
+    offset, size, pattern_size);
+
+  POCL_RETURN_ERROR_COND((size == 0), CL_INVALID_VALUE);
+
+  if (pocl_buffer_boundcheck (buffer, offset, size) != CL_SUCCESS)
+    return CL_INVALID_VALUE;
+
+  POCL_RETURN_ERROR_COND((event_wait_list == NULL && num_events_in_wait_list > 0),
+    CL_INVALID_EVENT_WAIT_LIST);
+
+  POCL_RETURN_ERROR_COND((event_wait_list != NULL && num_events_in_wait_list == 0),
+    CL_INVALID_EVENT_WAIT_LIST);
+
+  /* The pattern can be reused by the application after the call. */
+  pattern_copy = malloc (pattern_size);
+  if (pattern_copy == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  memcpy (pattern_copy, pattern, pattern_size);
+
+  errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_FILL_BUFFER,
+                                 event, num_events_in_wait_list,
+                                 event_wait_list);
+  if (errcode != CL_SUCCESS)
+    {
+      POCL_MEM_FREE (pattern_copy);
+      return errcode;
+    }
+
+  device = command_queue->device;
+  cmd->command.fill.data = device->data;
+  cmd->command.fill.device_ptr =
+    (char*)buffer->device_ptrs[device->dev_id].mem_ptr + offset;
+  cmd->command.fill.size = size;
+  cmd->command.fill.pattern = pattern_copy;
+  cmd->command.fill.pattern_size = pattern_size;
+  cmd->command.fill.buffer = buffer;
+  POname(clRetainMemObject) (buffer);
+
+  pocl_command_enqueue (command_queue, cmd);
+
+  return CL_SUCCESS;
+}
+POsym(clEnqueueFillBuffer)
@@ -0,0 +1,95 @@
+/* OpenCL runtime library: clEnqueueMigrateMemObjects()
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "pocl_cl.h"
+#include "utlist.h"
+#include "pocl_util.h"
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clEnqueueMigrateMemObjects) (cl_command_queue       command_queue,
+                                    cl_uint                num_mem_objects,
+                                    const cl_mem *         mem_objects,
+                                    cl_mem_migration_flags flags,
+                                    cl_uint                num_events_in_wait_list,
+                                    const cl_event *       event_wait_list,
+                                    cl_event *             event)
+CL_API_SUFFIX__VERSION_1_2
+{
+  unsigned i;
+  _cl_command_node *cmd = NULL;
+  cl_mem *objects = NULL;
+  int errcode;
+
+  POCL_RETURN_ERROR_COND((command_queue == NULL), CL_INVALID_COMMAND_QUEUE);
+
+  POCL_RETURN_ERROR_COND((num_mem_objects == 0 || mem_objects == NULL),
+    CL_INVALID_VALUE);
+
+  POCL_RETURN_ERROR_ON((flags & ~(CL_MIGRATE_MEM_OBJECT_HOST |
+    CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED)), CL_INVALID_VALUE,
+    "Unknown migration flags\n");
+
+  for (i = 0; i < num_mem_objects; ++i)
+    {
+      POCL_RETURN_ERROR_COND((mem_objects[i] == NULL), CL_INVALID_MEM_OBJECT);
+
+      POCL_RETURN_ERROR_ON((mem_objects[i]->context != command_queue->context),
+        CL_INVALID_CONTEXT, "mem_objects and command_queue are not from the "
+        "same context\n");
+    }
+
+  POCL_RETURN_ERROR_COND((event_wait_list == NULL && num_events_in_wait_list > 0),
+    CL_INVALID_EVENT_WAIT_LIST);
+
+  POCL_RETURN_ERROR_COND((event_wait_list != NULL && num_events_in_wait_list == 0),
+    CL_INVALID_EVENT_WAIT_LIST);
+
+  objects = (cl_mem*) malloc (num_mem_objects * sizeof (cl_mem));
+  if (objects == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  errcode = pocl_create_command (&cmd, command_queue,
+                                 CL_COMMAND_MIGRATE_MEM_OBJECTS,
+                                 event, num_events_in_wait_list,
+                                 event_wait_list);
+  if (errcode != CL_SUCCESS)
+    {
+      POCL_MEM_FREE(objects);
+      return errcode;
+    }
+
+  for (i = 0; i < num_mem_objects; ++i)
+    {
+      objects[i] = mem_objects[i];
+      POname(clRetainMemObject) (objects[i]);
+    }
+
+  cmd->command.migrate.data = command_queue->device->data;
+  cmd->command.migrate.mem_objects = objects;
+  cmd->command.migrate.num_mem_objects = num_mem_objects;
+  cmd->command.migrate.flags = flags;
+
+  pocl_command_enqueue (command_queue, cmd);
+
+  return CL_SUCCESS;
+}
+POsym(clEnqueueMigrateMemObjects)
@@ -26,6 +26,9 @@
 #include "pocl_cl.h"
 #include "pocl_llvm.h"
 #include "pocl_util.h"
+#include "pocl_runtime_config.h"
+#include "pocl_autotune.h"
+#include "cpuinfo.h"
 #include "utlist.h"
 #ifndef _MSC_VER
 #  include <unistd.h>
@@ -39,9 +42,211 @@
 
 #define COMMAND_LENGTH 1024
 #define ARGUMENT_STRING_LENGTH 32
+/* The maximum number of arguments a work-group function variant is
+   specialized on. Keeps the cache directory names short. */
+#define MAX_SPECIALIZED_ARGS 8
 
 //#define DEBUG_NDRANGE
 
+/* Tracks the values of the scalar arguments across the launches of the
+   kernel for the launch-time specialization (POCL_KERNEL_SPECIALIZE=N).
+   The arguments that have kept their value for the last N launches are
+   set to spec_args, the rest to NULL. The specialized values are appended
+   to the cache directory, thus each variant of the work-group function
+   gets its own. The kernel lock protects the counters from concurrent
+   launches of the same kernel.
+
+   Returns the number of specialized arguments. */
+static int
+specialize_arguments (cl_kernel kernel, unsigned threshold,
+                      struct pocl_argument *spec_args, char *cachedir)
+{
+  unsigned i;
+  int count = 0;
+  size_t len;
+
+  POCL_LOCK_OBJ (kernel);
+  if (kernel->spec_values == NULL)
+    {
+      kernel->spec_values =
+        (cl_ulong *) calloc (kernel->num_args, sizeof (cl_ulong));
+      kernel->spec_repeats =
+        (unsigned *) calloc (kernel->num_args, sizeof (unsigned));
+      if (kernel->spec_values == NULL || kernel->spec_repeats == NULL)
+        {
+          POCL_MEM_FREE (kernel->spec_values);
+          POCL_MEM_FREE (kernel->spec_repeats);
+          POCL_UNLOCK_OBJ (kernel);
+          return 0;
+        }
+    }
+
+  for (i = 0; i < kernel->num_args; ++i)
+    {
+      struct pocl_argument *arg = &kernel->dyn_arguments[i];
+      cl_ulong value = 0;
+
+      spec_args[i].size = 0;
+      spec_args[i].value = NULL;
+      if (kernel->arg_info[i].is_local ||
+          kernel->arg_info[i].type != POCL_ARG_TYPE_NONE ||
+          arg->value == NULL || arg->size > sizeof (cl_ulong))
+        continue;
+
+      memcpy (&value, arg->value, arg->size);
+      if (kernel->spec_repeats[i] == 0 || kernel->spec_values[i] != value)
+        {
+          kernel->spec_values[i] = value;
+          kernel->spec_repeats[i] = 1;
+        }
+      else if (kernel->spec_repeats[i] < threshold)
+        ++kernel->spec_repeats[i];
+
+      if (kernel->spec_repeats[i] < threshold || count == MAX_SPECIALIZED_ARGS)
+        continue;
+
+      spec_args[i] = *arg;
+      len = strlen (cachedir);
+      snprintf (cachedir + len, POCL_FILENAME_LENGTH - len, "%s%u_%llx",
+                count == 0 ? "/spec-" : "-", i, (unsigned long long)value);
+      ++count;
+    }
+  POCL_UNLOCK_OBJ (kernel);
+  return count;
+}
+
+/* Generates the work-group function of each ISA level variant of a
+   multi-versioned kernel to its own subdirectory of the cache dir. The
+   device picks the variant to load when it compiles the kernel. */
+static cl_int
+generate_isa_variants (cl_device_id device, cl_kernel kernel,
+                       size_t local_x, size_t local_y, size_t local_z,
+                       unsigned work_dim,
+                       const struct pocl_argument *spec_args,
+                       const char *cachedir, const char *kernel_filename)
+{
+  char variant_dir[POCL_FILENAME_LENGTH];
+  char parallel_filename[POCL_FILENAME_LENGTH];
+  char so_filename[POCL_FILENAME_LENGTH];
+  int level, error;
+
+  for (level = 0; level < POCL_ISA_LEVEL_COUNT; ++level)
+    {
+      if (!(device->isa_variants & (1u << level)))
+        continue;
+
+      error = snprintf (variant_dir, POCL_FILENAME_LENGTH, "%s/%s",
+                        cachedir, pocl_isa_level_name (level));
+      if (error < 0)
+        return CL_OUT_OF_HOST_MEMORY;
+
+      if (access (variant_dir, F_OK) != 0)
+        mkdir (variant_dir, S_IRWXU);
+
+      error = snprintf (so_filename, POCL_FILENAME_LENGTH, "%s/%s.so",
+                        variant_dir, kernel->name);
+      if (error < 0)
+        return CL_OUT_OF_HOST_MEMORY;
+
+      if (access (so_filename, F_OK) == 0)
+        continue;
+
+      error = snprintf (parallel_filename, POCL_FILENAME_LENGTH, "%s/%s",
+                        variant_dir, POCL_PARALLEL_BC_FILENAME);
+      if (error < 0)
+        return CL_OUT_OF_HOST_MEMORY;
+
+      error = pocl_llvm_generate_workgroup_function
+        (device, level, kernel, local_x, local_y, local_z, work_dim, spec_args,
+         parallel_filename, kernel_filename);
+      if (error)
+        return error;
+    }
+  return CL_SUCCESS;
+}
+
+/* Reads the local size set in the tuning profile of the kernel as
+   POCL_LOCAL_SIZE=x[,y[,z]]. Returns 1 in case it is set and usable
+   for the global size, 0 otherwise. */
+static int
+profile_local_size (cl_kernel kernel, cl_device_id device,
+                    size_t global_x, size_t global_y, size_t global_z,
+                    size_t *local_x, size_t *local_y, size_t *local_z)
+{
+  size_t local[3] = {1, 1, 1};
+  const char *option =
+    pocl_get_kernel_string_option (kernel, "POCL_LOCAL_SIZE", NULL);
+
+  if (option == NULL ||
+      sscanf (option, "%zu,%zu,%zu", &local[0], &local[1], &local[2]) < 1)
+    return 0;
+  if (local[0] == 0 || local[1] == 0 || local[2] == 0 ||
+      global_x % local[0] != 0 || global_y % local[1] != 0 ||
+      global_z % local[2] != 0 ||
+      local[0] * local[1] * local[2] > device->max_work_group_size)
+    return 0;
+
+  *local_x = local[0];
+  *local_y = local[1];
+  *local_z = local[2];
+  return 1;
+}
+
+/* Creates the cache dir of the launch and generates the work-group
+   function to it unless it is there already. The first base_len
+   characters of cachedir are the dir of the local size, the rest the
+   subdir of the specialized argument values, if any. */
+static cl_int
+generate_workgroup_function (cl_device_id device, cl_kernel kernel,
+                             size_t local_x, size_t local_y, size_t local_z,
+                             unsigned work_dim,
+                             const struct pocl_argument *spec_args,
+                             char *cachedir, size_t base_len)
+{
+  char kernel_filename[POCL_FILENAME_LENGTH];
+  char parallel_filename[POCL_FILENAME_LENGTH];
+  char so_filename[POCL_FILENAME_LENGTH];
+  char spec_char = cachedir[base_len];
+  int error;
+
+  cachedir[base_len] = '\0';
+  if (access (cachedir, F_OK) != 0)
+    mkdir (cachedir, S_IRWXU);
+  cachedir[base_len] = spec_char;
+  if (spec_char != '\0' && access (cachedir, F_OK) != 0)
+    mkdir (cachedir, S_IRWXU);
+
+  error = snprintf
+          (parallel_filename, POCL_FILENAME_LENGTH,
+          "%s/%s", cachedir, POCL_PARALLEL_BC_FILENAME);
+  if (error < 0)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  error = snprintf
+          (so_filename, POCL_FILENAME_LENGTH,
+          "%s/%s.so", cachedir, kernel->name);
+  if (error < 0)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  error = snprintf
+          (kernel_filename, POCL_FILENAME_LENGTH,
+           "%s/%s/%s", kernel->program->cache_dir,
+           device->cache_dir_name, POCL_PROGRAM_BC_FILENAME);
+  if (error < 0)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  if (device->isa_variants)
+    return generate_isa_variants (device, kernel,
+                                  local_x, local_y, local_z, work_dim,
+                                  spec_args, cachedir, kernel_filename);
+  else if (access(so_filename, F_OK) != 0)
+    return pocl_llvm_generate_workgroup_function
+        (device, POCL_ISA_LEVEL_NATIVE,
+         kernel, local_x, local_y, local_z, work_dim, spec_args,
+         parallel_filename, kernel_filename);
+  return CL_SUCCESS;
+}
+
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
                        cl_kernel kernel,
@@ -57,11 +262,14 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   size_t global_x, global_y, global_z;
   size_t local_x, local_y, local_z;
   char cachedir[POCL_FILENAME_LENGTH];
-  char kernel_filename[POCL_FILENAME_LENGTH];
-  char parallel_filename[POCL_FILENAME_LENGTH];
-  char so_filename[POCL_FILENAME_LENGTH];
+  size_t base_len;
   int i, count;
   int error;
+  int same_config;
+  int spec_threshold;
+  struct pocl_argument *spec_args = NULL;
+  pocl_autotune_entry *autotune = NULL;
+  unsigned autotune_candidate = 0;
   struct pocl_context pc;
   _cl_command_node *command_node;
 
@@ -197,6 +405,26 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
       }
       while (local_x * local_y * local_z >
              command_queue->device->max_work_group_size);
+
+      /* Replace the heuristic choice with the local size of the tuning
+         profile of the kernel or the autotuned one, or try the next
+         candidate in case the kernel is still being autotuned. */
+      if (profile_local_size (kernel, command_queue->device,
+                              global_x, global_y, global_z,
+                              &local_x, &local_y, &local_z))
+        ;
+      else if (pocl_get_bool_option ("POCL_AUTOTUNE_LOCAL_SIZE", 0) &&
+          command_queue->device->ops->get_timer_value != NULL)
+        {
+          size_t global[3] = {global_x, global_y, global_z};
+          size_t local[3] = {local_x, local_y, local_z};
+          autotune = pocl_autotune_local_size
+            (command_queue->device, kernel, work_dim, global,
+             preferred_wg_multiple, local, &autotune_candidate);
+          local_x = local[0];
+          local_y = local[1];
+          local_z = local[2];
+        }
     }
 
   POCL_MSG_PRINT_INFO("Qeueing kernel %s with local size %u x %u x %u group "
@@ -236,38 +464,48 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
             kernel->program->cache_dir, command_queue->device->cache_dir_name,
             kernel->name,
             local_x, local_y, local_z);
+  base_len = strlen (cachedir);
 
-  if (access (cachedir, F_OK) != 0)
-    mkdir (cachedir, S_IRWXU);
-  
-  error = snprintf
-          (parallel_filename, POCL_FILENAME_LENGTH,
-          "%s/%s", cachedir, POCL_PARALLEL_BC_FILENAME);
-  if (error < 0)
-    return CL_OUT_OF_HOST_MEMORY;
-
-  error = snprintf
-          (so_filename, POCL_FILENAME_LENGTH,
-          "%s/%s.so", cachedir, kernel->name);
-  if (error < 0)
-    return CL_OUT_OF_HOST_MEMORY;
-
-  error = snprintf
-          (kernel_filename, POCL_FILENAME_LENGTH,
-           "%s/%s/%s", kernel->program->cache_dir,
-           command_queue->device->cache_dir_name, POCL_PROGRAM_BC_FILENAME);
-  if (error < 0)
-    return CL_OUT_OF_HOST_MEMORY;
-
-  if (access(so_filename, F_OK) != 0)
+  spec_threshold = pocl_get_int_option ("POCL_KERNEL_SPECIALIZE", 0);
+  if (spec_threshold > 0 && kernel->num_args > 0)
     {
-      error = pocl_llvm_generate_workgroup_function
-          (command_queue->device,
-           kernel, local_x, local_y, local_z,
-           parallel_filename, kernel_filename);
+      spec_args = (struct pocl_argument *)
+        malloc (kernel->num_args * sizeof (struct pocl_argument));
+      if (spec_args == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+      if (specialize_arguments (kernel, spec_threshold, spec_args,
+                                cachedir) == 0)
+        POCL_MEM_FREE (spec_args);
+    }
 
-      if (error)  return error;
+  /* Repeated launches with the configuration of the previous launch of
+     the kernel, e.g. the clEnqueueTask()s of small control kernels,
+     only check that the cache dir still exists instead of checking
+     each file of the work-group function. */
+  POCL_LOCK_OBJ (kernel);
+  same_config = kernel->wg_device == command_queue->device &&
+    kernel->wg_cachedir != NULL && strcmp (kernel->wg_cachedir, cachedir) == 0;
+  POCL_UNLOCK_OBJ (kernel);
+
+  if (same_config && access (cachedir, F_OK) == 0)
+    error = CL_SUCCESS;
+  else
+    {
+      error = generate_workgroup_function (command_queue->device, kernel,
+                                           local_x, local_y, local_z,
+                                           work_dim, spec_args,
+                                           cachedir, base_len);
+      if (error == CL_SUCCESS)
+        {
+          POCL_LOCK_OBJ (kernel);
+          POCL_MEM_FREE (kernel->wg_cachedir);
+          kernel->wg_cachedir = strdup (cachedir);
+          kernel->wg_device = command_queue->device;
+          POCL_UNLOCK_OBJ (kernel);
+        }
     }
+  POCL_MEM_FREE (spec_args);
+  if (error)  return error;
 
   error = pocl_create_command (&command_node, command_queue,
                                CL_COMMAND_NDRANGE_KERNEL,
@@ -289,6 +527,10 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   command_node->command.run.tmp_dir = strdup(cachedir);
   command_node->command.run.kernel = kernel;
   command_node->command.run.pc = pc;
+  /* Set by the devices supporting the work-group range launchers. */
+  command_node->command.run.wg_range = NULL;
+  command_node->command.run.autotune = autotune;
+  command_node->command.run.autotune_candidate = autotune_candidate;
   command_node->command.run.local_x = local_x;
   command_node->command.run.local_y = local_y;
   command_node->command.run.local_z = local_z;
@@ -27,9 +27,14 @@
 #include "utlist.h"
 #include "clEnqueueMapBuffer.h"
 #include "pocl_mem_management.h"
+#include "pocl_autotune.h"
 
 static void exec_commands (_cl_command_node *node_list);
 
+/* The size of the pattern filled host block written to the buffers of
+   the devices without a fill operation. */
+#define FILL_BLOCK_SIZE (64 * 1024)
+
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clFinish)(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 {
@@ -94,6 +99,36 @@ POname(clFinish)(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 }
 POsym(clFinish)
 
+/* Fills a buffer of a device without a fill operation by writing a host
+   block filled with the pattern over it. */
+static void
+fill_with_writes (_cl_command_node *node)
+{
+  _cl_command_fill *fill = &node->command.fill;
+  size_t block_size = min (fill->size, FILL_BLOCK_SIZE);
+  size_t offset;
+  char *block = (char*) malloc (block_size);
+
+  if (block == NULL)
+    {
+      block = (char*)fill->pattern;
+      block_size = fill->pattern_size;
+    }
+  else
+    {
+      for (offset = 0; offset < block_size; offset += fill->pattern_size)
+        memcpy (block + offset, fill->pattern, fill->pattern_size);
+    }
+
+  for (offset = 0; offset < fill->size; offset += block_size)
+    node->device->ops->write (fill->data, block,
+                              (char*)fill->device_ptr + offset,
+                              min (block_size, fill->size - offset));
+
+  if (block != fill->pattern)
+    POCL_MEM_FREE (block);
+}
+
 static void exec_commands (_cl_command_node *node_list)
 {
   int i;
@@ -101,6 +136,7 @@ static void exec_commands (_cl_command_node *node_list)
   _cl_command_node *node;
   cl_command_queue command_queue = NULL;
   event_callback_item* cb_ptr;
+  cl_ulong start_time = 0;
   
   LL_FOREACH (node_list, node)
     {
@@ -206,7 +242,22 @@ static void exec_commands (_cl_command_node *node_list)
         case CL_COMMAND_NDRANGE_KERNEL:
           assert (*event == node->event);
           POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+          if (node->command.run.autotune != NULL)
+            start_time =
+              node->device->ops->get_timer_value (node->device->data);
           node->device->ops->run(node->command.run.data, node);
+          if (node->command.run.autotune != NULL)
+            {
+              struct pocl_context *pc = &node->command.run.pc;
+              pocl_autotune_record
+                (node->command.run.kernel, node->command.run.autotune,
+                 node->command.run.autotune_candidate,
+                 pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2] *
+                 node->command.run.local_x * node->command.run.local_y *
+                 node->command.run.local_z,
+                 node->device->ops->get_timer_value (node->device->data) -
+                 start_time);
+            }
           POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
           for (i = 0; i < node->command.run.arg_buffer_count; ++i)
             {
@@ -241,6 +292,21 @@ static void exec_commands (_cl_command_node *node_list)
           POCL_MEM_FREE(node->command.native.mem_list);
           POCL_MEM_FREE(node->command.native.args);
 	      break;
+        case CL_COMMAND_FILL_BUFFER:
+          POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+          if (node->device->ops->fill != NULL)
+            node->device->ops->fill
+              (node->command.fill.data,
+               node->command.fill.device_ptr,
+               node->command.fill.size,
+               node->command.fill.pattern,
+               node->command.fill.pattern_size);
+          else
+            fill_with_writes (node);
+          POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+          POCL_MEM_FREE(node->command.fill.pattern);
+          POname(clReleaseMemObject) (node->command.fill.buffer);
+          break;
         case CL_COMMAND_FILL_IMAGE:
           POCL_UPDATE_EVENT_RUNNING(event, command_queue);
           node->device->ops->fill_rect 
@@ -259,6 +325,24 @@ static void exec_commands (_cl_command_node *node_list)
           POCL_UPDATE_EVENT_RUNNING(event, command_queue);
           POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
           break;
+        case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+          POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+          for (i = 0; i < node->command.migrate.num_mem_objects; ++i)
+            {
+              cl_mem buf = node->command.migrate.mem_objects[i];
+              /* The host pointer buffers stay where the application
+                 placed them. */
+              if (node->device->ops->migrate_mem != NULL &&
+                  !(buf->flags & CL_MEM_USE_HOST_PTR))
+                node->device->ops->migrate_mem
+                  (node->command.migrate.data,
+                   buf->device_ptrs[node->device->dev_id].mem_ptr,
+                   buf->size, node->command.migrate.flags);
+              POname(clReleaseMemObject) (buf);
+            }
+          POCL_MEM_FREE(node->command.migrate.mem_objects);
+          POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+          break;
         default:
           POCL_ABORT_UNIMPLEMENTED("clFinish: Unknown command");
           break;
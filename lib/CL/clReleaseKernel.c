@@ -23,6 +23,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_util.h"
+#include "pocl_autotune.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
@@ -72,6 +73,10 @@ POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
         }
 
       POCL_MEM_FREE(kernel->dyn_arguments);
+      POCL_MEM_FREE(kernel->spec_values);
+      POCL_MEM_FREE(kernel->spec_repeats);
+      POCL_MEM_FREE(kernel->wg_cachedir);
+      pocl_autotune_free (kernel);
       POCL_MEM_FREE(kernel->reqd_wg_size);
       POCL_MEM_FREE(kernel);
     }
@@ -23,6 +23,7 @@
 
 #include "utlist.h"
 #include "pocl_cl.h"
+#include "pocl_util.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
@@ -54,6 +55,8 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
               device_id->ops->free(device_id->data, memobj->flags, memobj->device_ptrs[device_id->dev_id].mem_ptr);
               memobj->device_ptrs[device_id->dev_id].mem_ptr = NULL;
             }
+          if (memobj->file_map != NULL)
+            pocl_unmap_file (memobj->file_map, memobj->file_map_size);
         } else 
         {
           /* a sub buffer object does not free the memory from
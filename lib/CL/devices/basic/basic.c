@@ -205,6 +205,7 @@ pocl_basic_init_device_ops(struct pocl_device_ops *ops)
   ops->write_rect = pocl_basic_write_rect;
   ops->copy = pocl_basic_copy;
   ops->copy_rect = pocl_basic_copy_rect;
+  ops->fill = pocl_basic_fill;
   ops->fill_rect = pocl_basic_fill_rect;
   ops->map_mem = pocl_basic_map_mem;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
@@ -240,14 +241,16 @@ pocl_basic_init_device_infos(struct _cl_device_id* dev)
   dev->preferred_vector_width_float = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_FLOAT;
   dev->preferred_vector_width_double = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_DOUBLE;
   dev->preferred_vector_width_half = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_HALF;
-  /* TODO: figure out what the difference between preferred and native widths are */
-  dev->native_vector_width_char = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_CHAR;
-  dev->native_vector_width_short = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_SHORT;
-  dev->native_vector_width_int = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_INT;
-  dev->native_vector_width_long = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_LONG;
-  dev->native_vector_width_float = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_FLOAT;
-  dev->native_vector_width_double = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_DOUBLE;
-  dev->native_vector_width_half = POCL_DEVICES_PREFERRED_VECTOR_WIDTH_HALF;
+  /* These are the compile time defaults of the host pocl was built for.
+     The host devices override them with the widths of the ISA detected
+     at runtime in pocl_cpuinfo_detect_device_info(). */
+  dev->native_vector_width_char = POCL_DEVICES_NATIVE_VECTOR_WIDTH_CHAR;
+  dev->native_vector_width_short = POCL_DEVICES_NATIVE_VECTOR_WIDTH_SHORT;
+  dev->native_vector_width_int = POCL_DEVICES_NATIVE_VECTOR_WIDTH_INT;
+  dev->native_vector_width_long = POCL_DEVICES_NATIVE_VECTOR_WIDTH_LONG;
+  dev->native_vector_width_float = POCL_DEVICES_NATIVE_VECTOR_WIDTH_FLOAT;
+  dev->native_vector_width_double = POCL_DEVICES_NATIVE_VECTOR_WIDTH_DOUBLE;
+  dev->native_vector_width_half = POCL_DEVICES_NATIVE_VECTOR_WIDTH_HALF;
   dev->max_clock_frequency = 0;
   dev->address_bits = POCL_DEVICE_ADDRESS_BITS;
 
@@ -353,8 +356,7 @@ pocl_basic_init (cl_device_id device, const char* parameters)
      using multiple OpenCL devices. */
   device->max_compute_units = 1;
 
-  if(!strcmp(device->llvm_cpu, "(unknown)"))
-    device->llvm_cpu = NULL;
+  pocl_init_host_llvm_cpu (device);
 
   // work-around LLVM bug where sizeof(long)=4
   #ifdef _CL_DISABLE_LONG
@@ -370,7 +372,7 @@ pocl_basic_malloc (void *device_data, cl_mem_flags flags,
 
   if (flags & CL_MEM_COPY_HOST_PTR)
     {
-      b = pocl_memalign_alloc(MAX_EXTENDED_ALIGNMENT, size);
+      b = pocl_memalign_alloc_mem(MAX_EXTENDED_ALIGNMENT, size, flags);
       if (b != NULL)
         {
           memcpy(b, host_ptr, size);
@@ -384,7 +386,7 @@ pocl_basic_malloc (void *device_data, cl_mem_flags flags,
     {
       return host_ptr;
     }
-  b = pocl_memalign_alloc(MAX_EXTENDED_ALIGNMENT, size);
+  b = pocl_memalign_alloc_mem(MAX_EXTENDED_ALIGNMENT, size, flags);
   if (b != NULL)
     return b;
   
@@ -407,7 +409,8 @@ pocl_basic_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
         }
       else
         {
-          b = pocl_memalign_alloc(MAX_EXTENDED_ALIGNMENT, mem_obj->size);
+          b = pocl_memalign_alloc_mem(MAX_EXTENDED_ALIGNMENT, mem_obj->size,
+                                      flags);
           if (b == NULL)
             return CL_MEM_OBJECT_ALLOCATION_FAILURE;
         }
@@ -432,7 +435,7 @@ pocl_basic_free (void *data, cl_mem_flags flags, void *ptr)
   if (flags & CL_MEM_USE_HOST_PTR)
     return;
   
-  POCL_MEM_FREE(ptr);
+  pocl_memalign_free(ptr);
 }
 
 void
@@ -539,6 +542,14 @@ pocl_basic_run
     {
       for (y = 0; y < pc->num_groups[1]; ++y)
         {
+          if (cmd->command.run.wg_range != NULL)
+            {
+              pc->group_id[0] = 0;
+              pc->group_id[1] = y;
+              pc->group_id[2] = z;
+              cmd->command.run.wg_range (arguments, pc, pc->num_groups[0]);
+              continue;
+            }
           for (x = 0; x < pc->num_groups[0]; ++x)
             {
               pc->group_id[0] = x;
@@ -685,6 +696,13 @@ pocl_basic_read_rect (void *data,
               region[0]);
 }
 
+void
+pocl_basic_fill (void *data, void *device_ptr, size_t size,
+                 const void *pattern, size_t pattern_size)
+{
+  pocl_fill_pattern (device_ptr, size, pattern, pattern_size, 0);
+}
+
 /* origin and region must be in original shape unlike in copy/read/write_rect()
  */
 void
@@ -702,14 +720,13 @@ pocl_basic_fill_rect (void *data,
     + buffer_row_pitch * buffer_origin[1] 
     + buffer_slice_pitch * buffer_origin[2];
     
-  size_t i, j, k;
+  size_t j, k;
 
   for (k = 0; k < region[2]; ++k)
     for (j = 0; j < region[1]; ++j)
-      for (i = 0; i < region[0]; ++i)
-        memcpy (adjusted_device_ptr + pixel_size * i 
-                + buffer_row_pitch * j 
-                + buffer_slice_pitch * k, fill_pixel, pixel_size);
+      pocl_fill_pattern (adjusted_device_ptr + buffer_row_pitch * j
+                         + buffer_slice_pitch * k, region[0] * pixel_size,
+                         fill_pixel, pixel_size, 0);
 }
 
 void *
@@ -771,12 +788,80 @@ struct compiler_cache_item
   char *tmp_dir;
   char *function_name;
   pocl_workgroup wg;
+  pocl_workgroup_range wg_range;
+  /* The launchers specialized for a zero global offset and
+     spec_work_dim dimensions, NULL if the kernel has none. */
+  unsigned spec_work_dim;
+  pocl_workgroup spec_wg;
+  pocl_workgroup_range spec_wg_range;
   compiler_cache_item *next;
 };
 
 static compiler_cache_item *compiler_cache;
 static pocl_lock_t compiler_cache_lock;
 
+/* Picks the launchers of the cached kernel for the command: the
+   specialized ones in case the launch matches them. */
+static void
+select_workgroup_function (_cl_command_node *cmd, compiler_cache_item *ci)
+{
+  struct pocl_context *pc = &cmd->command.run.pc;
+  if (ci->spec_wg != NULL && pc->work_dim == ci->spec_work_dim &&
+      pc->global_offset[0] == 0 && pc->global_offset[1] == 0 &&
+      pc->global_offset[2] == 0)
+    {
+      cmd->command.run.wg = ci->spec_wg;
+      cmd->command.run.wg_range = ci->spec_wg_range;
+    }
+  else
+    {
+      cmd->command.run.wg = ci->wg;
+      cmd->command.run.wg_range = ci->wg_range;
+    }
+}
+
+/**
+ * Generates the binaries of all the ISA level variants of a
+ * multi-versioned work-group function, so hosts of other ISA levels
+ * sharing the kernel cache find theirs ready.
+ *
+ * @return The binary of the most capable variant the CPU can execute.
+ */
+static const char*
+codegen_isa_variants (_cl_command_node *cmd)
+{
+  cl_device_id device = cmd->device;
+  int host_level = pocl_cpuinfo_detect_isa_level ();
+  char variant_dir[POCL_FILENAME_LENGTH];
+  char *module_fn = NULL;
+  int level, chosen = POCL_ISA_LEVEL_NATIVE;
+
+  for (level = 0; level < POCL_ISA_LEVEL_COUNT; ++level)
+    {
+      char *fn;
+      if (!(device->isa_variants & (1u << level)))
+        continue;
+
+      snprintf (variant_dir, POCL_FILENAME_LENGTH, "%s/%s",
+                cmd->command.run.tmp_dir, pocl_isa_level_name (level));
+      fn = (char*) llvm_codegen (variant_dir, cmd->command.run.kernel,
+                                 device, level);
+      if (level <= host_level)
+        {
+          POCL_MEM_FREE (module_fn);
+          module_fn = fn;
+          chosen = level;
+        }
+      else
+        free (fn);
+    }
+  assert (module_fn != NULL);
+  POCL_MSG_PRINT_INFO ("Using the %s variant of kernel %s\n",
+                       pocl_isa_level_name (chosen),
+                       cmd->command.run.kernel->name);
+  return module_fn;
+}
+
 void check_compiler_cache (_cl_command_node *cmd)
 {
   char workgroup_string[WORKGROUP_STRING_LENGTH];
@@ -794,7 +879,7 @@ void check_compiler_cache (_cl_command_node *cmd)
                   cmd->command.run.kernel->function_name) == 0)
         {
           POCL_UNLOCK (compiler_cache_lock);
-          cmd->command.run.wg = ci->wg;
+          select_workgroup_function (cmd, ci);
           return;
         }
     }
@@ -802,9 +887,13 @@ void check_compiler_cache (_cl_command_node *cmd)
   ci->next = NULL;
   ci->tmp_dir = strdup(cmd->command.run.tmp_dir);
   ci->function_name = strdup (cmd->command.run.kernel->function_name);
-  const char* module_fn = llvm_codegen (cmd->command.run.tmp_dir,
-                                        cmd->command.run.kernel,
-                                        cmd->device);
+  const char* module_fn;
+  if (cmd->device->isa_variants)
+    module_fn = codegen_isa_variants (cmd);
+  else
+    module_fn = llvm_codegen (cmd->command.run.tmp_dir,
+                              cmd->command.run.kernel,
+                              cmd->device, POCL_ISA_LEVEL_NATIVE);
   dlhandle = lt_dlopen (module_fn);
   if (dlhandle == NULL)
     {
@@ -816,8 +905,31 @@ void check_compiler_cache (_cl_command_node *cmd)
     }
   snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
             "_%s_workgroup", cmd->command.run.kernel->function_name);
-  cmd->command.run.wg = ci->wg = 
-    (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
+  ci->wg = (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_%s_workgroup_range", cmd->command.run.kernel->function_name);
+  ci->wg_range = (pocl_workgroup_range) lt_dlsym (dlhandle, workgroup_string);
+
+  /* The kernel compiler generates the specialized launchers for the
+     work_dim of the launch which compiled the kernel, if any. */
+  ci->spec_wg = NULL;
+  ci->spec_wg_range = NULL;
+  for (ci->spec_work_dim = 1; ci->spec_work_dim <= 3; ++ci->spec_work_dim)
+    {
+      snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+                "_%s_offset0_dim%u_workgroup",
+                cmd->command.run.kernel->function_name, ci->spec_work_dim);
+      ci->spec_wg = (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
+      if (ci->spec_wg == NULL)
+        continue;
+      snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+                "_%s_offset0_dim%u_workgroup_range",
+                cmd->command.run.kernel->function_name, ci->spec_work_dim);
+      ci->spec_wg_range =
+        (pocl_workgroup_range) lt_dlsym (dlhandle, workgroup_string);
+      break;
+    }
+  select_workgroup_function (cmd, ci);
 
   LL_APPEND (compiler_cache, ci);
   POCL_UNLOCK (compiler_cache_lock);
@@ -43,10 +43,16 @@
  * lead to large physical chunks allocated for each kernel's buffers
  * which are also deallocated back to large region chunks.
  *
- * 2) The total number of allocations is not large.
+ * 2) The number of allocations can be large.
  *
- * Traversing through the list of chunk infos when searching for an
- * available freed chunk can be considered to be not very costly.
+ * Applications churning temporary buffers allocate and free thousands
+ * of them. The unallocated chunks are kept in segregated free lists by
+ * their size class, from which a fitting chunk is found without going
+ * through the chunks of the region, and the allocated chunks in a hash
+ * table by their start address, so freeing a buffer is a constant time
+ * operation. The chunk infos of the region are allocated dynamically
+ * in blocks once the statically allocated ones run out (except in the
+ * TCE standalone mode).
  *
  * 3a) There is no lack of (global) memory. 
  *
@@ -94,24 +100,204 @@ print_chunks (chunk_info_t *first)
     }
 }
 
+static size_t
+align_size (memory_region_t *region, size_t size)
+{
+  return (size + region->alignment - 1) & ~(size_t)(region->alignment - 1);
+}
+
+static unsigned
+size_class (size_t size)
+{
+  unsigned c = 0;
+  while (size > 1 && c < BA_SIZE_CLASSES - 1)
+    {
+      size >>= 1;
+      ++c;
+    }
+  return c;
+}
+
+static void
+free_list_insert (memory_region_t *region, chunk_info_t *chunk)
+{
+  chunk_info_t **head = &region->free_lists[size_class (chunk->size)];
+  chunk->free_prev = NULL;
+  chunk->free_next = *head;
+  if (*head != NULL)
+    (*head)->free_prev = chunk;
+  *head = chunk;
+}
+
+static void
+free_list_remove (memory_region_t *region, chunk_info_t *chunk)
+{
+  if (chunk->free_prev != NULL)
+    chunk->free_prev->free_next = chunk->free_next;
+  else
+    region->free_lists[size_class (chunk->size)] = chunk->free_next;
+  if (chunk->free_next != NULL)
+    chunk->free_next->free_prev = chunk->free_prev;
+  chunk->free_next = chunk->free_prev = NULL;
+}
+
+static unsigned
+chunk_hash (memory_region_t *region, memory_address_t addr)
+{
+  return (unsigned)((addr >> 6) * 2654435761u) & (region->chunk_table_size - 1);
+}
+
+static void
+table_insert (memory_region_t *region, chunk_info_t *chunk)
+{
+  unsigned i = chunk_hash (region, chunk->start_address);
+  while (region->chunk_table[i] != NULL)
+    i = (i + 1) & (region->chunk_table_size - 1);
+  region->chunk_table[i] = chunk;
+}
+
+static chunk_info_t *
+table_find (memory_region_t *region, memory_address_t addr)
+{
+  unsigned i = chunk_hash (region, addr);
+  while (region->chunk_table[i] != NULL)
+    {
+      if (region->chunk_table[i]->start_address == addr)
+        return region->chunk_table[i];
+      i = (i + 1) & (region->chunk_table_size - 1);
+    }
+  return NULL;
+}
+
+/* Removes the chunk from the table, moving back the following entries
+   of the probe sequence so that no tombstones are needed. */
+static void
+table_remove (memory_region_t *region, chunk_info_t *chunk)
+{
+  unsigned mask = region->chunk_table_size - 1;
+  unsigned i = chunk_hash (region, chunk->start_address);
+  unsigned j, home;
+
+  while (region->chunk_table[i] != chunk)
+    i = (i + 1) & mask;
+  region->chunk_table[i] = NULL;
+
+  for (j = (i + 1) & mask; region->chunk_table[j] != NULL; j = (j + 1) & mask)
+    {
+      home = chunk_hash (region, region->chunk_table[j]->start_address);
+      /* Move the entry to the hole unless its home slot is cyclically
+         in (i, j]. */
+      if ((j > i && (home <= i || home > j)) ||
+          (j < i && (home <= i && home > j)))
+        {
+          region->chunk_table[i] = region->chunk_table[j];
+          region->chunk_table[j] = NULL;
+          i = j;
+        }
+    }
+}
+
+#ifndef __TCE_STANDALONE__
+/* A block of dynamically allocated chunk infos. */
+typedef struct chunk_block chunk_block;
+struct chunk_block
+{
+  chunk_block *next;
+  chunk_info_t chunks[MAX_CHUNKS_IN_REGION];
+};
+
+/**
+ * Allocates more chunk infos for the region and grows the chunk table
+ * to keep its load factor at most one half.
+ *
+ * @return 0 if the allocation fails.
+ */
 static int
-chunk_slack (chunk_info_t* chunk, size_t size, size_t* last_chunk_size)
+grow_chunk_infos (memory_region_t *region)
+{
+  chunk_block *block = (chunk_block*) malloc (sizeof (chunk_block));
+  chunk_info_t **table, **old_table = region->chunk_table;
+  unsigned i, old_size = region->chunk_table_size;
+
+  if (block == NULL)
+    return 0;
+
+  if (2 * (region->num_chunk_infos + MAX_CHUNKS_IN_REGION) > old_size)
+    {
+      table = (chunk_info_t**) calloc (old_size * 2, sizeof (chunk_info_t*));
+      if (table == NULL)
+        {
+          free (block);
+          return 0;
+        }
+      region->chunk_table = table;
+      region->chunk_table_size = old_size * 2;
+      for (i = 0; i < old_size; ++i)
+        {
+          if (old_table[i] != NULL)
+            table_insert (region, old_table[i]);
+        }
+      if (old_table != region->chunk_table_storage)
+        free (old_table);
+    }
+
+  block->next = (chunk_block*) region->chunk_blocks;
+  region->chunk_blocks = block;
+  for (i = 0; i < MAX_CHUNKS_IN_REGION; ++i)
+    DL_APPEND (region->free_chunks, &block->chunks[i]);
+  region->num_chunk_infos += MAX_CHUNKS_IN_REGION;
+  return 1;
+}
+#endif
+
+/* Returns an unused chunk info of the region, NULL if none is left. */
+static chunk_info_t *
+get_chunk_info (memory_region_t *region)
 {
-  memory_address_t aligned_start_addr = 
-    (chunk->start_address + chunk->parent_region->alignment - 1) &
-    ~(chunk->parent_region->alignment - 1);
-  size_t end_chunk = chunk->start_address + chunk->size;
-  size_t end_addr = aligned_start_addr + size;
-  if(last_chunk_size)
-    *last_chunk_size = end_chunk - end_addr;
-  return end_chunk > end_addr;
+  chunk_info_t *chunk = region->free_chunks;
+#ifndef __TCE_STANDALONE__
+  if (chunk == NULL && grow_chunk_infos (region))
+    chunk = region->free_chunks;
+#endif
+  if (chunk == NULL)
+    return NULL;
+  DL_DELETE (region->free_chunks, chunk);
+  chunk->parent_region = region;
+  chunk->children = NULL;
+  chunk->parent = NULL;
+  chunk->free_next = chunk->free_prev = NULL;
+  return chunk;
+}
+
+/* Removes the chunk from the chunks of the region and recycles its info. */
+static void
+put_chunk_info (memory_region_t *region, chunk_info_t *chunk)
+{
+  DL_DELETE (region->chunks, chunk);
+  DL_APPEND (region->free_chunks, chunk);
+}
+
+/* Inserts the new chunk after the given one in the address ordered
+   chunk list. */
+static void
+insert_chunk_after (memory_region_t *region, chunk_info_t *chunk,
+                    chunk_info_t *new_chunk)
+{
+  new_chunk->prev = chunk;
+  new_chunk->next = chunk->next;
+  if (chunk->next != NULL)
+    chunk->next->prev = new_chunk;
+  else
+    region->chunks->prev = new_chunk;
+  chunk->next = new_chunk;
 }
 
 /**
  * Tries to create a new chunk to the end of the given region.
  *
  * Assumes the last_chunk is always the last chunk in the region and
- * it is unallocated in case there is free space at the end.
+ * it is unallocated in case there is free space at the end. Must be
+ * called inside a locked region, with the size aligned.
  *
  * @return The address of the chunk if it fits, 0 otherwise.
  */
@@ -119,109 +305,136 @@ static chunk_info_t *
 append_new_chunk (memory_region_t *region, 
                   size_t size) 
 {
-
-  chunk_info_t* new_chunk = NULL;
-  BA_LOCK (region->lock);
-
-  assert (!region->last_chunk->is_allocated);
+  chunk_info_t *last = region->last_chunk;
+  chunk_info_t *new_chunk = NULL;
+  memory_address_t aligned_start = 
+    (last->start_address + region->alignment - 1) &
+    ~(memory_address_t)(region->alignment - 1);
+  memory_address_t end = last->start_address + last->size;
+
+  assert (!last->is_allocated);
   /* if the last_chunk is too small we cannot append
      a new chunk before it */
-  if (!chunk_slack (region->last_chunk, size, NULL))
-    {
-      BA_UNLOCK (region->lock);
-      return NULL;
-    }
+  if (aligned_start + size > end)
+    return NULL;
 
   /* ok, there should be space at the end, create a new chunk
      before the last_chunk */
-  new_chunk = region->free_chunks;
-
+  new_chunk = get_chunk_info (region);
   if (new_chunk == NULL)
-    {
-      BA_UNLOCK (region->lock);
-      return NULL;
-    } 
-  else 
-    {
-      DL_DELETE (region->free_chunks, new_chunk);
-    }
+    return NULL;
 
-  /* Round the start address up towards the closest aligned
-     address. */
-  new_chunk->start_address = 
-    (region->last_chunk->start_address + region->alignment - 1) &
-    ~(region->alignment - 1); 
-  new_chunk->parent_region = region;
+  new_chunk->start_address = aligned_start;
   new_chunk->size = size;
   new_chunk->is_allocated = 1;
-  new_chunk->children = NULL;
 
-  chunk_slack (region->last_chunk, size, (size_t*)&region->last_chunk->size);
-  region->last_chunk->start_address = 
-    new_chunk->start_address + new_chunk->size;
+  last->start_address = aligned_start + size;
+  last->size = end - last->start_address;
 
-  DL_DELETE (region->chunks, region->last_chunk);
+  DL_DELETE (region->chunks, last);
   DL_APPEND (region->chunks, new_chunk);
-  DL_APPEND (region->chunks, region->last_chunk);
+  DL_APPEND (region->chunks, last);
+  table_insert (region, new_chunk);
 
 #ifdef DEBUG_BUFALLOC
   printf ("#### after append_new_chunk (%x, %u)\n", region, size);
   print_chunks (region->chunks);
   printf ("\n");
 #endif
-  
-  BA_UNLOCK (region->lock);
 
   return new_chunk;
 }
 
+/* The number of chunks of the smallest fitting size class to check
+   before taking a chunk from the larger classes, which all fit. */
+#define SIZE_CLASS_SCAN 4
+
 /**
- * Allocates a chunk of memory from the given memory region.
+ * Reuses an unallocated chunk from the free lists of the region,
+ * splitting off the part left over. Must be called inside a locked
+ * region, with the size aligned.
  *
- * @return The chunk, or NULL if no space available in the region.
+ * @return The chunk, or NULL if none fits.
  */
-chunk_info_t* 
-alloc_buffer_from_region (memory_region_t *region, size_t size) 
+static chunk_info_t *
+reuse_free_chunk (memory_region_t *region, size_t size)
 {
-  assert (region != NULL);
-  /* The memory-wasteful but fast strategy:
+  chunk_info_t *chunk = NULL, *rest;
+  unsigned c = size_class (size), scanned = 0;
 
-     Assume there's plenty of memory so just try to append the
-     buffer to the end of the region without trying to reuse
-     unallocated ones first. */
-  chunk_info_t* chunk = NULL, *cursor;
-  if (region->strategy == BALLOCS_WASTEFUL)
+  for (chunk = region->free_lists[c];
+       chunk != NULL && scanned < SIZE_CLASS_SCAN;
+       chunk = chunk->free_next, ++scanned)
+    {
+      if (chunk->size >= size)
+        break;
+    }
+  if (chunk == NULL || chunk->size < size)
     {
-      chunk = append_new_chunk(region, size);
-      if (chunk != NULL) return chunk;
+      chunk = NULL;
+      for (++c; c < BA_SIZE_CLASSES && chunk == NULL; ++c)
+        chunk = region->free_lists[c];
     }
+  if (chunk == NULL)
+    return NULL;
 
-  BA_LOCK (region->lock);
-  
-  DL_FOREACH (region->chunks, cursor) 
+  free_list_remove (region, chunk);
+  chunk->is_allocated = 1;
+
+  if (chunk->size > size && (rest = get_chunk_info (region)) != NULL)
     {
-      if (cursor == region->last_chunk ||
-          cursor->is_allocated || 
-          !chunk_slack (cursor, size, NULL))
-        continue; /* doesn't fit */
-      /* found one */
-      chunk = cursor;
-      chunk->is_allocated = 1;
+      rest->start_address = chunk->start_address + size;
+      rest->size = chunk->size - size;
+      rest->is_allocated = 0;
+      chunk->size = size;
+      insert_chunk_after (region, chunk, rest);
+      /* The chunk after an unallocated one is always allocated, except
+         for the last chunk. */
+      if (rest->next == region->last_chunk)
+        {
+          rest->size += region->last_chunk->size;
+          put_chunk_info (region, region->last_chunk);
+          region->last_chunk = rest;
+        }
+      else
+        free_list_insert (region, rest);
+    }
+  table_insert (region, chunk);
 
 #ifdef DEBUG_BUFALLOC
-      printf ("#### after reusing a chunk in region %x\n", region);
-      print_chunks (region->chunks);
-      printf ("\n");
+  printf ("#### after reusing a chunk in region %x\n", region);
+  print_chunks (region->chunks);
+  printf ("\n");
 #endif
-      break;
-    }
+  return chunk;
+}
 
-  BA_UNLOCK (region->lock);
+/**
+ * Allocates a chunk of memory from the given memory region.
+ *
+ * @return The chunk, or NULL if no space available in the region.
+ */
+chunk_info_t* 
+alloc_buffer_from_region (memory_region_t *region, size_t size) 
+{
+  chunk_info_t* chunk = NULL;
+  assert (region != NULL);
+
+  size = align_size (region, size);
+  BA_LOCK (region->lock);
+  /* The memory-wasteful but fast strategy:
 
+     Assume there's plenty of memory so just try to append the
+     buffer to the end of the region before trying to reuse
+     unallocated ones. */
+  if (region->strategy == BALLOCS_WASTEFUL)
+    chunk = append_new_chunk (region, size);
+  if (chunk == NULL)
+    chunk = reuse_free_chunk (region, size);
   if (chunk == NULL && region->strategy != BALLOCS_WASTEFUL) 
-    {
-      return append_new_chunk (region, size);
-    } 
+    chunk = append_new_chunk (region, size);
+  BA_UNLOCK (region->lock);
+
   return chunk;
 }
 
@@ -243,6 +456,8 @@ alloc_buffer (memory_region_t *regions, size_t size)
   memory_region_t *region = NULL;
   LL_FOREACH(regions, region) 
     {
+      if (region->size < size)
+        continue;
       chunk = alloc_buffer_from_region (region, size);
       if (chunk != NULL)
         return chunk;
@@ -267,82 +482,106 @@ create_sub_chunk (chunk_info_t *parent, size_t offset, size_t size)
   return subchunk;
 }
 
-
 /**
- * Merges two unallocated chunks together to a larger chunk, if both
- * are unallocated.
- *
- * The first chunk must before the second chunk in the memory region.
- * Must be called inside a locked region.
- *
- * @return A pointer to the coalesced chunk, or the second chunk in case
- * coalsecing could not be done. 
+ * Marks the chunk unallocated and merges it with the unallocated
+ * chunks next to it. Must be called inside a locked region.
  */
-static chunk_info_t * 
-coalesce_chunks (chunk_info_t* first, 
-                 chunk_info_t* second)
+static void
+release_chunk (memory_region_t *region, chunk_info_t *chunk)
 {
-  if (first == NULL) return second;
-  if (second == NULL) return first;
-  if (first->is_allocated || second->is_allocated) return second;
+  chunk_info_t *prev = chunk->prev, *next;
 
-  /* The linked list head has a prev pointing to the last (sentinel),
-     detect that here and do not merge first with the second. */
-  if (first->start_address > second->start_address) return second;
-
-#ifdef DEBUG_BUFALLOC
-  printf ("### coalescing chunks:\n");
-  print_chunk (first);
-  print_chunk (second);
-  puts ("\n");
-#endif
+  table_remove (region, chunk);
+  chunk->is_allocated = 0;
 
-  /* Should not just add the size of the second chunk as we might have
-     done alignment adjustment to the start address */
-  first->size = second->start_address + second->size - first->start_address;
-  DL_DELETE (first->parent_region->chunks, second);
-  DL_APPEND (first->parent_region->free_chunks, second);
+  /* The head of the list has a prev pointing to the last chunk, which
+     is never before it. */
+  if (chunk != region->chunks && !prev->is_allocated)
+    {
+      free_list_remove (region, prev);
+      prev->size = chunk->start_address + chunk->size - prev->start_address;
+      put_chunk_info (region, chunk);
+      chunk = prev;
+    }
 
-  /* Did we coalesce away the sentinel chunk? Need to set it to
-     a new valid one. */
-  if (second->parent_region->last_chunk == second)
-      second->parent_region->last_chunk = first;
+  next = chunk->next;
+  if (next != NULL && !next->is_allocated)
+    {
+      /* Should not just add the size of the second chunk as we might
+         have done alignment adjustment to the start address */
+      chunk->size = next->start_address + next->size - chunk->start_address;
+      if (next == region->last_chunk)
+        {
+          /* Coalesced away the sentinel chunk, the merged one is the
+             new one and it is not in the free lists. */
+          put_chunk_info (region, next);
+          region->last_chunk = chunk;
+          return;
+        }
+      free_list_remove (region, next);
+      put_chunk_info (region, next);
+    }
+  free_list_insert (region, chunk);
+}
 
-  return first;
+static memory_region_t *
+find_region (memory_region_t *regions, memory_address_t addr)
+{
+  memory_region_t *region = NULL;
+  LL_FOREACH (regions, region)
+    {
+      if (addr >= region->start_address &&
+          addr < region->start_address + region->size)
+        return region;
+    }
+  return NULL;
 }
 
 memory_region_t *
 free_buffer (memory_region_t *regions, memory_address_t addr)
 {
-  memory_region_t *region = NULL;
+  memory_region_t *region = find_region (regions, addr);
+  chunk_info_t *chunk;
 
 #ifdef DEBUG_BUFALLOC
   printf ("#### free_buffer(%p, %x)\n", regions, addr);
 #endif
 
-  LL_FOREACH (regions, region) 
-    {
-      chunk_info_t *chunk = NULL;
-      BA_LOCK (region->lock);
-      DL_FOREACH (region->chunks, chunk)
-        {
-          if (chunk->start_address == addr) 
-            {
-              chunk->is_allocated = 0;
-              coalesce_chunks (coalesce_chunks (chunk->prev, chunk), chunk->next);
-              BA_UNLOCK (region->lock);
+  if (region == NULL)
+    return NULL;
+
+  BA_LOCK (region->lock);
+  chunk = table_find (region, addr);
+  if (chunk != NULL)
+    release_chunk (region, chunk);
+  BA_UNLOCK (region->lock);
+
 #ifdef DEBUG_BUFALLOC
-              printf ("#### region %x after free_buffer at addr %x\n", 
-                      region, addr);
-              print_chunks (region->chunks);
-              printf ("\n");
+  printf ("#### region %x after free_buffer at addr %x\n", region, addr);
+  print_chunks (region->chunks);
+  printf ("\n");
 #endif
-              return region;
-            }
-        }
-      BA_UNLOCK (region->lock);
-    }
-  return NULL;
+  return chunk != NULL ? region : NULL;
+}
+
+/**
+ * Finds the allocated chunk starting at the given address.
+ *
+ * @return The chunk, or NULL in case none of the regions has one.
+ */
+chunk_info_t *
+find_chunk (memory_region_t *regions, memory_address_t addr)
+{
+  memory_region_t *region = find_region (regions, addr);
+  chunk_info_t *chunk;
+
+  if (region == NULL)
+    return NULL;
+
+  BA_LOCK (region->lock);
+  chunk = table_find (region, addr);
+  BA_UNLOCK (region->lock);
+  return chunk;
 }
 
 /**
@@ -356,8 +595,7 @@ free_chunk (chunk_info_t* chunk)
 {
   memory_region_t *region = chunk->parent_region;
   BA_LOCK (region->lock);
-  chunk->is_allocated = 0;
-  coalesce_chunks (coalesce_chunks (chunk->prev, chunk), chunk->next);
+  release_chunk (region, chunk);
   BA_UNLOCK (region->lock);
 
 #ifdef DEBUG_BUFALLOC
@@ -383,6 +621,19 @@ init_mem_region (memory_region_t *region, memory_address_t start, size_t size)
   region->chunks = NULL;
   region->free_chunks = NULL;
   region->alignment = 64;
+  region->start_address = start;
+  region->size = size;
+
+  for (i = 0; i < BA_SIZE_CLASSES; ++i)
+    region->free_lists[i] = NULL;
+  for (i = 0; i < BA_CHUNK_TABLE_SIZE; ++i)
+    region->chunk_table_storage[i] = NULL;
+  region->chunk_table = region->chunk_table_storage;
+  region->chunk_table_size = BA_CHUNK_TABLE_SIZE;
+  region->num_chunk_infos = MAX_CHUNKS_IN_REGION;
+#ifndef __TCE_STANDALONE__
+  region->chunk_blocks = NULL;
+#endif
 
   /* Create the "sentinel chunk" */
   region->last_chunk = &region->all_chunks[0];
@@ -390,6 +641,7 @@ init_mem_region (memory_region_t *region, memory_address_t start, size_t size)
   region->last_chunk->size = size;
   region->last_chunk->is_allocated = 0;
   region->last_chunk->parent_region = region;
+  region->last_chunk->free_next = region->last_chunk->free_prev = NULL;
 
   DL_APPEND(region->chunks, region->last_chunk);
 
@@ -402,3 +654,25 @@ init_mem_region (memory_region_t *region, memory_address_t start, size_t size)
           region, start, size);
 #endif
 }
+
+#ifndef __TCE_STANDALONE__
+/**
+ * Frees the dynamically allocated book keeping data of the region, but
+ * not the memory it manages.
+ */
+void
+uninit_mem_region (memory_region_t *region)
+{
+  chunk_block *block = (chunk_block*) region->chunk_blocks, *next;
+  while (block != NULL)
+    {
+      next = block->next;
+      free (block);
+      block = next;
+    }
+  region->chunk_blocks = NULL;
+  if (region->chunk_table != region->chunk_table_storage)
+    free (region->chunk_table);
+  region->chunk_table = region->chunk_table_storage;
+}
+#endif
@@ -71,12 +71,25 @@ typedef tce_sm_lock ba_lock_t;
 #endif
 
 /* The number of chunks in a region should be scaled to an approximate
-   maximum number of kernel buffer arguments. Running out of chunk 
-   data structures might leave region space unused due to that only. */
+   maximum number of kernel buffer arguments. In the TCE standalone mode
+   running out of chunk data structures might leave region space unused
+   due to that only, elsewhere more are allocated in blocks of this many
+   chunks. */
 #ifndef MAX_CHUNKS_IN_REGION
 #define MAX_CHUNKS_IN_REGION 64
 #endif
 
+/* The number of size classes of the free lists. The class of a chunk
+   is the base 2 logarithm of its size rounded down, the last class
+   holds all the larger ones. */
+#ifndef BA_SIZE_CLASSES
+#define BA_SIZE_CLASSES 48
+#endif
+
+/* The initial size of the hash table from the start addresses of the
+   allocated chunks to the chunks, a power of two. */
+#define BA_CHUNK_TABLE_SIZE (MAX_CHUNKS_IN_REGION * 2)
+
 /* address-space agnostic memory address */
 typedef size_t memory_address_t;
 
@@ -108,6 +121,10 @@ struct chunk_info
   chunk_info_t* children;
   chunk_info_t* parent;
   memory_region_t* parent_region;
+  /* The links in the free list of the size class of the chunk while it
+     is unallocated. */
+  chunk_info_t* free_next;
+  chunk_info_t* free_prev;
 };
 
 /* Represents a single continuous region of memory from which smaller
@@ -129,6 +146,18 @@ struct memory_region
                                the last chunk is allocated, the region 
                                is completely full. New chunks should be inserted
                                before this chunk. */
+  chunk_info_t *free_lists[BA_SIZE_CLASSES]; /* The unallocated chunks before
+                                                the last chunk by size class. */
+  chunk_info_t **chunk_table; /* Open addressing hash table of the allocated
+                                 chunks by their start address. */
+  chunk_info_t *chunk_table_storage[BA_CHUNK_TABLE_SIZE];
+  unsigned chunk_table_size;
+  unsigned num_chunk_infos;
+#ifndef __TCE_STANDALONE__
+  void *chunk_blocks; /* The dynamically allocated chunk info blocks. */
+#endif
+  memory_address_t start_address;
+  size_t size;
   memory_region_t *next;
   memory_region_t *prev;
   enum allocation_strategy strategy; 
@@ -141,10 +170,14 @@ chunk_info_t *alloc_buffer_from_region(memory_region_t *region, size_t size);
 chunk_info_t *alloc_buffer(memory_region_t *regions, size_t size);
 
 memory_region_t *free_buffer (memory_region_t *regions, memory_address_t addr);
+chunk_info_t *find_chunk (memory_region_t *regions, memory_address_t addr);
 void free_chunk(chunk_info_t* chunk);
 
 void init_mem_region (
     memory_region_t *region, memory_address_t start, size_t size);
+#ifndef __TCE_STANDALONE__
+void uninit_mem_region (memory_region_t *region);
+#endif
 
 chunk_info_t *create_sub_chunk (chunk_info_t *parent, size_t offset, size_t size);
 
@@ -29,21 +29,36 @@
 
 #ifndef _MSC_VER
 #  include <unistd.h>
+#  include <sys/mman.h>
 #else
 #  include "vccompat.hpp"
 #endif
 
 #include "config.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 #include "pocl_image_util.h"
 #include "pocl_util.h"
 #include "devices.h"
 #include "pocl_mem_management.h"
 #include "pocl_runtime_config.h"
 #include "pocl_llvm.h"
+#include "cpuinfo.h"
+#include "utlist.h"
 
 #define COMMAND_LENGTH 2048
 
+/* The size and the alignment of the huge pages of the huge page
+   backed buffers. */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* The size of the block the fill patterns are replicated to, a multiple
+   of all the valid pattern sizes. */
+#define FILL_BLOCK_SIZE 128
+
 /**
  * Generate code from the final bitcode using the LLVM
  * tools.
@@ -51,10 +66,13 @@
  * Uses an existing (cached) one, if available.
  *
  * @param tmpdir The directory of the work-group function bitcode.
+ * @param isa_level The ISA level variant the bitcode was generated for,
+ * or POCL_ISA_LEVEL_NATIVE.
  * @param return the generated binary filename.
  */
 const char*
-llvm_codegen (const char* tmpdir, cl_kernel kernel, cl_device_id device) {
+llvm_codegen (const char* tmpdir, cl_kernel kernel, cl_device_id device,
+              int isa_level) {
 
   const char* pocl_verbose_ptr = 
     pocl_get_string_option("POCL_VERBOSE", (char*)NULL);
@@ -88,7 +106,7 @@ llvm_codegen (const char* tmpdir, cl_kernel kernel, cl_device_id device) {
                         "%s/%s", tmpdir, POCL_PARALLEL_BC_FILENAME);
       assert (error >= 0);
       
-      error = pocl_llvm_codegen( kernel, device, bytecode, objfile);
+      error = pocl_llvm_codegen( kernel, device, isa_level, bytecode, objfile);
       assert (error == 0);
 
       // clang is used as the linker driver in LINK_CMD
@@ -154,4 +172,355 @@ pocl_memalign_alloc(size_t align_width, size_t size)
 #endif
 }
 
+enum huge_page_policy
+  {
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_THP,    /* transparent huge pages with madvise() */
+    HUGE_PAGES_HUGETLB /* explicit huge pages from the hugetlbfs pool */
+  };
+
+/* Read from the environment once, by the first allocation. */
+static int huge_page_policy = HUGE_PAGES_NONE;
+static size_t huge_page_threshold;
+static pthread_once_t huge_page_once = PTHREAD_ONCE_INIT;
+
+/* The explicit huge page mappings, which must be unmapped instead of
+   freed. */
+typedef struct huge_page_map huge_page_map;
+struct huge_page_map
+{
+  void *ptr;
+  size_t size;
+  huge_page_map *next;
+};
+
+static huge_page_map *huge_page_maps = NULL;
+static pocl_lock_t huge_page_lock = POCL_LOCK_INITIALIZER;
+/* The number of the live mappings. Lets pocl_memalign_free() skip the
+   lock in the common case of no explicit huge pages. */
+static volatile int huge_page_map_count = 0;
+
+static void
+init_huge_page_policy (void)
+{
+  const char *policy = pocl_get_string_option ("POCL_HUGE_PAGES", "thp");
+
+  huge_page_threshold =
+    (size_t)pocl_get_int_option ("POCL_HUGE_PAGE_THRESHOLD_MB", 32)
+    * 1024 * 1024;
+  if (strcmp (policy, "hugetlb") == 0)
+    huge_page_policy = HUGE_PAGES_HUGETLB;
+  else if (strcmp (policy, "none") == 0)
+    huge_page_policy = HUGE_PAGES_NONE;
+  else
+    huge_page_policy = HUGE_PAGES_THP;
+}
+
+/**
+ * Tells whether a buffer should be backed by huge pages.
+ *
+ * Buffers of at least POCL_HUGE_PAGE_THRESHOLD_MB megabytes use huge
+ * pages unless the POCL_HUGE_PAGES policy is 'none'. The
+ * CL_MEM_HUGE_PAGES_POCL and CL_MEM_NO_HUGE_PAGES_POCL flags override
+ * the threshold.
+ */
+int
+pocl_use_huge_pages (size_t size, cl_mem_flags flags)
+{
+  pthread_once (&huge_page_once, init_huge_page_policy);
+
+  if (huge_page_policy == HUGE_PAGES_NONE ||
+      (flags & CL_MEM_NO_HUGE_PAGES_POCL))
+    return 0;
+  return (flags & CL_MEM_HUGE_PAGES_POCL) || size >= huge_page_threshold;
+}
+
+/**
+ * Allocates the memory of a buffer, backing it with huge pages in
+ * case pocl_use_huge_pages() tells so.
+ *
+ * Explicit huge pages fall back to transparent ones in case the huge
+ * page pool is exhausted, and those to the normal pages when the system
+ * does not support them. The memory must be freed with
+ * pocl_memalign_free().
+ */
+void*
+pocl_memalign_alloc_mem (size_t align_width, size_t size, cl_mem_flags flags)
+{
+  void *ptr;
+
+  if (!pocl_use_huge_pages (size, flags))
+    return pocl_memalign_alloc (align_width, size);
+
+#ifdef MAP_HUGETLB
+  if (huge_page_policy == HUGE_PAGES_HUGETLB && align_width <= HUGE_PAGE_SIZE)
+    {
+      size_t map_size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+      huge_page_map *map = (huge_page_map*) malloc (sizeof (huge_page_map));
+      ptr = MAP_FAILED;
+      if (map != NULL)
+        ptr = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (ptr != MAP_FAILED)
+        {
+          map->ptr = ptr;
+          map->size = map_size;
+          POCL_LOCK (huge_page_lock);
+          LL_PREPEND (huge_page_maps, map);
+          __sync_add_and_fetch (&huge_page_map_count, 1);
+          POCL_UNLOCK (huge_page_lock);
+          return ptr;
+        }
+      POCL_MEM_FREE (map);
+      POCL_MSG_PRINT_INFO ("Could not map %zu bytes of explicit huge pages, "
+                           "using transparent ones\n", map_size);
+    }
+#endif
+
+  ptr = pocl_memalign_alloc (max (align_width, HUGE_PAGE_SIZE), size);
+  if (ptr == NULL)
+    return pocl_memalign_alloc (align_width, size);
+#ifdef MADV_HUGEPAGE
+  /* Only the whole huge pages inside the buffer can be advised. */
+  if (size >= HUGE_PAGE_SIZE)
+    madvise (ptr, size & ~(size_t)(HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+#endif
+  return ptr;
+}
+
+/**
+ * Frees memory allocated with pocl_memalign_alloc() or
+ * pocl_memalign_alloc_mem().
+ */
+void
+pocl_memalign_free (void *ptr)
+{
+  huge_page_map *map = NULL;
+
+  /* The mapping of ptr, if any, was counted before ptr was handed out. */
+  if (__sync_add_and_fetch (&huge_page_map_count, 0) != 0)
+    {
+      POCL_LOCK (huge_page_lock);
+      LL_SEARCH_SCALAR (huge_page_maps, map, ptr, ptr);
+      if (map != NULL)
+        {
+          LL_DELETE (huge_page_maps, map);
+          __sync_sub_and_fetch (&huge_page_map_count, 1);
+        }
+      POCL_UNLOCK (huge_page_lock);
+    }
+
+  if (map != NULL)
+    {
+#ifdef MAP_HUGETLB
+      munmap (ptr, map->size);
+#endif
+      POCL_MEM_FREE (map);
+    }
+  else
+    free (ptr);
+}
+
+/**
+ * Copies memory with non-temporal stores which bypass the caches.
+ *
+ * Used for the bulk transfers larger than the caches, which would only
+ * evict the working set of the kernels. Falls back to memcpy() on the
+ * targets without streaming stores.
+ */
+void
+pocl_stream_memcpy (void *__restrict__ dst, const void *__restrict__ src,
+                    size_t size)
+{
+#ifdef __SSE2__
+  char *d = (char*)dst;
+  const char *s = (const char*)src;
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+  if (size < head + 64)
+    {
+      memcpy (dst, src, size);
+      return;
+    }
+
+  /* Align the destination for the streaming stores. */
+  memcpy (d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+
+  for (; size >= 64; size -= 64, d += 64, s += 64)
+    {
+      __m128i v0 = _mm_loadu_si128 ((const __m128i*)s);
+      __m128i v1 = _mm_loadu_si128 ((const __m128i*)(s + 16));
+      __m128i v2 = _mm_loadu_si128 ((const __m128i*)(s + 32));
+      __m128i v3 = _mm_loadu_si128 ((const __m128i*)(s + 48));
+      _mm_stream_si128 ((__m128i*)d, v0);
+      _mm_stream_si128 ((__m128i*)(d + 16), v1);
+      _mm_stream_si128 ((__m128i*)(d + 32), v2);
+      _mm_stream_si128 ((__m128i*)(d + 48), v3);
+    }
+  /* Order the weakly ordered streaming stores before the later ones. */
+  _mm_sfence ();
+  memcpy (d, s, size);
+#else
+  memcpy (dst, src, size);
+#endif
+}
+
+/**
+ * Fills memory with copies of a pattern.
+ *
+ * The patterns with all the bytes equal are filled with memset().
+ * Others of 1 to 128 bytes (a power of two) are replicated to a block
+ * which is stored with aligned vector stores, or non-temporal ones in
+ * case of streaming. The rest (e.g. the 3 or 6 byte image pixels) are
+ * replicated by doubling the filled part with memcpy().
+ *
+ * @param size The size to fill, a multiple of pattern_size.
+ */
+void
+pocl_fill_pattern (void *__restrict__ dst, size_t size,
+                   const void *__restrict__ pattern, size_t pattern_size,
+                   int streaming)
+{
+  const unsigned char *p = (const unsigned char*)pattern;
+  /* Two blocks to read the block rotated by the alignment head from. */
+  unsigned char block[2 * FILL_BLOCK_SIZE];
+  char *d = (char*)dst;
+  size_t i, head;
+
+  for (i = 1; i < pattern_size && p[i] == p[0]; ++i)
+    ;
+  if (i == pattern_size)
+    {
+      memset (dst, p[0], size);
+      return;
+    }
+
+  if (FILL_BLOCK_SIZE % pattern_size != 0)
+    {
+      i = min (pattern_size, size);
+      memcpy (d, pattern, i);
+      for (; i < size; i *= 2)
+        memcpy (d + i, d, min (i, size - i));
+      return;
+    }
 
+  for (i = 0; i < 2 * FILL_BLOCK_SIZE; i += pattern_size)
+    memcpy (block + i, pattern, pattern_size);
+
+  head = (16 - ((uintptr_t)d & 15)) & 15;
+  if (size < head + FILL_BLOCK_SIZE)
+    {
+      for (i = 0; i < size; i += FILL_BLOCK_SIZE)
+        memcpy (d + i, block, min (size - i, FILL_BLOCK_SIZE));
+      return;
+    }
+
+  memcpy (d, block, head);
+  d += head;
+  size -= head;
+
+#ifdef __SSE2__
+  {
+    __m128i v[FILL_BLOCK_SIZE / 16];
+    for (i = 0; i < FILL_BLOCK_SIZE / 16; ++i)
+      v[i] = _mm_loadu_si128 ((const __m128i*)(block + head + 16 * i));
+
+    if (streaming)
+      {
+        for (; size >= FILL_BLOCK_SIZE;
+             size -= FILL_BLOCK_SIZE, d += FILL_BLOCK_SIZE)
+          for (i = 0; i < FILL_BLOCK_SIZE / 16; ++i)
+            _mm_stream_si128 ((__m128i*)(d + 16 * i), v[i]);
+        _mm_sfence ();
+      }
+    else
+      {
+        for (; size >= FILL_BLOCK_SIZE;
+             size -= FILL_BLOCK_SIZE, d += FILL_BLOCK_SIZE)
+          for (i = 0; i < FILL_BLOCK_SIZE / 16; ++i)
+            _mm_store_si128 ((__m128i*)(d + 16 * i), v[i]);
+      }
+  }
+#else
+  for (; size >= FILL_BLOCK_SIZE; size -= FILL_BLOCK_SIZE, d += FILL_BLOCK_SIZE)
+    memcpy (d, block + head, FILL_BLOCK_SIZE);
+#endif
+  memcpy (d, block + head, size);
+}
+
+
+
+/**
+ * Parses the POCL_KERNEL_ISA_VARIANTS env, a comma separated list of
+ * ISA level names.
+ *
+ * @return The bitmask of the ISA levels to build variants of the
+ * work-group functions for, 0 if multi-versioning is not used.
+ */
+static unsigned
+parse_isa_variants ()
+{
+  const char *env = pocl_get_string_option ("POCL_KERNEL_ISA_VARIANTS", "");
+  char *list = strdup (env);
+  char *save = NULL;
+  char *name;
+  unsigned variants = 0;
+
+  for (name = strtok_r (list, ", ", &save); name != NULL;
+       name = strtok_r (NULL, ", ", &save))
+    {
+      int level = pocl_isa_level_from_name (name);
+      if (level == POCL_ISA_LEVEL_NATIVE)
+        POCL_MSG_PRINT_INFO ("Unsupported kernel ISA variant '%s' ignored\n",
+                             name);
+      else
+        variants |= 1u << level;
+    }
+  POCL_MEM_FREE (list);
+  return variants;
+}
+
+/**
+ * Sets the LLVM CPU variant of a host CPU device to the CPU we are
+ * running on instead of the one pocl was configured on, which might
+ * lack (or have more) instruction set extensions.
+ *
+ * In case the work-group functions are multi-versioned for several ISA
+ * levels, the program bitcode is instead compiled for the lowest level
+ * and the kernel cache directory does not depend on the host CPU model
+ * so the cache can be shared by hosts of different ISA levels.
+ */
+void
+pocl_init_host_llvm_cpu (cl_device_id device)
+{
+  const char *host_cpu = pocl_llvm_get_host_cpu_name ();
+  unsigned variants;
+  int lowest;
+
+  if (host_cpu != NULL)
+    device->llvm_cpu = host_cpu;
+
+  if (device->llvm_cpu != NULL && !strcmp (device->llvm_cpu, "(unknown)"))
+    device->llvm_cpu = NULL;
+
+  variants = parse_isa_variants ();
+  if (variants == 0)
+    return;
+
+  for (lowest = 0; !(variants & (1u << lowest)); ++lowest)
+    ;
+  if (pocl_cpuinfo_detect_isa_level () < lowest)
+    {
+      POCL_MSG_PRINT_INFO ("The CPU does not support any of the kernel ISA "
+                           "variants, using the native target\n");
+      return;
+    }
+
+  device->isa_variants = variants;
+  device->llvm_cpu = pocl_isa_level_llvm_cpu (lowest);
+  device->llvm_cpu_features = pocl_isa_level_llvm_features (lowest);
+  device->cache_dir_name = strdup (device->short_name);
+}
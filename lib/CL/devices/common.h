@@ -75,11 +75,28 @@
 
 const char* llvm_codegen (const char* tmpdir,
                           cl_kernel kernel,
-                          cl_device_id device);
+                          cl_device_id device,
+                          int isa_level);
 
 void fill_dev_image_t (dev_image_t* di, struct pocl_argument* parg, 
                        cl_device_id device);
 
 void* pocl_memalign_alloc(size_t align_width, size_t size);
 
+int pocl_use_huge_pages (size_t size, cl_mem_flags flags);
+
+void* pocl_memalign_alloc_mem (size_t align_width, size_t size,
+                               cl_mem_flags flags);
+
+void pocl_memalign_free (void *ptr);
+
+void pocl_stream_memcpy (void *__restrict__ dst, const void *__restrict__ src,
+                         size_t size);
+
+void pocl_fill_pattern (void *__restrict__ dst, size_t size,
+                        const void *__restrict__ pattern, size_t pattern_size,
+                        int streaming);
+
+void pocl_init_host_llvm_cpu (cl_device_id device);
+
 #endif
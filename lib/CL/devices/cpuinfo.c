@@ -34,6 +34,17 @@
 #include "config.h"
 #include "cpuinfo.h"
 
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#  define POCL_CPUINFO_X86
+#  include <cpuid.h>
+#elif (defined(__arm__) || defined(__aarch64__)) && defined(__linux__)
+#  define POCL_CPUINFO_ARM
+#  include <sys/auxv.h>
+#  ifndef HWCAP_NEON
+#    define HWCAP_NEON (1 << 12)
+#  endif
+#endif
+
 const char* cpuinfo = "/proc/cpuinfo";
 #define MAX_CPUINFO_SIZE 64*1024
 //#define DEBUG_POCL_CPUINFO
@@ -280,6 +291,212 @@ pocl_cpuinfo_append_cpu_name(cl_device_id device)
 
 }
 
+#define MAX_FEATURES_LEN 512
+
+static void
+append_feature (char *features, const char *name, int enabled)
+{
+  size_t len = strlen (features);
+  if (len + strlen (name) + 3 > MAX_FEATURES_LEN)
+    return;
+  snprintf (features + len, MAX_FEATURES_LEN - len, "%s%c%s",
+            (len > 0) ? "," : "", enabled ? '+' : '-', name);
+}
+
+#ifdef POCL_CPUINFO_X86
+/* Returns the OS-enabled register state mask (XCR0), or 0 if the OS
+   does not use XSAVE in which case the AVX registers are not usable
+   even if CPUID claims the CPU has them. */
+static unsigned
+x86_xgetbv ()
+{
+  unsigned eax, edx;
+  __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return eax;
+}
+
+/* The CPUID feature bits pocl is interested in. */
+#define X86_L1_ECX_SSE3    (1u << 0)
+#define X86_L1_ECX_SSSE3   (1u << 9)
+#define X86_L1_ECX_FMA     (1u << 12)
+#define X86_L1_ECX_SSE41   (1u << 19)
+#define X86_L1_ECX_SSE42   (1u << 20)
+#define X86_L1_ECX_POPCNT  (1u << 23)
+#define X86_L1_ECX_OSXSAVE (1u << 27)
+#define X86_L1_ECX_AVX     (1u << 28)
+#define X86_L1_ECX_F16C    (1u << 29)
+#define X86_L1_EDX_SSE2    (1u << 26)
+#define X86_L7_EBX_BMI     (1u << 3)
+#define X86_L7_EBX_AVX2    (1u << 5)
+#define X86_L7_EBX_BMI2    (1u << 8)
+#define X86_L7_EBX_AVX512F (1u << 16)
+#define X86_L7_EBX_AVX512DQ (1u << 17)
+#define X86_L7_EBX_AVX512PF (1u << 26)
+#define X86_L7_EBX_AVX512ER (1u << 27)
+#define X86_L7_EBX_AVX512CD (1u << 28)
+#define X86_L7_EBX_AVX512BW (1u << 30)
+#define X86_L7_EBX_AVX512VL (1u << 31)
+
+typedef struct
+{
+  unsigned leaf1_ecx, leaf1_edx, leaf7_ebx;
+  /* The OS saves the YMM (and ZMM) registers across context switches. */
+  int avx_usable, avx512_usable;
+} x86_cpuid_info;
+
+static void
+x86_read_cpuid (x86_cpuid_info *info)
+{
+  unsigned eax, ebx, ecx, edx;
+  unsigned max_leaf = __get_cpuid_max (0, NULL);
+  unsigned xcr0 = 0;
+
+  memset (info, 0, sizeof (x86_cpuid_info));
+  if (max_leaf >= 1 && __get_cpuid (1, &eax, &ebx, &ecx, &edx))
+    {
+      info->leaf1_ecx = ecx;
+      info->leaf1_edx = edx;
+    }
+  if (max_leaf >= 7)
+    {
+      __cpuid_count (7, 0, eax, ebx, ecx, edx);
+      info->leaf7_ebx = ebx;
+    }
+  if (info->leaf1_ecx & X86_L1_ECX_OSXSAVE)
+    xcr0 = x86_xgetbv ();
+  /* XMM and YMM state enabled */
+  info->avx_usable = (info->leaf1_ecx & X86_L1_ECX_AVX)
+    && ((xcr0 & 0x06) == 0x06);
+  /* ... and the opmask and both halves of the ZMM state */
+  info->avx512_usable = info->avx_usable && ((xcr0 & 0xe0) == 0xe0)
+    && (info->leaf7_ebx & X86_L7_EBX_AVX512F);
+}
+#endif
+
+/**
+ * Detects the SIMD instruction set extensions supported by the host CPU
+ * (and enabled by the OS) at runtime.
+ *
+ * Fills in the native and preferred vector widths according to the
+ * widest usable vector registers and sets device->llvm_cpu_features to
+ * a comma separated list of LLVM target features ("+avx2,-avx512f,...")
+ * to pass to the kernel compiler. Otherwise the kernels would be compiled
+ * for the features of the CPU pocl was configured on, which might be
+ * less (or more) than what the current CPU can execute.
+ *
+ * @return The width of the widest usable vector register in bytes,
+ * or 0 if the ISA was not recognized.
+ */
+int
+pocl_cpuinfo_detect_simd_features(cl_device_id device)
+{
+  char features[MAX_FEATURES_LEN];
+  /* Widest vector register in bytes for floating point and for integer
+     data (AVX without AVX2 has only 128b integer operations). */
+  int fp_width = 0, int_width = 0, byte_width = 0;
+  features[0] = '\0';
+
+#if defined POCL_CPUINFO_X86
+  x86_cpuid_info id;
+  unsigned l1c, l1d, l7b;
+  int avx, avx512;
+
+  x86_read_cpuid (&id);
+  l1c = id.leaf1_ecx;
+  l1d = id.leaf1_edx;
+  l7b = id.leaf7_ebx;
+  avx = id.avx_usable;
+  avx512 = id.avx512_usable;
+
+  append_feature (features, "sse2", l1d & X86_L1_EDX_SSE2);
+  append_feature (features, "sse3", l1c & X86_L1_ECX_SSE3);
+  append_feature (features, "ssse3", l1c & X86_L1_ECX_SSSE3);
+  append_feature (features, "sse4.1", l1c & X86_L1_ECX_SSE41);
+  append_feature (features, "sse4.2", l1c & X86_L1_ECX_SSE42);
+  append_feature (features, "popcnt", l1c & X86_L1_ECX_POPCNT);
+  append_feature (features, "avx", avx);
+  append_feature (features, "avx2", avx && (l7b & X86_L7_EBX_AVX2));
+  append_feature (features, "fma", avx && (l1c & X86_L1_ECX_FMA));
+  append_feature (features, "f16c", avx && (l1c & X86_L1_ECX_F16C));
+  append_feature (features, "bmi", l7b & X86_L7_EBX_BMI);
+  append_feature (features, "bmi2", l7b & X86_L7_EBX_BMI2);
+#if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  append_feature (features, "avx512f", avx512);
+  append_feature (features, "avx512cd", avx512 && (l7b & X86_L7_EBX_AVX512CD));
+  append_feature (features, "avx512er", avx512 && (l7b & X86_L7_EBX_AVX512ER));
+  append_feature (features, "avx512pf", avx512 && (l7b & X86_L7_EBX_AVX512PF));
+#else
+  /* The code generator does not get the AVX-512 features, thus the
+     vectors are limited to the AVX2 widths. */
+  avx512 = 0;
+#endif
+#ifndef LLVM_OLDER_THAN_3_6
+  append_feature (features, "avx512dq", avx512 && (l7b & X86_L7_EBX_AVX512DQ));
+  append_feature (features, "avx512bw", avx512 && (l7b & X86_L7_EBX_AVX512BW));
+  append_feature (features, "avx512vl", avx512 && (l7b & X86_L7_EBX_AVX512VL));
+#endif
+
+  if (avx512)
+    {
+      fp_width = int_width = 64;
+      /* 512b byte and short operations need AVX-512BW, which is passed
+         to the code generator from LLVM 3.6 on. */
+#ifndef LLVM_OLDER_THAN_3_6
+      byte_width = (l7b & X86_L7_EBX_AVX512BW) ? 64 : 32;
+#else
+      byte_width = 32;
+#endif
+    }
+  else if (avx && (l7b & X86_L7_EBX_AVX2))
+    fp_width = int_width = byte_width = 32;
+  else if (avx)
+    {
+      fp_width = 32;
+      int_width = byte_width = 16;
+    }
+  else if (l1d & X86_L1_EDX_SSE2)
+    fp_width = int_width = byte_width = 16;
+
+#elif defined POCL_CPUINFO_ARM
+#ifdef __aarch64__
+  /* Advanced SIMD is mandatory in ARMv8-A. */
+  int have_neon = 1;
+#else
+  int have_neon = (getauxval (AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+  append_feature (features, "neon", have_neon);
+  if (have_neon)
+    fp_width = int_width = byte_width = 16;
+#endif
+
+  if (fp_width == 0)
+    return 0;
+
+  device->native_vector_width_char = byte_width;
+  device->native_vector_width_short = byte_width / 2;
+  device->native_vector_width_int = int_width / 4;
+  device->native_vector_width_long = int_width / 8;
+  device->native_vector_width_float = fp_width / 4;
+  device->native_vector_width_double = fp_width / 8;
+  device->native_vector_width_half = device->native_vector_width_short;
+
+  /* Prefer the full register width also for the preferred widths so the
+     autovectorized work-group functions and the user's vector code agree
+     on the vector width. */
+  device->preferred_vector_width_char = device->native_vector_width_char;
+  device->preferred_vector_width_short = device->native_vector_width_short;
+  device->preferred_vector_width_int = device->native_vector_width_int;
+  device->preferred_vector_width_long = device->native_vector_width_long;
+  device->preferred_vector_width_float = device->native_vector_width_float;
+  device->preferred_vector_width_double = device->native_vector_width_double;
+  device->preferred_vector_width_half = device->native_vector_width_half;
+
+  if (features[0] != '\0')
+    device->llvm_cpu_features = strdup (features);
+
+  return fp_width;
+}
+
 void
 pocl_cpuinfo_detect_device_info(cl_device_id device) 
 {
@@ -299,4 +516,111 @@ pocl_cpuinfo_detect_device_info(cl_device_id device)
     device->max_clock_frequency = 0;
 
   pocl_cpuinfo_append_cpu_name(device);
+
+  pocl_cpuinfo_detect_simd_features(device);
+}
+
+/* The LLVM CPU variants and target features the work-group function
+   variants of each ISA level are compiled for. */
+#define ISA_SSE42_FEATURES "+sse4.2,+popcnt"
+#define ISA_AVX_FEATURES ISA_SSE42_FEATURES ",+avx"
+#define ISA_AVX2_FEATURES ISA_AVX_FEATURES ",+avx2,+fma,+f16c,+bmi,+bmi2"
+#ifdef LLVM_OLDER_THAN_3_6
+#  define ISA_AVX512_FEATURES ISA_AVX2_FEATURES ",+avx512f,+avx512cd"
+#else
+#  define ISA_AVX512_FEATURES ISA_AVX2_FEATURES \
+  ",+avx512f,+avx512cd,+avx512dq,+avx512bw,+avx512vl"
+#endif
+
+static const struct
+{
+  const char *name;
+  const char *llvm_cpu;
+  const char *llvm_features;
+} isa_levels[POCL_ISA_LEVEL_COUNT] =
+  {
+    {"sse4.2", "corei7", ISA_SSE42_FEATURES},
+    {"avx", "corei7-avx", ISA_AVX_FEATURES},
+    {"avx2", "core-avx2", ISA_AVX2_FEATURES},
+    {"avx512", "core-avx2", ISA_AVX512_FEATURES}
+  };
+
+const char *
+pocl_isa_level_name (int level)
+{
+  assert (level >= 0 && level < POCL_ISA_LEVEL_COUNT);
+  return isa_levels[level].name;
+}
+
+const char *
+pocl_isa_level_llvm_cpu (int level)
+{
+  assert (level >= 0 && level < POCL_ISA_LEVEL_COUNT);
+  return isa_levels[level].llvm_cpu;
+}
+
+const char *
+pocl_isa_level_llvm_features (int level)
+{
+  assert (level >= 0 && level < POCL_ISA_LEVEL_COUNT);
+  return isa_levels[level].llvm_features;
+}
+
+/**
+ * @return The ISA level with the given name, or POCL_ISA_LEVEL_NATIVE
+ * if the name is unknown or the level is not supported by the LLVM
+ * pocl was built against.
+ */
+int
+pocl_isa_level_from_name (const char *name)
+{
+  int level;
+  for (level = 0; level < POCL_ISA_LEVEL_COUNT; ++level)
+    {
+      if (strcmp (name, isa_levels[level].name) != 0)
+        continue;
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+      if (level == POCL_ISA_LEVEL_AVX512)
+        return POCL_ISA_LEVEL_NATIVE;
+#endif
+      return level;
+    }
+  return POCL_ISA_LEVEL_NATIVE;
+}
+
+/**
+ * Detects the most capable ISA level the host CPU can execute.
+ *
+ * @return The ISA level, or POCL_ISA_LEVEL_NATIVE if the CPU does not
+ * reach even the lowest level (or is not an x86).
+ */
+int
+pocl_cpuinfo_detect_isa_level ()
+{
+#ifdef POCL_CPUINFO_X86
+  x86_cpuid_info id;
+  unsigned l1c, l7b;
+  x86_read_cpuid (&id);
+  l1c = id.leaf1_ecx;
+  l7b = id.leaf7_ebx;
+
+  if (!(l1c & X86_L1_ECX_SSE42) || !(l1c & X86_L1_ECX_POPCNT))
+    return POCL_ISA_LEVEL_NATIVE;
+  if (!id.avx_usable)
+    return POCL_ISA_LEVEL_SSE42;
+  if (!(l7b & X86_L7_EBX_AVX2) || !(l1c & X86_L1_ECX_FMA)
+      || !(l1c & X86_L1_ECX_F16C) || !(l7b & X86_L7_EBX_BMI)
+      || !(l7b & X86_L7_EBX_BMI2))
+    return POCL_ISA_LEVEL_AVX;
+  if (!id.avx512_usable || !(l7b & X86_L7_EBX_AVX512CD)
+#ifndef LLVM_OLDER_THAN_3_6
+      || !(l7b & X86_L7_EBX_AVX512DQ) || !(l7b & X86_L7_EBX_AVX512BW)
+      || !(l7b & X86_L7_EBX_AVX512VL)
+#endif
+      )
+    return POCL_ISA_LEVEL_AVX2;
+  return POCL_ISA_LEVEL_AVX512;
+#else
+  return POCL_ISA_LEVEL_NATIVE;
+#endif
 }
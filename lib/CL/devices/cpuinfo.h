@@ -32,6 +32,39 @@
 
 #include "pocl_cl.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The x86 ISA levels the work-group functions can be multi-versioned
+   for, in increasing order of capability. */
+typedef enum
+{
+  /* The target of the device itself (llvm_cpu, llvm_cpu_features). */
+  POCL_ISA_LEVEL_NATIVE = -1,
+  POCL_ISA_LEVEL_SSE42 = 0,
+  POCL_ISA_LEVEL_AVX,
+  POCL_ISA_LEVEL_AVX2,
+  POCL_ISA_LEVEL_AVX512,
+  POCL_ISA_LEVEL_COUNT
+} pocl_isa_level;
+
 void pocl_cpuinfo_detect_device_info(cl_device_id device);
 
+int pocl_cpuinfo_detect_simd_features(cl_device_id device);
+
+int pocl_cpuinfo_detect_isa_level ();
+
+const char *pocl_isa_level_name (int level);
+
+const char *pocl_isa_level_llvm_cpu (int level);
+
+const char *pocl_isa_level_llvm_features (int level);
+
+int pocl_isa_level_from_name (const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* POCL_TOPOLOGY_H */
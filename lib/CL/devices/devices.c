@@ -256,8 +256,14 @@ pocl_init_devices()
           if (dev_index == 0)
             pocl_devices[dev_index].type |= CL_DEVICE_TYPE_DEFAULT;
 
-          pocl_devices[dev_index].cache_dir_name = strdup(pocl_devices[dev_index].long_name);
-          pocl_string_to_dirname(pocl_devices[dev_index].cache_dir_name);
+          /* The device can choose its kernel cache directory name in
+             init, e.g. to share the cache across different hosts. */
+          if (pocl_devices[dev_index].cache_dir_name == NULL)
+            {
+              pocl_devices[dev_index].cache_dir_name =
+                strdup(pocl_devices[dev_index].long_name);
+              pocl_string_to_dirname(pocl_devices[dev_index].cache_dir_name);
+            }
           
           ++dev_index;
         }
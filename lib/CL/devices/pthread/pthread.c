@@ -31,6 +31,7 @@
 
 #ifndef _MSC_VER
 #  include <unistd.h>
+#  include <sys/mman.h>
 #else
 #  include "vccompat.hpp"
 #endif
@@ -76,6 +77,45 @@
    deallocated. If 0, it can reuse the same region over multiple kernels. */
 #define FREE_EMPTY_REGIONS 0
 
+/* Freed buffers up to this size are kept allocated in a per-thread
+   cache for the next allocations of the thread, which then need not
+   take the region locks. The cache has a slot for this many buffers
+   per power of two size class. */
+#define THREAD_CACHE_MAX_SIZE (64 * 1024)
+#define THREAD_CACHE_DEPTH 4
+#define THREAD_CACHE_CLASSES 17
+
+struct _mem_regions_management;
+
+typedef struct thread_cache {
+  unsigned generation;
+  /* The regions the cached chunks are from. */
+  struct _mem_regions_management *regions;
+  int registered;
+  unsigned count[THREAD_CACHE_CLASSES];
+  chunk_info_t *chunks[THREAD_CACHE_CLASSES][THREAD_CACHE_DEPTH];
+} thread_cache;
+
+static __thread thread_cache buffer_cache;
+/* Bumped when the regions are freed to invalidate the thread caches. */
+static volatile unsigned buffer_cache_generation = 1;
+
+/* Returns the cached chunks to their regions. Also the destructor of
+   the cache of an exiting thread. */
+static void
+flush_thread_cache (void *p)
+{
+  thread_cache *cache = (thread_cache*)p;
+  unsigned c, i;
+
+  if (cache->generation == buffer_cache_generation)
+    for (c = 0; c < THREAD_CACHE_CLASSES; ++c)
+      for (i = 0; i < cache->count[c]; ++i)
+        free_chunk (cache->chunks[c][i]);
+  memset (cache->count, 0, sizeof (cache->count));
+  cache->registered = 0;
+}
+
 /* CUSTOM_BUFFER_ALLOCATOR */
 #endif
 
@@ -85,6 +125,17 @@
 /* The name of the environment variable used to force a certain max thread count
    for the thread execution. */
 #define THREAD_COUNT_ENV "POCL_MAX_PTHREAD_COUNT"
+#define CHUNK_SIZE_ENV "POCL_PTHREAD_CHUNK_SIZE"
+/* The minimum size in megabytes of the transfers each worker thread of
+   a buffer read, write or copy command handles, and the size from which
+   on the transfers use non-temporal stores. */
+#define COPY_THREAD_SIZE_ENV "POCL_PTHREAD_COPY_THREAD_MB"
+#define STREAMING_COPY_SIZE_ENV "POCL_PTHREAD_STREAMING_COPY_MB"
+
+/* The byte ranges of a row split across threads start at multiples of
+   the cache line size and the fill pattern sizes (multiplied with the
+   pattern size for the ones not dividing it). */
+#define COPY_SPLIT_ALIGNMENT 128
 
 typedef struct thread_arguments thread_arguments;
 struct thread_arguments 
@@ -95,6 +146,7 @@ struct thread_arguments
   struct pocl_context pc;
   int last_gid_x; 
   pocl_workgroup workgroup;
+  pocl_workgroup_range workgroup_range;
   struct pocl_argument *kernel_args;
   thread_arguments *volatile next;
 };
@@ -104,6 +156,8 @@ struct thread_arguments
 typedef struct _mem_regions_management{
   ba_lock_t mem_regions_lock;
   struct memory_region *mem_regions;
+  /* Returns the chunks cached by the exiting threads. */
+  pthread_key_t cache_key;
 } mem_regions_management;
 #endif
 
@@ -119,6 +173,39 @@ struct data {
   mem_regions_management* mem_regions;
 #endif
 
+  /* The NUMA node the worker threads are bound to and the buffers are
+     placed on by default, -1 if not bound. */
+  int numa_node;
+
+  /* The bulk transfer thresholds in bytes, SIZE_MAX if disabled, and
+     the max number of threads to split a transfer to. */
+  size_t copy_thread_size;
+  size_t streaming_copy_size;
+  int max_copy_threads;
+};
+
+/* The part of a 3D region transfer a thread handles: the bytes
+   [first_byte, last_byte) of the rows [first_row, last_row), the
+   rows of all the slices counted linearly. The region is filled with
+   copies of the pattern in case there is one instead of a source. */
+typedef struct copy_job copy_job;
+struct copy_job
+{
+  char *dst;
+  const char *src;
+  const void *pattern;
+  size_t pattern_size;
+  size_t region[3];
+  size_t dst_row_pitch;
+  size_t dst_slice_pitch;
+  size_t src_row_pitch;
+  size_t src_slice_pitch;
+  size_t first_row;
+  size_t last_row;
+  size_t first_byte;
+  size_t last_byte;
+  int streaming;
+  int numa_node;
 };
 
 
@@ -127,6 +214,18 @@ static int argument_pool_initialized = 0;
 pocl_lock_t ta_pool_lock;
 static int get_max_thread_count();
 static void * workgroup_thread (void *p);
+static void * workgroup_worker (void *p);
+
+/* Returns a size env given in megabytes in bytes, SIZE_MAX in case it
+   is not positive. */
+static size_t
+get_size_option_mb (const char *key, int default_value)
+{
+  int value = pocl_get_int_option (key, default_value);
+  if (value <= 0)
+    return SIZE_MAX;
+  return (size_t)value << 20;
+}
 
 static void pocl_init_thread_argument_manager (void)
 {
@@ -176,9 +275,14 @@ pocl_pthread_init_device_ops(struct pocl_device_ops *ops)
   ops->read = pocl_pthread_read;
   ops->write = pocl_pthread_write;
   ops->copy = pocl_pthread_copy;
-  ops->copy_rect = pocl_basic_copy_rect;
+  ops->read_rect = pocl_pthread_read_rect;
+  ops->write_rect = pocl_pthread_write_rect;
+  ops->copy_rect = pocl_pthread_copy_rect;
+  ops->fill = pocl_pthread_fill;
+  ops->fill_rect = pocl_pthread_fill_rect;
   ops->run = pocl_pthread_run;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
+  ops->migrate_mem = pocl_pthread_migrate_mem;
 
 }
 
@@ -226,6 +330,20 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   d->current_kernel = NULL;
   d->current_dlhandle = 0;
 
+  /* POCL_PTHREADn_PARAMETERS can give a NUMA node to bind the device
+     instance to, making the instances per-node sub-devices. */
+  d->numa_node = -1;
+  if (parameters != NULL && *parameters != '\0')
+    {
+      char *end = NULL;
+      long node = strtol (parameters, &end, 10);
+      if (*end == '\0' && node >= 0 && node < pocl_topology_num_numa_nodes ())
+        d->numa_node = (int)node;
+      else
+        POCL_MSG_WARN ("Ignoring the pthread device parameters '%s', "
+                       "expected a NUMA node number\n", parameters);
+    }
+
   device->data = d;
 #ifdef CUSTOM_BUFFER_ALLOCATOR  
   if (mrm == NULL)
@@ -233,6 +351,7 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
       mrm = (mem_regions_management*)malloc (sizeof (mem_regions_management));
       BA_INIT_LOCK (mrm->mem_regions_lock);
       mrm->mem_regions = NULL;
+      pthread_key_create (&mrm->cache_key, flush_thread_cache);
     }
   d->mem_regions = mrm;
 #endif  
@@ -271,9 +390,7 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
 
   pocl_topology_detect_device_info(device);
   pocl_cpuinfo_detect_device_info(device);
-
-  if(!strcmp(device->llvm_cpu, "(unknown)"))
-    device->llvm_cpu = NULL;
+  pocl_init_host_llvm_cpu (device);
 
   // work-around LLVM bug where sizeof(long)=4
   #ifdef _CL_DISABLE_LONG
@@ -281,7 +398,10 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   #endif
 
   pocl_init_thread_argument_manager();
-  
+
+  d->copy_thread_size = get_size_option_mb (COPY_THREAD_SIZE_ENV, 4);
+  d->streaming_copy_size = get_size_option_mb (STREAMING_COPY_SIZE_ENV, 16);
+  d->max_copy_threads = get_max_thread_count (device);
 }
 
 void
@@ -295,21 +415,123 @@ pocl_pthread_uninit (cl_device_id device)
       DL_DELETE(d->mem_regions->mem_regions, region);
       free((void*)region->chunks->start_address);
       region->chunks->start_address = 0;
+      uninit_mem_region (region);
       POCL_MEM_FREE(region);
     }
   d->mem_regions->mem_regions = NULL;
+  ++buffer_cache_generation;
 #endif  
   POCL_MEM_FREE(d);
   device->data = NULL;
 }
 
 
+/* Returns the NUMA placement policy of a buffer with the given flags. */
+static pocl_numa_policy
+numa_policy (cl_mem_flags flags)
+{
+  if (flags & CL_MEM_NUMA_INTERLEAVE_POCL)
+    return POCL_NUMA_INTERLEAVE;
+  if (flags & CL_MEM_NUMA_FIRST_TOUCH_POCL)
+    return POCL_NUMA_FIRST_TOUCH;
+  if (flags & CL_MEM_NUMA_BIND_POCL)
+    return POCL_NUMA_BIND;
+  return POCL_NUMA_DEFAULT;
+}
+
+/* The NUMA policies apply to whole pages, thus the buffers with one
+   are allocated page aligned and outside the regions. */
+#define NUMA_PAGE_ALIGNMENT 4096
+
+/**
+ * Allocates a buffer with a NUMA placement policy. The bound buffers
+ * are placed on the node of the device, or the node of the calling
+ * thread in case the device is not bound to one.
+ */
+static void *
+allocate_numa_buffer (struct data* d, size_t alignment, size_t size,
+                      cl_mem_flags flags)
+{
+  pocl_numa_policy policy = numa_policy (flags);
+  int node = d->numa_node;
+  void *ptr =
+    pocl_memalign_alloc_mem (max (alignment, NUMA_PAGE_ALIGNMENT), size, flags);
+
+  if (ptr == NULL)
+    return NULL;
+  if (policy == POCL_NUMA_BIND && node == -1)
+    node = pocl_topology_current_numa_node ();
+  if (pocl_topology_set_mem_policy (ptr, size, policy, node) != 0)
+    POCL_MSG_PRINT_INFO ("Could not set the NUMA policy of a buffer of "
+                         "%zu bytes\n", size);
+  return ptr;
+}
+
 #ifdef CUSTOM_BUFFER_ALLOCATOR
+/* Returns the cache of the calling thread for the given regions. The
+   chunks cached from other regions are returned to them first, and
+   the chunks of the regions freed since the thread last used the
+   cache are dropped. */
+static thread_cache *
+get_thread_cache (mem_regions_management *regions)
+{
+  thread_cache *cache = &buffer_cache;
+  if (cache->generation != buffer_cache_generation)
+    {
+      memset (cache->count, 0, sizeof (cache->count));
+      cache->generation = buffer_cache_generation;
+    }
+  if (cache->regions != regions)
+    {
+      flush_thread_cache (cache);
+      cache->regions = regions;
+    }
+  if (!cache->registered)
+    {
+      pthread_setspecific (regions->cache_key, cache);
+      cache->registered = 1;
+    }
+  return cache;
+}
+
 static int
-allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
+allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment,
+                         size_t size, cl_mem_flags flags)
 {
+  chunk_info_t *chunk = NULL;
+  thread_cache *cache;
+  unsigned c = 0;
+
+  if (numa_policy (flags) != POCL_NUMA_DEFAULT)
+    {
+      *memptr = allocate_numa_buffer (d, alignment, size, flags);
+      return ((*memptr) == NULL) ? ENOMEM : 0;
+    }
+
+  /* The huge page backed buffers get their own mappings outside the
+     regions. */
+  if (pocl_use_huge_pages (size, flags))
+    {
+      *memptr = pocl_memalign_alloc_mem (alignment, size, flags);
+      return ((*memptr) == NULL) ? ENOMEM : 0;
+    }
+
+  /* The cached chunks of the size class rounded up all fit. */
+  if (size <= THREAD_CACHE_MAX_SIZE)
+    {
+      while (((size_t)1 << c) < size)
+        ++c;
+      cache = get_thread_cache (d->mem_regions);
+      if (cache->count[c] > 0)
+        {
+          chunk = cache->chunks[c][--cache->count[c]];
+          *memptr = (void*) chunk->start_address;
+          return 0;
+        }
+    }
+
   BA_LOCK(d->mem_regions->mem_regions_lock);
-  chunk_info_t *chunk = alloc_buffer (d->mem_regions->mem_regions, size);
+  chunk = alloc_buffer (d->mem_regions->mem_regions, size);
   if (chunk == NULL)
     {
       memory_region_t *new_mem_region = 
@@ -370,9 +592,13 @@ allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t
 #else
 
 static int
-allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
+allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment,
+                         size_t size, cl_mem_flags flags)
 {
-  *memptr = pocl_memalign_alloc(alignment, size);
+  if (numa_policy (flags) != POCL_NUMA_DEFAULT)
+    *memptr = allocate_numa_buffer (d, alignment, size, flags);
+  else
+    *memptr = pocl_memalign_alloc_mem(alignment, size, flags);
   return (((*memptr) == NULL)? -1: 0);
 }
 
@@ -386,7 +612,7 @@ pocl_pthread_malloc (void *device_data, cl_mem_flags flags, size_t size, void *h
 
   if (flags & CL_MEM_COPY_HOST_PTR)
     {
-      if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, size) == 0)
+      if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, size, flags) == 0)
         {
           memcpy (b, host_ptr, size);
           return b;
@@ -400,7 +626,7 @@ pocl_pthread_malloc (void *device_data, cl_mem_flags flags, size_t size, void *h
       return host_ptr;
     }
 
-  if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, size) == 0)
+  if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, size, flags) == 0)
     return b;
   
   return NULL;
@@ -413,6 +639,11 @@ pocl_pthread_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
   struct data* d = (struct data*)device->data;
   cl_int flags = mem_obj->flags;
 
+  /* The buffers of a device bound to a NUMA node are placed on it
+     unless they ask for another policy. */
+  if (d->numa_node != -1 && !(flags & POCL_MEM_NUMA_FLAGS))
+    flags |= CL_MEM_NUMA_BIND_POCL;
+
   /* if memory for this global memory is not yet allocated -> do it */
   if (mem_obj->device_ptrs[device->global_mem_id].mem_ptr == NULL)
     {
@@ -421,7 +652,7 @@ pocl_pthread_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
           b = mem_obj->mem_host_ptr;
         }
       else if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, 
-                                        mem_obj->size) != 0)
+                                        mem_obj->size, flags) != 0)
         return CL_MEM_OBJECT_ALLOCATION_FAILURE;
 
       if (flags & CL_MEM_COPY_HOST_PTR)
@@ -444,13 +675,36 @@ pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
 {
   struct data* d = (struct data*) device_data;
   memory_region_t *region = NULL;
+  chunk_info_t *chunk = NULL;
+  thread_cache *cache;
+  unsigned c = 0;
 
   if (flags & CL_MEM_USE_HOST_PTR)
       return; /* The host code should free the host ptr. */
 
-  region = free_buffer (d->mem_regions->mem_regions, (memory_address_t)ptr);
+  chunk = find_chunk (d->mem_regions->mem_regions, (memory_address_t)ptr);
+
+  /* Not in the regions, a huge page backed buffer. */
+  if (chunk == NULL)
+    {
+      pocl_memalign_free (ptr);
+      return;
+    }
 
-  assert(region != NULL && "Unable to find the region for chunk.");
+  if (chunk->size <= THREAD_CACHE_MAX_SIZE)
+    {
+      while (((size_t)2 << c) <= chunk->size)
+        ++c;
+      cache = get_thread_cache (d->mem_regions);
+      if (cache->count[c] < THREAD_CACHE_DEPTH)
+        {
+          cache->chunks[c][cache->count[c]++] = chunk;
+          return;
+        }
+    }
+
+  region = chunk->parent_region;
+  free_chunk (chunk);
 
 #if FREE_EMPTY_REGIONS == 1
   BA_LOCK(d->mem_regions->mem_regions_lock);
@@ -478,35 +732,296 @@ pocl_pthread_free (void *data, cl_mem_flags flags, void *ptr)
   if (flags & CL_MEM_USE_HOST_PTR)
     return;
   
-  POCL_MEM_FREE(ptr);
+  pocl_memalign_free(ptr);
 }
 #endif
 
+static void
+run_copy_job (const copy_job *job)
+{
+  size_t size = job->last_byte - job->first_byte;
+  size_t row;
+
+  for (row = job->first_row; row < job->last_row; ++row)
+    {
+      size_t j = row % job->region[1];
+      size_t k = row / job->region[1];
+      char *dst = job->dst + job->dst_row_pitch * j +
+        job->dst_slice_pitch * k + job->first_byte;
+      const char *src = job->src + job->src_row_pitch * j +
+        job->src_slice_pitch * k + job->first_byte;
+
+      if (job->pattern != NULL)
+        pocl_fill_pattern (dst, size, job->pattern, job->pattern_size,
+                           job->streaming);
+      else if (job->streaming)
+        pocl_stream_memcpy (dst, src, size);
+      else
+        memcpy (dst, src, size);
+    }
+}
+
+static void *
+copy_worker (void *p)
+{
+  copy_job *job = (copy_job*)p;
+
+  if (job->numa_node != -1)
+    pocl_topology_bind_thread (job->numa_node);
+  run_copy_job (job);
+  return NULL;
+}
+
+/**
+ * Copies a 3D region between the host and a buffer or two buffers, or
+ * fills a buffer range.
+ *
+ * The large transfers are split across threads, one of them being the
+ * calling one. The rows are distributed to the threads, or the bytes
+ * of each row in case there are fewer rows than threads (as in the
+ * linear transfers). Above the streaming threshold the stores bypass
+ * the caches, as the data would only evict the working set.
+ */
+static void
+bulk_transfer (struct data *d, const copy_job *transfer)
+{
+  copy_job job = *transfer;
+  size_t *region = job.region;
+  size_t rows = region[1] * region[2];
+  size_t size = region[0] * rows;
+  size_t num_threads = 1, num_started;
+  size_t split_alignment = COPY_SPLIT_ALIGNMENT;
+  copy_job *jobs;
+  pthread_t *threads;
+  size_t i;
+
+  if (size == 0)
+    return;
+
+  job.first_row = 0;
+  job.last_row = rows;
+  job.first_byte = 0;
+  job.last_byte = region[0];
+  job.streaming = size >= d->streaming_copy_size;
+  job.numa_node = d->numa_node;
+
+  if (d->copy_thread_size != SIZE_MAX)
+    num_threads = min (size / d->copy_thread_size,
+                       (size_t)d->max_copy_threads);
+  if (num_threads < 2)
+    {
+      run_copy_job (&job);
+      return;
+    }
+
+  if (job.pattern != NULL && COPY_SPLIT_ALIGNMENT % job.pattern_size != 0)
+    split_alignment *= job.pattern_size;
+
+  jobs = (copy_job*) malloc (sizeof (copy_job) * num_threads);
+  threads = (pthread_t*) malloc (sizeof (pthread_t) * num_threads);
+  if (jobs == NULL || threads == NULL)
+    {
+      POCL_MEM_FREE (jobs);
+      POCL_MEM_FREE (threads);
+      run_copy_job (&job);
+      return;
+    }
+
+  for (i = 0; i < num_threads; ++i)
+    {
+      jobs[i] = job;
+      if (rows >= num_threads)
+        {
+          jobs[i].first_row = rows * i / num_threads;
+          jobs[i].last_row = rows * (i + 1) / num_threads;
+        }
+      else
+        {
+          jobs[i].first_byte = region[0] * i / num_threads /
+            split_alignment * split_alignment;
+          if (i + 1 < num_threads)
+            jobs[i].last_byte = region[0] * (i + 1) / num_threads /
+              split_alignment * split_alignment;
+        }
+    }
+
+  /* The calling thread handles the first part, and the parts no thread
+     could be created for. */
+  for (num_started = 1; num_started < num_threads; ++num_started)
+    {
+      if (pthread_create (&threads[num_started], NULL, copy_worker,
+                          &jobs[num_started]) != 0)
+        break;
+    }
+  for (i = num_started; i < num_threads; ++i)
+    run_copy_job (&jobs[i]);
+  run_copy_job (&jobs[0]);
+  for (i = 1; i < num_started; ++i)
+    pthread_join (threads[i], NULL);
+
+  POCL_MEM_FREE (jobs);
+  POCL_MEM_FREE (threads);
+}
+
+static void
+bulk_copy (struct data *d, void *dst, const void *src, const size_t *region,
+           size_t dst_row_pitch, size_t dst_slice_pitch,
+           size_t src_row_pitch, size_t src_slice_pitch)
+{
+  copy_job job;
+
+  job.dst = (char*)dst;
+  job.src = (const char*)src;
+  job.pattern = NULL;
+  job.pattern_size = 0;
+  memcpy (job.region, region, 3 * sizeof (size_t));
+  job.dst_row_pitch = dst_row_pitch;
+  job.dst_slice_pitch = dst_slice_pitch;
+  job.src_row_pitch = src_row_pitch;
+  job.src_slice_pitch = src_slice_pitch;
+  bulk_transfer (d, &job);
+}
+
 void
 pocl_pthread_read (void *data, void *host_ptr, const void *device_ptr, size_t cb)
 {
+  size_t region[3] = {cb, 1, 1};
+
   if (host_ptr == device_ptr)
     return;
 
-  memcpy (host_ptr, device_ptr, cb);
+  bulk_copy ((struct data*)data, host_ptr, device_ptr, region, 0, 0, 0, 0);
 }
 
 void
 pocl_pthread_write (void *data, const void *host_ptr, void *device_ptr, size_t cb)
 {
+  size_t region[3] = {cb, 1, 1};
+
   if (host_ptr == device_ptr)
     return;
-  
-  memcpy (device_ptr, host_ptr, cb);
+
+  bulk_copy ((struct data*)data, device_ptr, host_ptr, region, 0, 0, 0, 0);
 }
 
 void
 pocl_pthread_copy (void *data, const void *src_ptr, void *__restrict__ dst_ptr, size_t cb)
 {
+  size_t region[3] = {cb, 1, 1};
+
   if (src_ptr == dst_ptr)
     return;
-  
-  memcpy (dst_ptr, src_ptr, cb);
+
+  bulk_copy ((struct data*)data, dst_ptr, src_ptr, region, 0, 0, 0, 0);
+}
+
+void
+pocl_pthread_fill (void *data, void *device_ptr, size_t size,
+                   const void *pattern, size_t pattern_size)
+{
+  copy_job job;
+
+  memset (&job, 0, sizeof (job));
+  job.dst = (char*)device_ptr;
+  job.pattern = pattern;
+  job.pattern_size = pattern_size;
+  job.region[0] = size;
+  job.region[1] = job.region[2] = 1;
+  bulk_transfer ((struct data*)data, &job);
+}
+
+/* The rows of large images are filled by several threads. */
+void
+pocl_pthread_fill_rect (void *data,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        void *fill_pixel,
+                        size_t pixel_size)
+{
+  copy_job job;
+
+  memset (&job, 0, sizeof (job));
+  job.dst = (char*)device_ptr + buffer_origin[0] * pixel_size +
+    buffer_row_pitch * buffer_origin[1] +
+    buffer_slice_pitch * buffer_origin[2];
+  job.pattern = fill_pixel;
+  job.pattern_size = pixel_size;
+  job.region[0] = region[0] * pixel_size;
+  job.region[1] = region[1];
+  job.region[2] = region[2];
+  job.dst_row_pitch = buffer_row_pitch;
+  job.dst_slice_pitch = buffer_slice_pitch;
+  bulk_transfer ((struct data*)data, &job);
+}
+
+void
+pocl_pthread_copy_rect (void *data,
+                        const void *__restrict const src_ptr,
+                        void *__restrict__ const dst_ptr,
+                        const size_t *__restrict__ const src_origin,
+                        const size_t *__restrict__ const dst_origin,
+                        const size_t *__restrict__ const region,
+                        size_t const src_row_pitch,
+                        size_t const src_slice_pitch,
+                        size_t const dst_row_pitch,
+                        size_t const dst_slice_pitch)
+{
+  bulk_copy ((struct data*)data,
+             (char*)dst_ptr + dst_origin[0] + dst_row_pitch * dst_origin[1] +
+               dst_slice_pitch * dst_origin[2],
+             (char const*)src_ptr + src_origin[0] +
+               src_row_pitch * src_origin[1] + src_slice_pitch * src_origin[2],
+             region, dst_row_pitch, dst_slice_pitch,
+             src_row_pitch, src_slice_pitch);
+}
+
+void
+pocl_pthread_write_rect (void *data,
+                         const void *__restrict__ const host_ptr,
+                         void *__restrict__ const device_ptr,
+                         const size_t *__restrict__ const buffer_origin,
+                         const size_t *__restrict__ const host_origin,
+                         const size_t *__restrict__ const region,
+                         size_t const buffer_row_pitch,
+                         size_t const buffer_slice_pitch,
+                         size_t const host_row_pitch,
+                         size_t const host_slice_pitch)
+{
+  bulk_copy ((struct data*)data,
+             (char*)device_ptr + buffer_origin[0] +
+               buffer_row_pitch * buffer_origin[1] +
+               buffer_slice_pitch * buffer_origin[2],
+             (char const*)host_ptr + host_origin[0] +
+               host_row_pitch * host_origin[1] +
+               host_slice_pitch * host_origin[2],
+             region, buffer_row_pitch, buffer_slice_pitch,
+             host_row_pitch, host_slice_pitch);
+}
+
+void
+pocl_pthread_read_rect (void *data,
+                        void *__restrict__ const host_ptr,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const host_origin,
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        size_t const host_row_pitch,
+                        size_t const host_slice_pitch)
+{
+  bulk_copy ((struct data*)data,
+             (char*)host_ptr + host_origin[0] +
+               host_row_pitch * host_origin[1] +
+               host_slice_pitch * host_origin[2],
+             (char const*)device_ptr + buffer_origin[0] +
+               buffer_row_pitch * buffer_origin[1] +
+               buffer_slice_pitch * buffer_origin[2],
+             region, host_row_pitch, host_slice_pitch,
+             buffer_row_pitch, buffer_slice_pitch);
 }
 
 #define FALLBACK_MAX_THREAD_COUNT 8
@@ -545,13 +1060,47 @@ pocl_pthread_run
   d = (struct data *) data;
 
   int num_groups_x = pc->num_groups[0];
+
+  /* Single work-group launches (e.g. clEnqueueTask()) are executed
+     on the calling thread without creating a worker for them. The
+     calling thread belongs to the application and must not be bound,
+     thus the launches of a NUMA bound device still use a worker. */
+  if (pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2] == 1
+      && d->numa_node == -1)
+    {
+      arguments = new_thread_arguments();
+      arguments->data = data;
+      arguments->kernel = kernel;
+      arguments->device = cmd->device;
+      arguments->pc = *pc;
+      arguments->pc.group_id[0] = 0;
+      arguments->workgroup = cmd->command.run.wg;
+      arguments->workgroup_range = cmd->command.run.wg_range;
+      arguments->last_gid_x = 0;
+      arguments->kernel_args = cmd->command.run.arguments;
+      workgroup_thread (arguments);
+      return;
+    }
+
   /* TODO: distributing the work groups in the x dimension is not always the
      best option. This assumes x dimension has enough work groups to utilize
      all the threads. */
   if (max_threads == 0)
     max_threads = get_max_thread_count(cmd->device);
 
-  int num_threads = min(max_threads, num_groups_x);
+  /* The tuning profile of the kernel can override the thread count and
+     the minimum number of work-groups a thread executes. */
+  int kernel_threads =
+    pocl_get_kernel_int_option (kernel, THREAD_COUNT_ENV, max_threads);
+  int chunk_size =
+    pocl_get_kernel_int_option (kernel, CHUNK_SIZE_ENV, 1);
+  if (kernel_threads < 1)
+    kernel_threads = max_threads;
+  if (chunk_size < 1)
+    chunk_size = 1;
+
+  int num_threads = min(kernel_threads,
+                        (num_groups_x + chunk_size - 1) / chunk_size);
   pthread_t *threads = (pthread_t*) malloc (sizeof (pthread_t)*num_threads);
   
   int wgs_per_thread = num_groups_x / num_threads;
@@ -585,13 +1134,14 @@ pocl_pthread_run
     arguments->pc = *pc;
     arguments->pc.group_id[0] = first_gid_x;
     arguments->workgroup = cmd->command.run.wg;
+    arguments->workgroup_range = cmd->command.run.wg_range;
     arguments->last_gid_x = last_gid_x;
     arguments->kernel_args = cmd->command.run.arguments;
 
     /* TODO: pool of worker threads to avoid syscalls here */
     error = pthread_create (&threads[i],
                             NULL,
-                            workgroup_thread,
+                            workgroup_worker,
                             arguments);
     assert(!error);
   }
@@ -606,6 +1156,39 @@ pocl_pthread_run
   POCL_MEM_FREE(threads);
 }
 
+/**
+ * Moves the pages of a buffer to the NUMA node of the device, or of the
+ * calling thread in case of a migration to the host. Nothing is done
+ * for the devices not bound to a node, as their workers can run on any.
+ */
+void
+pocl_pthread_migrate_mem (void *data, void *ptr, size_t size,
+                          cl_mem_migration_flags flags)
+{
+  struct data *d = (struct data*)data;
+  int node = d->numa_node;
+  uintptr_t start, end;
+
+  if (flags & CL_MIGRATE_MEM_OBJECT_HOST)
+    node = pocl_topology_current_numa_node ();
+  if (node == -1 || pocl_topology_num_numa_nodes () < 2)
+    return;
+
+#ifdef MADV_DONTNEED
+  if (flags & CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED)
+    {
+      /* Drop the pages wholly inside the buffer instead of copying them,
+         they get allocated on the node when touched next time. */
+      start = ((uintptr_t)ptr + NUMA_PAGE_ALIGNMENT - 1) &
+        ~(uintptr_t)(NUMA_PAGE_ALIGNMENT - 1);
+      end = ((uintptr_t)ptr + size) & ~(uintptr_t)(NUMA_PAGE_ALIGNMENT - 1);
+      if (end > start)
+        madvise ((void*)start, end - start, MADV_DONTNEED);
+    }
+#endif
+  pocl_topology_set_mem_policy (ptr, size, POCL_NUMA_BIND, node);
+}
+
 void *
 pocl_pthread_map_mem (void *data, void *buf_ptr, 
                       size_t offset, size_t size, void* host_ptr) 
@@ -615,6 +1198,20 @@ pocl_pthread_map_mem (void *data, void *buf_ptr,
   return (char*)buf_ptr + offset;
 }
 
+/* The entry of the worker threads. Runs the work-groups of a NUMA bound
+   device on the CPUs of its node, so the pages of the buffers they touch
+   first are placed there. */
+static void *
+workgroup_worker (void *p)
+{
+  struct thread_arguments *ta = (struct thread_arguments *) p;
+  int numa_node = ((struct data*)ta->data)->numa_node;
+
+  if (numa_node != -1)
+    pocl_topology_bind_thread (numa_node);
+  return workgroup_thread (p);
+}
+
 void *
 workgroup_thread (void *p)
 {
@@ -696,6 +1293,17 @@ workgroup_thread (void *p)
     {
       for (gid_y = 0; gid_y < ta->pc.num_groups[1]; ++gid_y)
         {
+          /* The kernels without barriers execute the whole range of
+             the thread in one call. */
+          if (ta->workgroup_range != NULL)
+            {
+              ta->pc.group_id[0] = first_gid_x;
+              ta->pc.group_id[1] = gid_y;
+              ta->pc.group_id[2] = gid_z;
+              ta->workgroup_range (arguments, &(ta->pc),
+                                   ta->last_gid_x - first_gid_x + 1);
+              continue;
+            }
           for (gid_x = first_gid_x; gid_x <= ta->last_gid_x; ++gid_x)
             {
               ta->pc.group_id[0] = gid_x;
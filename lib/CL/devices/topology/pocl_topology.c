@@ -23,9 +23,14 @@
 
 #include <pocl_cl.h>
 #include <hwloc.h>
+#include <unistd.h>
 
 #include "pocl_topology.h"
 
+#if HWLOC_API_VERSION < 0x00010b00
+#define HWLOC_OBJ_NUMANODE HWLOC_OBJ_NODE
+#endif
+
 void
 pocl_topology_detect_device_info(cl_device_id device)
 {
@@ -57,4 +62,122 @@ pocl_topology_detect_device_info(cl_device_id device)
 
 }
 
+/* The topology used for the NUMA placement, loaded on the first use. */
+static hwloc_topology_t numa_topology;
+static int numa_topology_loaded = 0;
+static pocl_lock_t numa_topology_lock = POCL_LOCK_INITIALIZER;
+
+static hwloc_topology_t
+get_numa_topology ()
+{
+  POCL_LOCK (numa_topology_lock);
+  if (!numa_topology_loaded)
+    {
+      if (hwloc_topology_init (&numa_topology) == -1)
+        POCL_ABORT ("Cannot initialize the topology.\n");
+      if (hwloc_topology_load (numa_topology) == -1)
+        POCL_ABORT ("Cannot load the topology.\n");
+      numa_topology_loaded = 1;
+    }
+  POCL_UNLOCK (numa_topology_lock);
+  return numa_topology;
+}
+
+int
+pocl_topology_num_numa_nodes ()
+{
+  int n = hwloc_get_nbobjs_by_type (get_numa_topology (), HWLOC_OBJ_NUMANODE);
+  return n > 0 ? n : 1;
+}
+
+/**
+ * Returns the NUMA node of the CPU the calling thread last ran on, 0 in
+ * case it cannot be detected.
+ */
+int
+pocl_topology_current_numa_node ()
+{
+  hwloc_topology_t topology = get_numa_topology ();
+  hwloc_cpuset_t cpuset = hwloc_bitmap_alloc ();
+  hwloc_obj_t node = NULL;
 
+  if (hwloc_get_last_cpu_location (topology, cpuset, HWLOC_CPUBIND_THREAD) == 0)
+    node = hwloc_get_next_obj_covering_cpuset_by_type
+      (topology, cpuset, HWLOC_OBJ_NUMANODE, NULL);
+  hwloc_bitmap_free (cpuset);
+  return node != NULL ? (int)node->logical_index : 0;
+}
+
+/**
+ * Binds the calling thread to the CPUs of the given NUMA node.
+ *
+ * @return 0 on success.
+ */
+int
+pocl_topology_bind_thread (int node)
+{
+  hwloc_topology_t topology = get_numa_topology ();
+  hwloc_obj_t obj = hwloc_get_obj_by_type (topology, HWLOC_OBJ_NUMANODE, node);
+  if (obj == NULL)
+    return -1;
+  return hwloc_set_cpubind (topology, obj->cpuset, HWLOC_CPUBIND_THREAD);
+}
+
+/**
+ * Sets the NUMA placement policy of the pages of the given memory area.
+ *
+ * The pages already touched are migrated to follow the policy. Only
+ * the pages wholly inside the area are affected, as the partially
+ * covered ones can be shared with other allocations.
+ *
+ * @return 0 on success.
+ */
+int
+pocl_topology_set_mem_policy (void *ptr, size_t size,
+                              pocl_numa_policy policy, int node)
+{
+  hwloc_topology_t topology = get_numa_topology ();
+  hwloc_nodeset_t nodeset;
+  hwloc_membind_policy_t membind;
+  hwloc_obj_t obj;
+  uintptr_t page = (uintptr_t)sysconf (_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+  int ret;
+
+  if (end <= start)
+    return 0;
+
+  switch (policy)
+    {
+    case POCL_NUMA_INTERLEAVE:
+      membind = HWLOC_MEMBIND_INTERLEAVE;
+      nodeset = hwloc_bitmap_dup (hwloc_topology_get_topology_nodeset (topology));
+      break;
+    case POCL_NUMA_FIRST_TOUCH:
+      membind = HWLOC_MEMBIND_FIRSTTOUCH;
+      nodeset = hwloc_bitmap_dup (hwloc_topology_get_topology_nodeset (topology));
+      break;
+    case POCL_NUMA_BIND:
+      obj = hwloc_get_obj_by_type (topology, HWLOC_OBJ_NUMANODE, node);
+      if (obj == NULL)
+        return -1;
+      membind = HWLOC_MEMBIND_BIND;
+      nodeset = hwloc_bitmap_dup (obj->nodeset);
+      break;
+    default:
+      return 0;
+    }
+
+#if HWLOC_API_VERSION >= 0x00020000
+  ret = hwloc_set_area_membind (topology, (void*)start, end - start, nodeset,
+                                membind,
+                                HWLOC_MEMBIND_BYNODESET | HWLOC_MEMBIND_MIGRATE);
+#else
+  ret = hwloc_set_area_membind_nodeset (topology, (void*)start, end - start,
+                                        nodeset, membind,
+                                        HWLOC_MEMBIND_MIGRATE);
+#endif
+  hwloc_bitmap_free (nodeset);
+  return ret;
+}
@@ -35,8 +35,24 @@
 
 #define MIN_MAX_MEM_ALLOC_SIZE (128*1024*1024)
 
+/* The NUMA placement policies of buffers. */
+typedef enum
+  {
+    POCL_NUMA_DEFAULT,     /* the policy of the allocating thread */
+    POCL_NUMA_INTERLEAVE,  /* pages interleaved across all the nodes */
+    POCL_NUMA_FIRST_TOUCH, /* pages on the node of the thread touching
+                              them first */
+    POCL_NUMA_BIND         /* pages on the given node */
+  } pocl_numa_policy;
+
 #pragma GCC visibility push(hidden)
 void pocl_topology_detect_device_info(cl_device_id device);
+
+int pocl_topology_num_numa_nodes ();
+int pocl_topology_current_numa_node ();
+int pocl_topology_bind_thread (int node);
+int pocl_topology_set_mem_policy (void *ptr, size_t size,
+                                  pocl_numa_policy policy, int node);
 #pragma GCC visibility pop
 
 #endif /* POCL_TOPOLOGY_H */
@@ -0,0 +1,275 @@
+/* pocl_autotune.c: local work size autotuning for the launches without
+   a local size
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_autotune.h"
+#include "utlist.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The launches of a kernel with no local size are executed with each
+   candidate local size once, after which the fastest one per work-item
+   is used for the rest of the launches. The winner is stored to the
+   kernel's dir in the kernel cache, thus later processes using the
+   cache skip the tuning. The candidates are handed out in turns until
+   each has been measured, thus a launch which fails or is never run
+   only delays the tuning. */
+
+static unsigned
+size_class (size_t size)
+{
+  unsigned c = 0;
+  while (((size_t)1 << c) < size)
+    ++c;
+  return c;
+}
+
+static int
+fits (cl_device_id device, const size_t *global, const size_t *local)
+{
+  int i;
+  if (local[0] * local[1] * local[2] > device->max_work_group_size)
+    return 0;
+  for (i = 0; i < 3; ++i)
+    {
+      if (local[i] == 0 || global[i] % local[i] != 0 ||
+          local[i] > device->max_work_item_sizes[i])
+        return 0;
+    }
+  return 1;
+}
+
+static void
+add_candidate (pocl_autotune_entry *entry, size_t x, size_t y, size_t z)
+{
+  unsigned i;
+  if (entry->num_candidates == POCL_AUTOTUNE_MAX_CANDIDATES)
+    return;
+  for (i = 0; i < entry->num_candidates; ++i)
+    {
+      if (entry->candidates[i][0] == x && entry->candidates[i][1] == y &&
+          entry->candidates[i][2] == z)
+        return;
+    }
+  entry->candidates[i][0] = x;
+  entry->candidates[i][1] = y;
+  entry->candidates[i][2] = z;
+  ++entry->num_candidates;
+}
+
+/* The candidates are the size chosen by the default heuristics and the
+   SIMD friendly sizes along the x dimension, from the largest down. */
+static void
+init_candidates (pocl_autotune_entry *entry, cl_device_id device,
+                 const size_t *global, size_t preferred_multiple,
+                 const size_t *local)
+{
+  size_t c[3] = {0, 1, 1};
+  size_t x;
+
+  add_candidate (entry, local[0], local[1], local[2]);
+
+  if (preferred_multiple == 0)
+    preferred_multiple = 1;
+  for (x = preferred_multiple; x * 2 <= global[0]; x *= 2)
+    ;
+  for (; x >= preferred_multiple; x /= 2)
+    {
+      c[0] = x;
+      if (fits (device, global, c))
+        add_candidate (entry, c[0], c[1], c[2]);
+    }
+}
+
+static void
+tuning_filename (char *filename, cl_kernel kernel,
+                 const pocl_autotune_entry *entry)
+{
+  snprintf (filename, POCL_FILENAME_LENGTH,
+            "%s/%s/%s/autotune-%ud-%u-%u-%u", kernel->program->cache_dir,
+            entry->device->cache_dir_name, kernel->name, entry->work_dim,
+            entry->size_class[0], entry->size_class[1], entry->size_class[2]);
+}
+
+static void
+load_tuning (cl_kernel kernel, pocl_autotune_entry *entry)
+{
+  char filename[POCL_FILENAME_LENGTH];
+  FILE *fp;
+
+  tuning_filename (filename, kernel, entry);
+  fp = fopen (filename, "r");
+  if (fp == NULL)
+    return;
+  if (fscanf (fp, "%zu %zu %zu", &entry->best[0], &entry->best[1],
+              &entry->best[2]) == 3)
+    entry->tuned = 1;
+  fclose (fp);
+}
+
+static void
+store_tuning (cl_kernel kernel, const pocl_autotune_entry *entry)
+{
+  char filename[POCL_FILENAME_LENGTH];
+  FILE *fp;
+
+  tuning_filename (filename, kernel, entry);
+  fp = fopen (filename, "w");
+  if (fp == NULL)
+    return;
+  fprintf (fp, "%zu %zu %zu\n", entry->best[0], entry->best[1],
+           entry->best[2]);
+  fclose (fp);
+}
+
+/**
+ * Picks the local size for a launch without one.
+ *
+ * local holds the size chosen by the default heuristics. In case the
+ * kernel has been tuned for the global size class, it is replaced with
+ * the tuned size. Otherwise the next candidate still to measure is
+ * stored to it, and the entry to record the execution time of the
+ * launch to is returned with the index of the candidate in *candidate.
+ *
+ * @return The tuning entry in case the launch is a measurement, NULL
+ * otherwise.
+ */
+pocl_autotune_entry *
+pocl_autotune_local_size (cl_device_id device, cl_kernel kernel,
+                          unsigned work_dim, const size_t *global,
+                          size_t preferred_multiple, size_t *local,
+                          unsigned *candidate)
+{
+  pocl_autotune_entry *entry = NULL;
+  unsigned classes[3];
+  unsigned c;
+  int i;
+
+  for (i = 0; i < 3; ++i)
+    classes[i] = size_class (global[i]);
+
+  POCL_LOCK_OBJ (kernel);
+  LL_FOREACH (kernel->autotune, entry)
+    {
+      if (entry->device == device && entry->work_dim == work_dim &&
+          memcmp (entry->size_class, classes, sizeof (classes)) == 0)
+        break;
+    }
+
+  if (entry == NULL)
+    {
+      entry = (pocl_autotune_entry *) calloc (1, sizeof (pocl_autotune_entry));
+      if (entry == NULL)
+        {
+          POCL_UNLOCK_OBJ (kernel);
+          return NULL;
+        }
+      entry->device = device;
+      entry->work_dim = work_dim;
+      memcpy (entry->size_class, classes, sizeof (classes));
+      load_tuning (kernel, entry);
+      if (!entry->tuned)
+        init_candidates (entry, device, global, preferred_multiple, local);
+      LL_APPEND (kernel->autotune, entry);
+    }
+
+  if (entry->tuned)
+    {
+      if (fits (device, global, entry->best))
+        memcpy (local, entry->best, 3 * sizeof (size_t));
+      entry = NULL;
+    }
+  else
+    {
+      for (i = 0; i < (int)entry->num_candidates; ++i)
+        {
+          c = (entry->next_candidate + i) % entry->num_candidates;
+          if (!entry->measured[c] &&
+              fits (device, global, entry->candidates[c]))
+            break;
+        }
+      if (i < (int)entry->num_candidates)
+        {
+          *candidate = c;
+          entry->next_candidate = c + 1;
+          memcpy (local, entry->candidates[c], 3 * sizeof (size_t));
+          POCL_MSG_PRINT_INFO ("Autotuning kernel %s with local size "
+                               "%zu x %zu x %zu\n", kernel->name,
+                               local[0], local[1], local[2]);
+        }
+      else
+        entry = NULL;
+    }
+  POCL_UNLOCK_OBJ (kernel);
+  return entry;
+}
+
+/**
+ * Records the execution time of a launch with a candidate local size.
+ *
+ * After all the candidates have been measured, the fastest one becomes
+ * the tuned local size of the entry.
+ */
+void
+pocl_autotune_record (cl_kernel kernel, pocl_autotune_entry *entry,
+                      unsigned candidate, size_t work_items, cl_ulong time)
+{
+  unsigned i, best = 0;
+
+  POCL_LOCK_OBJ (kernel);
+  /* A candidate can be measured again by the launches in flight. */
+  if (entry->tuned || entry->measured[candidate])
+    {
+      POCL_UNLOCK_OBJ (kernel);
+      return;
+    }
+  entry->times[candidate] = (double)time / work_items;
+  entry->measured[candidate] = 1;
+  if (++entry->num_measured == entry->num_candidates)
+    {
+      for (i = 1; i < entry->num_candidates; ++i)
+        {
+          if (entry->times[i] < entry->times[best])
+            best = i;
+        }
+      memcpy (entry->best, entry->candidates[best], 3 * sizeof (size_t));
+      entry->tuned = 1;
+      store_tuning (kernel, entry);
+      POCL_MSG_PRINT_INFO ("Tuned kernel %s to local size %zu x %zu x %zu\n",
+                           kernel->name, entry->best[0], entry->best[1],
+                           entry->best[2]);
+    }
+  POCL_UNLOCK_OBJ (kernel);
+}
+
+void
+pocl_autotune_free (cl_kernel kernel)
+{
+  pocl_autotune_entry *entry, *tmp;
+  LL_FOREACH_SAFE (kernel->autotune, entry, tmp)
+    {
+      LL_DELETE (kernel->autotune, entry);
+      free (entry);
+    }
+}
@@ -0,0 +1,74 @@
+/* pocl_autotune.h: local work size autotuning for the launches without
+   a local size
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef POCL_AUTOTUNE_H
+#define POCL_AUTOTUNE_H
+
+#include "pocl_cl.h"
+
+#define POCL_AUTOTUNE_MAX_CANDIDATES 8
+
+/* The tuning state of a kernel on a device for the launches with the
+   global size in the same class (the same power of two rounded up in
+   each dimension). */
+typedef struct pocl_autotune_entry pocl_autotune_entry;
+struct pocl_autotune_entry
+{
+  cl_device_id device;
+  unsigned work_dim;
+  unsigned size_class[3];
+  unsigned num_candidates;
+  size_t candidates[POCL_AUTOTUNE_MAX_CANDIDATES][3];
+  /* The execution time per work-item of each measured candidate. */
+  double times[POCL_AUTOTUNE_MAX_CANDIDATES];
+  int measured[POCL_AUTOTUNE_MAX_CANDIDATES];
+  /* The candidate to try first for the next launch. */
+  unsigned next_candidate;
+  unsigned num_measured;
+  int tuned;
+  size_t best[3];
+  pocl_autotune_entry *next;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+pocl_autotune_entry *
+pocl_autotune_local_size (cl_device_id device, cl_kernel kernel,
+                          unsigned work_dim, const size_t *global,
+                          size_t preferred_multiple, size_t *local,
+                          unsigned *candidate);
+
+void pocl_autotune_record (cl_kernel kernel, pocl_autotune_entry *entry,
+                           unsigned candidate, size_t work_items,
+                           cl_ulong time);
+
+void pocl_autotune_free (cl_kernel kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -61,6 +61,13 @@
 #define POCL_BUILDLOG_FILENAME      "build.log"
 #define POCL_LAST_ACCESSED_FILENAME "last_accessed"
 
+/* The cl_mem_flags of the pocl extensions, allowed besides the core ones. */
+#define POCL_MEM_NUMA_FLAGS (CL_MEM_NUMA_INTERLEAVE_POCL |                  \
+                             CL_MEM_NUMA_FIRST_TOUCH_POCL |                 \
+                             CL_MEM_NUMA_BIND_POCL)
+#define POCL_MEM_EXT_FLAGS (CL_MEM_HUGE_PAGES_POCL | CL_MEM_NO_HUGE_PAGES_POCL | \
+                            POCL_MEM_NUMA_FLAGS)
+
 #if __STDC_VERSION__ < 199901L
 # if __GNUC__ >= 2
 #  define __func__ __PRETTY_FUNCTION__
@@ -204,19 +211,20 @@ typedef pthread_mutex_t pocl_lock_t;
 #define POCL_LOCK_OBJ(__OBJ__) POCL_LOCK((__OBJ__)->pocl_lock)
 #define POCL_UNLOCK_OBJ(__OBJ__) POCL_UNLOCK((__OBJ__)->pocl_lock)
 
+/* The reference counts are updated atomically, the object lock is
+   only for the changes of the object state. The atomic builtins are
+   full barriers, thus the releasing thread reaching 0 sees the writes
+   done by the others before their releases. */
 #define POCL_RELEASE_OBJECT(__OBJ__, __NEW_REFCOUNT__)  \
   do {                                                  \
-    POCL_LOCK_OBJ (__OBJ__);                            \
-    __NEW_REFCOUNT__ = --(__OBJ__)->pocl_refcount;      \
-    POCL_UNLOCK_OBJ (__OBJ__);                          \
+    __NEW_REFCOUNT__ =                                  \
+      __sync_sub_and_fetch (&(__OBJ__)->pocl_refcount, 1); \
     if (__NEW_REFCOUNT__ == 0) POCL_DESTROY_LOCK ((__OBJ__)->pocl_lock); \
   } while (0)
 
 #define POCL_RETAIN_OBJECT(__OBJ__)             \
   do {                                          \
-    POCL_LOCK_OBJ (__OBJ__);                    \
-    (__OBJ__)->pocl_refcount++;                   \
-    POCL_UNLOCK_OBJ (__OBJ__);                  \
+    __sync_add_and_fetch (&(__OBJ__)->pocl_refcount, 1); \
   } while (0)
 
 /* The reference counter is initialized to 1,
@@ -248,7 +256,7 @@ typedef pthread_mutex_t pocl_lock_t;
 /* Declares the generic pocl object attributes inside a struct. */
 #define POCL_OBJECT \
   pocl_lock_t pocl_lock; \
-  int pocl_refcount 
+  volatile int pocl_refcount 
 
 #define POCL_OBJECT_INIT \
   POCL_LOCK_INITIALIZER, 0
@@ -374,6 +382,12 @@ struct pocl_device_ops {
                      size_t dst_row_pitch,
                      size_t dst_slice_pitch);
 
+  /* Fills 'size' bytes of device global memory at device_ptr with
+     copies of the pattern. Optional, the devices without it are filled
+     with writes. */
+  void (*fill) (void *data, void *device_ptr, size_t size,
+                const void *pattern, size_t pattern_size);
+
 void (*fill_rect) (void *data,
                    void *__restrict__ const device_ptr,
                    const size_t *__restrict__ const buffer_origin,
@@ -388,6 +402,12 @@ void (*fill_rect) (void *data,
      the block from the device. */
   void* (*map_mem) (void *data, void *buf_ptr, size_t offset, size_t size, void *host_ptr);
   void* (*unmap_mem) (void *data, void *host_ptr, void *device_start_ptr, size_t size);
+  /* Moves the pages of 'size' bytes of device global memory at ptr close
+     to the device, or to the host with CL_MIGRATE_MEM_OBJECT_HOST. The
+     contents can be discarded with CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED.
+     Optional. */
+  void (*migrate_mem) (void *data, void *ptr, size_t size,
+                       cl_mem_migration_flags flags);
   
   void (*compile_submitted_kernels) (_cl_command_node* cmd);
   void (*run) (void *data, _cl_command_node* cmd);
@@ -488,6 +508,12 @@ struct _cl_device_id {
   void *data;
   const char* llvm_target_triplet; /* the llvm target triplet to use */
   const char* llvm_cpu; /* the llvm CPU variant to use */
+  /* comma separated llvm target features ("+avx2,-avx512f") detected
+     at runtime for the CPU variant, or NULL to use the CPU's defaults */
+  const char* llvm_cpu_features;
+  /* bitmask of the ISA levels (pocl_isa_level) to build variants of
+     the work-group functions for, 0 if not multi-versioned */
+  unsigned isa_variants;
   /* A running number (starting from zero) across all the device instances. Used for 
      indexing  arrays in data structures with device specific entries. */
   int dev_id;
@@ -562,6 +588,9 @@ struct _cl_mem {
   /* in case this is a sub buffer, this points to the parent
      buffer */
   cl_mem_t *parent;
+  /* The mmap()ed file range backing the buffer, NULL if none. */
+  void *file_map;
+  size_t file_map_size;
   /* Image flags */
   cl_bool                 is_image;
   cl_channel_order        image_channel_order;
@@ -624,6 +653,19 @@ struct _cl_kernel {
   /* The kernel arguments that are set with clSetKernelArg().
      These are copied to the command queue command at enqueue. */
   struct pocl_argument *dyn_arguments;
+  /* The launch-time specialization state (POCL_KERNEL_SPECIALIZE): the
+     value of each scalar argument in the previous launch and the number
+     of consecutive launches it has had that value. Allocated at the
+     first launch with the specialization enabled. */
+  cl_ulong *spec_values;
+  unsigned *spec_repeats;
+  /* The cache dir and the device the work-group function was last
+     generated for, to skip the file system checks when the kernel is
+     launched again in the same configuration. */
+  char *wg_cachedir;
+  cl_device_id wg_device;
+  /* The local size autotuning state (POCL_AUTOTUNE_LOCAL_SIZE). */
+  struct pocl_autotune_entry *autotune;
   struct _cl_kernel *next;
 };
 
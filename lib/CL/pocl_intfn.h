@@ -30,6 +30,7 @@
 
 POdeclsym(clBuildProgram)
 POdeclsym(clCreateBuffer)
+POdeclsym(clCreateBufferFromFilePOCL)
 POdeclsym(clCreateCommandQueue)
 POdeclsym(clCreateContext)
 POdeclsym(clCreateContextFromType)
@@ -64,9 +65,11 @@ POdeclsym(clEnqueueTask)
 POdeclsym(clEnqueueUnmapMemObject)
 POdeclsym(clEnqueueWaitForEvents)
 POdeclsym(clEnqueueMarkerWithWaitList)
+POdeclsym(clEnqueueMigrateMemObjects)
 POdeclsym(clEnqueueWriteBuffer)
 POdeclsym(clEnqueueWriteBufferRect)
 POdeclsym(clEnqueueWriteImage)
+POdeclsym(clEnqueueFillBuffer)
 POdeclsym(clEnqueueFillImage)
 POdeclsym(clFinish)
 POdeclsym(clFlush)
@@ -58,17 +58,31 @@ int pocl_llvm_get_kernel_metadata
  * runs pocl's kernel compiler passes on that module to produce 
  * a function that executes all work-items in a work-group.
  *
+ * The work-group function is optimized for the given ISA level
+ * (pocl_isa_level) of a multi-versioned kernel, or for the device's own
+ * target in case of POCL_ISA_LEVEL_NATIVE.
+ *
  * Output is a LLVM bitcode file that contains a work-group function
  * and its associated launchers. 
  *
+ * In case work_dim is not zero, a launcher specialized for work_dim
+ * dimensions and a zero global offset is generated in addition to the
+ * generic one.
+ *
+ * In case spec_args is not NULL, the kernel arguments with a non-NULL
+ * value in it are replaced with the value (launch-time specialization).
+ *
  * TODO: this is not thread-safe, it changes the LLVM global options to
  * control the compilation. We should enforce only one compilations is done
  * at a time or control the options through thread safe methods.
  */
 int pocl_llvm_generate_workgroup_function
 (cl_device_id device,
+ int isa_level,
  cl_kernel kernel,
  size_t local_x, size_t local_y, size_t local_z,
+ unsigned work_dim,
+ const struct pocl_argument *spec_args,
  const char* parallel_filename,
  const char* kernel_filename);
 
@@ -92,13 +106,19 @@ void pocl_llvm_update_binaries (cl_program program);
 int pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned max_num_krn);
 
 /** Compile the kernel in infile from LLVM bitcode to native object file for
- * device, into outfile.
+ * device (or for the given ISA level of it), into outfile.
  */
 int pocl_llvm_codegen ( cl_kernel kernel,
                         cl_device_id device,
+                        int isa_level,
                         const char *infile,
                         const char *outfile);
 
+/** Returns the LLVM name of the CPU pocl is running on, or NULL if LLVM
+ * could not recognize it.
+ */
+const char* pocl_llvm_get_host_cpu_name ();
+
 /* Parse program file and populate program's llvm_irs */
 void
 pocl_update_program_llvm_irs(cl_program program,
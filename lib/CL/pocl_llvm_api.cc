@@ -77,6 +77,7 @@
 #include <vector>
 #include <sstream>
 #include <string>
+#include <cstring>
 
 #ifndef _MSC_VER
 #  include <unistd.h>
@@ -90,6 +91,7 @@
 #include "LLVMUtils.h"
 #include "linker.h"
 #include "pocl_util.h"
+#include "cpuinfo.h"
 
 using namespace clang;
 using namespace llvm;
@@ -177,6 +179,20 @@ load_source(FrontendOptions &fe,
   return 0;
 }
 
+// Split the comma separated target feature list of the device
+// (device->llvm_cpu_features) to the individual "+feature" items.
+static void
+split_features(const char *features, std::vector<std::string> &out)
+{
+  std::stringstream ss(features);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    {
+      if (!item.empty())
+        out.push_back(item);
+    }
+}
+
 // Compatibility function: this function existed up to LLVM 3.5
 // With 3.6 its name & signature changed
 #if !(defined LLVM_3_2 || defined LLVM_3_3 || \
@@ -262,6 +278,13 @@ int pocl_llvm_build_program(cl_program program,
   ss << "-triple=" << device->llvm_target_triplet << " ";
   if (device->llvm_cpu != NULL)
     ss << "-target-cpu " << device->llvm_cpu << " ";
+  if (device->llvm_cpu_features != NULL)
+    {
+      std::vector<std::string> features;
+      split_features (device->llvm_cpu_features, features);
+      for (unsigned f = 0; f < features.size(); ++f)
+        ss << "-target-feature " << features[f] << " ";
+    }
   ss << user_options << " ";
   std::istream_iterator<std::string> begin(ss);
   std::istream_iterator<std::string> end;
@@ -351,6 +374,8 @@ int pocl_llvm_build_program(cl_program program,
   ta.Triple = device->llvm_target_triplet;
   if (device->llvm_cpu != NULL)
     ta.CPU = device->llvm_cpu;
+  if (device->llvm_cpu_features != NULL)
+    split_features (device->llvm_cpu_features, ta.Features);
 
   // printf("### Triple: %s, CPU: %s\n", ta.Triple.c_str(), ta.CPU.c_str());
 
@@ -843,12 +868,25 @@ static llvm::TargetOptions GetTargetOptions() {
   return Options;
 }
 // Returns the TargetMachine instance or zero if no triple is provided.
+// The isa_level selects the CPU variant and features of a multi-versioned
+// work-group function instead of the device's own.
 static TargetMachine* GetTargetMachine(cl_device_id device,
- const std::vector<std::string>& MAttrs=std::vector<std::string>()) {
+ int isa_level=POCL_ISA_LEVEL_NATIVE,
+ const std::vector<std::string>& ExtraMAttrs=std::vector<std::string>()) {
 
   std::string Error;
   Triple TheTriple(device->llvm_target_triplet);
   std::string MCPU =  device->llvm_cpu ? device->llvm_cpu : "";
+  const char *cpu_features = device->llvm_cpu_features;
+  if (isa_level != POCL_ISA_LEVEL_NATIVE)
+    {
+      MCPU = pocl_isa_level_llvm_cpu(isa_level);
+      cpu_features = pocl_isa_level_llvm_features(isa_level);
+    }
+  std::vector<std::string> MAttrs;
+  if (cpu_features != NULL)
+    split_features (cpu_features, MAttrs);
+  MAttrs.insert (MAttrs.end(), ExtraMAttrs.begin(), ExtraMAttrs.end());
   const Target *TheTarget = 
     TargetRegistry::lookupTarget("", TheTriple, Error);
   
@@ -893,19 +931,35 @@ static void InitializeLLVM() {
 /**
  * Prepare the kernel compiler passes.
  *
- * The passes are created only once per program run per device.
+ * The passes are created only once per program run per device and
+ * per the work-group method and scalarization options of the kernel,
+ * which its tuning profile can override.
  * The returned pass manager should not be modified, only the Module
  * should be optimized using it.
  */
 static PassManager& kernel_compiler_passes
-(cl_device_id device, std::string module_data_layout)
+(cl_device_id device, int isa_level, std::string module_data_layout,
+ cl_kernel kernel)
 {
-  static std::map<cl_device_id, PassManager*> kernel_compiler_passes;
+  const std::string wg_method = 
+    pocl_get_kernel_string_option(kernel, "POCL_WORK_GROUP_METHOD", "loopvec");
+#if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  // Scalarizer is in LLVM upstream since 3.4.
+  const bool SCALARIZE =
+    pocl_is_kernel_option_set(kernel, "POCL_SCALARIZE_KERNELS");
+#else
+  const bool SCALARIZE = false;
+#endif
 
-  if (kernel_compiler_passes.find(device) != 
+  typedef std::pair<std::pair<cl_device_id, int>, std::string> PassesKey;
+  static std::map<PassesKey, PassManager*> kernel_compiler_passes;
+  const PassesKey key(std::make_pair(device, isa_level),
+                      wg_method + (SCALARIZE ? "+scalarize" : ""));
+
+  if (kernel_compiler_passes.find(key) != 
       kernel_compiler_passes.end())
     {
-      return *kernel_compiler_passes[device];
+      return *kernel_compiler_passes[key];
     }
 
   Triple triple(device->llvm_target_triplet);
@@ -927,12 +981,6 @@ static PassManager& kernel_compiler_passes
     initializeTarget(Registry);
   }
 
-#if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
-  // Scalarizer is in LLVM upstream since 3.4.
-  const bool SCALARIZE = pocl_is_option_set("POCL_SCALARIZE_KERNELS");
-#else
-  const bool SCALARIZE = false;
-#endif
 
 #ifndef LLVM_3_2
   StringMap<llvm::cl::Option*> opts;
@@ -942,7 +990,7 @@ static PassManager& kernel_compiler_passes
   PassManager *Passes = new PassManager();
 
   // Need to setup the target info for target specific passes. */
-  TargetMachine *Machine = GetTargetMachine(device);
+  TargetMachine *Machine = GetTargetMachine(device, isa_level);
   // Add internal analysis passes from the target machine.
 #ifndef LLVM_3_2
   if (Machine != NULL)
@@ -995,8 +1043,13 @@ static PassManager& kernel_compiler_passes
   passes.push_back("flatten");
   passes.push_back("always-inline");
   passes.push_back("globaldce");
+  // The work-group functions become barriers for the passes below.
+  passes.push_back("workgroup-collectives");
   passes.push_back("simplifycfg");
   passes.push_back("loop-simplify");
+  // Move the kernel body to work-item fibers in case they were chosen. The
+  // barrier handling passes below then see a kernel without barriers.
+  passes.push_back("workitemfibers");
   passes.push_back("uniformity");
   passes.push_back("phistoallocas");
   passes.push_back("isolate-regions");
@@ -1010,6 +1063,14 @@ static PassManager& kernel_compiler_passes
   passes.push_back("workitemrepl");
   //passes.push_back("print-module");
   passes.push_back("workitemloops");
+  // Hoist the uniform computation out of the work-item loops. Uses the
+  // uniformity info preserved by -workitemloops.
+  passes.push_back("wiloop-hoist");
+  // Vectorize the work-item loops explicitly across the work-items. Uses
+  // the uniformity info preserved by the two previous passes, thus must run
+  // directly after them.
+  if (wg_method == "wivec")
+    passes.push_back("wiloop-vectorize");
   passes.push_back("allocastoentry");
   passes.push_back("workgroup");
   passes.push_back("target-address-spaces");
@@ -1019,11 +1080,8 @@ static PassManager& kernel_compiler_passes
   passes.push_back("simplifycfg");
   //passes.push_back("print-module");
 
-  const std::string wg_method = 
-    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "loopvec");
-
 #ifndef LLVM_3_2
-  if (wg_method == "loopvec")
+  if (wg_method == "loopvec" || wg_method == "wivec")
     {
 
       if (SCALARIZE)
@@ -1105,7 +1163,7 @@ static PassManager& kernel_compiler_passes
 #if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
           // These need to be setup in addition to invoking the passes
           // to get the vectorizers initialized properly.
-          if (wg_method == "loopvec") {
+          if (wg_method == "loopvec" || wg_method == "wivec") {
             Builder.LoopVectorize = true;
             Builder.SLPVectorize = true;
             Builder.BBVectorize = true;
@@ -1134,7 +1192,7 @@ static PassManager& kernel_compiler_passes
           POCL_ABORT("FAIL");
         }
     }
-  kernel_compiler_passes[device] = Passes;
+  kernel_compiler_passes[key] = Passes;
   return *Passes;
 }
 
@@ -1208,9 +1266,72 @@ kernel_library
 /* This is used to control the kernel we want to process in the kernel compilation. */
 extern cl::opt<std::string> KernelName;
 
+namespace pocl {
+extern llvm::cl::list<std::string> KernelOptions;
+}
+
+/* Passes an option override of the tuning profile of the kernel to
+   the kernel compiler passes. */
+static void
+add_kernel_option(const char *key, const char *value, void *)
+{
+  pocl::KernelOptions.addValue(std::string(key) + "=" + value);
+}
+/* The work_dim to generate the specialized launcher for. */
+extern cl::opt<unsigned> WorkDim;
+
+/**
+ * Replaces the uses of the specialized kernel arguments with their
+ * values. Only the scalar integer and floating point arguments are
+ * specialized, the rest are left as they are.
+ */
+static void
+specialize_kernel_arguments(llvm::Module *input, cl_kernel kernel,
+                            const struct pocl_argument *spec_args)
+{
+  llvm::Function *F = input->getFunction(kernel->name);
+  if (F == NULL)
+    return;
+
+  unsigned i = 0;
+  for (llvm::Function::arg_iterator a = F->arg_begin(), e = F->arg_end();
+       a != e && i < kernel->num_args; ++a, ++i)
+    {
+      const struct pocl_argument *arg = &spec_args[i];
+      if (arg->value == NULL || arg->size > sizeof(uint64_t))
+        continue;
+
+      llvm::Type *t = a->getType();
+      llvm::Constant *c = NULL;
+      if (t->isIntegerTy() && t->getIntegerBitWidth() <= arg->size * 8)
+        {
+          uint64_t bits = 0;
+          memcpy(&bits, arg->value, arg->size);
+          c = llvm::ConstantInt::get(t, bits);
+        }
+      else if (t->isFloatTy() && arg->size == sizeof(float))
+        {
+          float f;
+          memcpy(&f, arg->value, sizeof(float));
+          c = llvm::ConstantFP::get(t, f);
+        }
+      else if (t->isDoubleTy() && arg->size == sizeof(double))
+        {
+          double d;
+          memcpy(&d, arg->value, sizeof(double));
+          c = llvm::ConstantFP::get(t, d);
+        }
+      if (c != NULL)
+        a->replaceAllUsesWith(c);
+    }
+}
+
 int pocl_llvm_generate_workgroup_function(cl_device_id device,
+                                          int isa_level,
                                           cl_kernel kernel,
                                           size_t local_x, size_t local_y, size_t local_z,
+                                          unsigned work_dim,
+                                          const struct pocl_argument *spec_args,
                                           const char* parallel_filename,
                                           const char* kernel_filename)
 {
@@ -1254,6 +1375,9 @@ int pocl_llvm_generate_workgroup_function(cl_device_id device,
   assert (libmodule != NULL);
   link(input, libmodule);
 
+  if (spec_args != NULL)
+    specialize_kernel_arguments(input, kernel, spec_args);
+
   /* Now finally run the set of passes assembled above */
   // TODO pass these as parameters instead, this is not thread safe!
   pocl::LocalSize.clear();
@@ -1261,15 +1385,24 @@ int pocl_llvm_generate_workgroup_function(cl_device_id device,
   pocl::LocalSize.addValue(local_y);
   pocl::LocalSize.addValue(local_z);
   KernelName = kernel->name;
+  WorkDim = work_dim;
+  pocl::KernelOptions.clear();
+  pocl_foreach_kernel_option(kernel, add_kernel_option, NULL);
 
 #if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
-  kernel_compiler_passes(device, input->getDataLayout()).run(*input);
+  kernel_compiler_passes(device, isa_level,
+                         input->getDataLayout(), kernel).run(*input);
 #else
-  kernel_compiler_passes(device,
-                         input->getDataLayout()->getStringRepresentation())
+  kernel_compiler_passes(device, isa_level,
+                         input->getDataLayout()->getStringRepresentation(),
+                         kernel)
                         .run(*input);
 #endif
 
+  // The work-item fibers call the scheduler of the kernel library which
+  // was not referred to at the time of the initial link.
+  link_functions(input, libmodule);
+
   // TODO: don't write this once LLC is called via API, not system()
   write_temporary_file(input, parallel_filename);
 
@@ -1377,6 +1510,7 @@ pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned ma
 int
 pocl_llvm_codegen(cl_kernel kernel,
                   cl_device_id device,
+                  int isa_level,
                   const char *infilename,
                   const char *outfilename)
 {
@@ -1392,7 +1526,7 @@ pocl_llvm_codegen(cl_kernel kernel,
     tool_output_file outfile(outfilename, error, F_Binary);
 #endif
     llvm::Triple triple(device->llvm_target_triplet);
-    llvm::TargetMachine *target = GetTargetMachine(device);
+    llvm::TargetMachine *target = GetTargetMachine(device, isa_level);
     llvm::Module *input = ParseIRFile(infilename, Err, *GlobalContext());
 
     llvm::PassManager PM;
@@ -1428,5 +1562,13 @@ pocl_llvm_codegen(cl_kernel kernel,
 
     return 0;
 }
-/* vim: set ts=4 expandtab: */
 
+const char*
+pocl_llvm_get_host_cpu_name ()
+{
+  static std::string name = llvm::sys::getHostCPUName();
+  if (name.empty() || name == "generic")
+    return NULL;
+  return name.c_str();
+}
+/* vim: set ts=4 expandtab: */
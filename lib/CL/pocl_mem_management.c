@@ -23,19 +23,273 @@
 
 #include "pocl_mem_management.h"
 #include "pocl.h"
+#include "pocl_util.h"
 #include "utlist.h"
 
+/* The events and the command nodes are allocated from pools of
+   objects allocated in cache line aligned slabs and never freed.
+
+   Each thread caches two magazines (fixed size stacks) of free objects
+   per pool, and gets or returns whole magazines from/to the global
+   stacks of full and empty magazines only when both its magazines are
+   empty or full. The global stacks are lock-free: their heads hold the
+   index of the top magazine with a tag incremented at each update, so
+   a pop racing with another thread popping and pushing back the same
+   magazine fails its compare-and-swap instead of corrupting the stack
+   (the ABA problem). The lock is taken only to allocate new magazines
+   and slabs. */
+
+#define CACHE_LINE_SIZE 64
+#define MAGAZINE_SIZE 32
+#define MAGAZINE_CHUNK_SIZE 256
+#define MAX_MAGAZINE_CHUNKS 4096
+
+enum
+{
+  EVENT_POOL,
+  COMMAND_POOL,
+  NUM_POOLS
+};
+
+typedef struct magazine
+{
+  /* The index of the magazine and of the next one in a global stack
+     plus one, 0 at the bottom of the stack. */
+  uint32_t index;
+  uint32_t next;
+  unsigned count;
+  void *objects[MAGAZINE_SIZE];
+} magazine;
+
+/* The index of the top magazine plus one in the low 32 bits, the tag
+   in the high ones. */
+typedef volatile uint64_t magazine_stack;
+
 typedef struct _mem_manager
 {
-  pocl_lock_t event_lock;
-  pocl_lock_t cmd_lock;
-  cl_event event_list;
-  _cl_command_node *volatile cmd_list;
+  /* The magazines with objects per pool and the empty ones. */
+  magazine_stack full_magazines[NUM_POOLS];
+  magazine_stack empty_magazines;
+  size_t object_size[NUM_POOLS];
+  pocl_lock_t slab_lock;
+  magazine *magazine_chunks[MAX_MAGAZINE_CHUNKS];
+  uint32_t num_magazines;
+  /* Returns the magazines of the exiting threads. */
+  pthread_key_t cache_key;
 } pocl_mem_manager;
 
+typedef struct thread_cache
+{
+  magazine *loaded[NUM_POOLS];
+  magazine *previous[NUM_POOLS];
+  int registered;
+} thread_cache;
 
 static pocl_mem_manager *mm = NULL;
 
+static __thread thread_cache object_cache;
+
+static magazine *
+magazine_at (uint32_t index)
+{
+  return &mm->magazine_chunks[index / MAGAZINE_CHUNK_SIZE]
+    [index % MAGAZINE_CHUNK_SIZE];
+}
+
+static void
+push_magazine (magazine_stack *stack, magazine *mag)
+{
+  uint64_t head, new_head;
+  do
+    {
+      head = *stack;
+      mag->next = (uint32_t)head;
+      new_head = ((head >> 32) + 1) << 32 | (mag->index + 1);
+    }
+  while (!__sync_bool_compare_and_swap (stack, head, new_head));
+}
+
+static magazine *
+pop_magazine (magazine_stack *stack)
+{
+  uint64_t head, new_head;
+  magazine *mag;
+  do
+    {
+      head = *stack;
+      if ((uint32_t)head == 0)
+        return NULL;
+      /* The magazines are never freed, thus reading the next index of
+         one just popped by another thread is safe, and the tag makes
+         the exchange fail in that case. */
+      mag = magazine_at ((uint32_t)head - 1);
+      new_head = ((head >> 32) + 1) << 32 | mag->next;
+    }
+  while (!__sync_bool_compare_and_swap (stack, head, new_head));
+  return mag;
+}
+
+static magazine *
+get_empty_magazine (void)
+{
+  magazine *mag = pop_magazine (&mm->empty_magazines);
+  uint32_t index;
+
+  if (mag != NULL)
+    return mag;
+
+  POCL_LOCK (mm->slab_lock);
+  index = mm->num_magazines;
+  if (index / MAGAZINE_CHUNK_SIZE >= MAX_MAGAZINE_CHUNKS)
+    goto ERROR;
+  if (index % MAGAZINE_CHUNK_SIZE == 0)
+    {
+      mm->magazine_chunks[index / MAGAZINE_CHUNK_SIZE] = (magazine*)
+        calloc (MAGAZINE_CHUNK_SIZE, sizeof (magazine));
+      if (mm->magazine_chunks[index / MAGAZINE_CHUNK_SIZE] == NULL)
+        goto ERROR;
+    }
+  mag = magazine_at (index);
+  mag->index = index;
+  ++mm->num_magazines;
+  POCL_UNLOCK (mm->slab_lock);
+  return mag;
+
+ERROR:
+  POCL_UNLOCK (mm->slab_lock);
+  return NULL;
+}
+
+/* Fills an empty magazine with the objects of a new slab. */
+static int
+fill_from_slab (int pool, magazine *mag)
+{
+  size_t size = mm->object_size[pool];
+  char *slab = (char*) pocl_aligned_malloc (CACHE_LINE_SIZE,
+                                            size * MAGAZINE_SIZE);
+  unsigned i;
+
+  if (slab == NULL)
+    return 0;
+  memset (slab, 0, size * MAGAZINE_SIZE);
+  for (i = 0; i < MAGAZINE_SIZE; ++i)
+    mag->objects[i] = slab + size * i;
+  mag->count = MAGAZINE_SIZE;
+  return 1;
+}
+
+static void
+return_magazine (int pool, magazine *mag)
+{
+  if (mag == NULL)
+    return;
+  if (mag->count > 0)
+    push_magazine (&mm->full_magazines[pool], mag);
+  else
+    push_magazine (&mm->empty_magazines, mag);
+}
+
+static void
+flush_thread_cache (void *p)
+{
+  thread_cache *cache = (thread_cache*)p;
+  int pool;
+
+  for (pool = 0; pool < NUM_POOLS; ++pool)
+    {
+      return_magazine (pool, cache->loaded[pool]);
+      return_magazine (pool, cache->previous[pool]);
+      cache->loaded[pool] = cache->previous[pool] = NULL;
+    }
+  cache->registered = 0;
+}
+
+static thread_cache *
+get_thread_cache (void)
+{
+  thread_cache *cache = &object_cache;
+  if (!cache->registered)
+    {
+      pthread_setspecific (mm->cache_key, cache);
+      cache->registered = 1;
+    }
+  return cache;
+}
+
+static void *
+pool_alloc (int pool)
+{
+  thread_cache *cache = get_thread_cache ();
+  magazine *mag = cache->loaded[pool];
+  magazine *prev = cache->previous[pool];
+  magazine *full;
+
+  if (mag == NULL || mag->count == 0)
+    {
+      if (prev != NULL && prev->count > 0)
+        {
+          cache->previous[pool] = mag;
+          mag = prev;
+        }
+      else if ((full = pop_magazine (&mm->full_magazines[pool])) != NULL)
+        {
+          if (prev != NULL)
+            push_magazine (&mm->empty_magazines, prev);
+          cache->previous[pool] = mag;
+          mag = full;
+        }
+      else
+        {
+          if (mag == NULL)
+            mag = get_empty_magazine ();
+          if (mag == NULL)
+            return NULL;
+          cache->loaded[pool] = mag;
+          if (!fill_from_slab (pool, mag))
+            return NULL;
+        }
+      cache->loaded[pool] = mag;
+    }
+  return mag->objects[--mag->count];
+}
+
+static void
+pool_free (int pool, void *object)
+{
+  thread_cache *cache = get_thread_cache ();
+  magazine *mag = cache->loaded[pool];
+  magazine *prev = cache->previous[pool];
+
+  if (mag == NULL || mag->count == MAGAZINE_SIZE)
+    {
+      if (prev != NULL && prev->count < MAGAZINE_SIZE)
+        {
+          cache->previous[pool] = mag;
+          mag = prev;
+        }
+      else
+        {
+          magazine *empty = get_empty_magazine ();
+          /* The object is leaked in the unlikely case of running out
+             of magazines. */
+          if (empty == NULL)
+            return;
+          if (prev != NULL)
+            push_magazine (&mm->full_magazines[pool], prev);
+          cache->previous[pool] = mag;
+          mag = empty;
+        }
+      cache->loaded[pool] = mag;
+    }
+  mag->objects[mag->count++] = object;
+}
+
+static size_t
+cache_line_multiple (size_t size)
+{
+  return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
 void pocl_init_mem_manager (void)
 {
   static unsigned int init_done = 0;
@@ -50,56 +304,36 @@ void pocl_init_mem_manager (void)
   if (!mm)
     {
       mm = (pocl_mem_manager*) calloc (1, sizeof (pocl_mem_manager));
-      POCL_INIT_LOCK (mm->event_lock);
-      POCL_INIT_LOCK (mm->cmd_lock);
+      POCL_INIT_LOCK (mm->slab_lock);
+      mm->object_size[EVENT_POOL] =
+        cache_line_multiple (sizeof (struct _cl_event));
+      mm->object_size[COMMAND_POOL] =
+        cache_line_multiple (sizeof (_cl_command_node));
+      pthread_key_create (&mm->cache_key, flush_thread_cache);
     }
   POCL_UNLOCK(pocl_init_lock);
 }
 
 cl_event pocl_mem_manager_new_event ()
 {
-  cl_event ev = NULL;
-  POCL_LOCK (mm->event_lock);
-  if (ev = mm->event_list)
-    {
-      LL_DELETE (mm->event_list, ev);
-      POCL_UNLOCK (mm->event_lock);
-      POCL_INIT_LOCK (ev->pocl_lock);
-      ev->pocl_refcount = 1; /* no need to lock because event is not in use */
-      return ev;
-    }
-  POCL_UNLOCK (mm->event_lock);
-    
-  ev = (struct _cl_event*) calloc (1, sizeof (struct _cl_event));
+  cl_event ev = (cl_event) pool_alloc (EVENT_POOL);
+  if (ev == NULL)
+    return NULL;
   POCL_INIT_OBJECT(ev);
-  ev->pocl_refcount = 1;
   return ev;
 }
 
 void pocl_mem_manager_free_event (cl_event event)
 {
-  POCL_LOCK (mm->event_lock);
-  LL_PREPEND (mm->event_list, event);
-  POCL_UNLOCK(mm->event_lock);
+  pool_free (EVENT_POOL, event);
 }
 
 _cl_command_node* pocl_mem_manager_new_command ()
 {
-  _cl_command_node *cmd = NULL;
-  POCL_LOCK (mm->cmd_lock);
-  if (cmd = mm->cmd_list)
-    LL_DELETE (mm->cmd_list, cmd);
-  POCL_UNLOCK (mm->cmd_lock);
-  
-  if (cmd)
-    return cmd;
-  
-  return (_cl_command_node*) calloc (1, sizeof (_cl_command_node));
+  return (_cl_command_node*) pool_alloc (COMMAND_POOL);
 }
 
 void pocl_mem_manager_free_command ( _cl_command_node *cmd_ptr)
 {
-  POCL_LOCK (mm->cmd_lock);
-  LL_PREPEND (mm->cmd_list, cmd_ptr);
-  POCL_UNLOCK(mm->cmd_lock);
+  pool_free (COMMAND_POOL, cmd_ptr);
 }
@@ -25,6 +25,7 @@
 #include "utlist.h"
 #include "pocl_cl.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -98,3 +99,199 @@ const char* pocl_get_string_option(const char *key, const char *default_value)
   env_data *ed;
   return (ed = find_env (env_cache, key)) ? ed->value : default_value;
 }
+
+/* The tuning profiles of the kernels, read from the file given with
+   POCL_KERNEL_PROFILES. Each line of the file is of the form
+
+   <program hash> <kernel name> KEY=VALUE [KEY=VALUE ...]
+
+   where the program hash is the name (or a prefix of it) of the program
+   dir in the kernel cache and either of them can be '*' to match any.
+   The options of the first matching line setting an option override
+   the global value of the option for the kernel. */
+
+typedef struct kernel_profile kernel_profile;
+struct kernel_profile
+{
+  char *program_hash;
+  char *kernel_name;
+  env_data *options;
+  kernel_profile *next;
+};
+
+static kernel_profile *kernel_profiles = NULL;
+static int kernel_profiles_loaded = 0;
+static pocl_lock_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define PROFILE_SEPARATORS " \t\r\n"
+
+static void
+load_kernel_profiles (const char *file_name)
+{
+  char line[1024];
+  char *save, *hash, *name, *option, *eq;
+  kernel_profile *profile;
+  env_data *ed;
+  FILE *fp = fopen (file_name, "r");
+
+  if (fp == NULL)
+    {
+      POCL_MSG_PRINT_INFO ("Could not open the kernel profiles %s\n",
+                           file_name);
+      return;
+    }
+
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      hash = strtok_r (line, PROFILE_SEPARATORS, &save);
+      if (hash == NULL || hash[0] == '#')
+        continue;
+      name = strtok_r (NULL, PROFILE_SEPARATORS, &save);
+      if (name == NULL)
+        continue;
+
+      profile = (kernel_profile*) calloc (1, sizeof (kernel_profile));
+      if (profile == NULL)
+        break;
+      if (strcmp (hash, "*") != 0)
+        profile->program_hash = strdup (hash);
+      if (strcmp (name, "*") != 0)
+        profile->kernel_name = strdup (name);
+
+      while ((option = strtok_r (NULL, PROFILE_SEPARATORS, &save)) != NULL)
+        {
+          eq = strchr (option, '=');
+          if (eq == NULL)
+            continue;
+          *eq = '\0';
+          ed = (env_data*) malloc (sizeof (env_data));
+          if (ed == NULL)
+            break;
+          ed->env = strdup (option);
+          ed->value = strdup (eq + 1);
+          ed->next = NULL;
+          LL_APPEND (profile->options, ed);
+        }
+      LL_APPEND (kernel_profiles, profile);
+    }
+  fclose (fp);
+}
+
+static kernel_profile*
+get_kernel_profiles ()
+{
+  const char *file_name;
+
+  POCL_LOCK (profile_lock);
+  if (!kernel_profiles_loaded)
+    {
+      file_name = pocl_get_string_option ("POCL_KERNEL_PROFILES", NULL);
+      if (file_name != NULL)
+        load_kernel_profiles (file_name);
+      kernel_profiles_loaded = 1;
+    }
+  POCL_UNLOCK (profile_lock);
+  return kernel_profiles;
+}
+
+static int
+profile_matches (const kernel_profile *profile, struct _cl_kernel *kernel,
+                 const char *hash)
+{
+  if (profile->program_hash != NULL &&
+      strncmp (hash, profile->program_hash,
+               strlen (profile->program_hash)) != 0)
+    return 0;
+  return profile->kernel_name == NULL ||
+    strcmp (profile->kernel_name, kernel->name) == 0;
+}
+
+static void
+program_hash_string (struct _cl_kernel *kernel, char *hash)
+{
+  int i;
+  for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+    sprintf (&hash[i*2], "%02x",
+             (unsigned int) kernel->program->build_hash[i]);
+}
+
+static env_data*
+find_kernel_option (struct _cl_kernel *kernel, const char *key)
+{
+  char hash[SHA1_DIGEST_SIZE * 2 + 1];
+  kernel_profile *profiles = get_kernel_profiles ();
+  kernel_profile *profile;
+  env_data *ed;
+
+  if (profiles != NULL && kernel != NULL)
+    {
+      program_hash_string (kernel, hash);
+      LL_FOREACH (profiles, profile)
+        {
+          if (!profile_matches (profile, kernel, hash))
+            continue;
+          LL_FOREACH (profile->options, ed)
+            {
+              if (strcmp (ed->env, key) == 0)
+                return ed;
+            }
+        }
+    }
+  return find_env (env_cache, key);
+}
+
+int pocl_is_kernel_option_set(struct _cl_kernel *kernel, const char *key)
+{
+  return find_kernel_option (kernel, key) != NULL;
+}
+
+int pocl_get_kernel_int_option(struct _cl_kernel *kernel, const char *key,
+                               int default_value)
+{
+  env_data *ed;
+  return (ed = find_kernel_option (kernel, key)) ?
+    atoi(ed->value) : default_value;
+}
+
+int pocl_get_kernel_bool_option(struct _cl_kernel *kernel, const char *key,
+                                int default_value)
+{
+  env_data *ed;
+  if (ed = find_kernel_option (kernel, key))
+    return (strncmp(ed->value, "1", 1) == 0);
+  return default_value;
+}
+
+const char* pocl_get_kernel_string_option(struct _cl_kernel *kernel,
+                                          const char *key,
+                                          const char *default_value)
+{
+  env_data *ed;
+  return (ed = find_kernel_option (kernel, key)) ? ed->value : default_value;
+}
+
+/* Calls the callback for each option override in the profiles of the
+   kernel, in the order of the profile file. */
+void pocl_foreach_kernel_option(struct _cl_kernel *kernel,
+                                void (*callback)(const char *key,
+                                                 const char *value,
+                                                 void *data),
+                                void *data)
+{
+  char hash[SHA1_DIGEST_SIZE * 2 + 1];
+  kernel_profile *profiles = get_kernel_profiles ();
+  kernel_profile *profile;
+  env_data *ed;
+
+  if (profiles == NULL)
+    return;
+
+  program_hash_string (kernel, hash);
+  LL_FOREACH (profiles, profile)
+    {
+      if (!profile_matches (profile, kernel, hash))
+        continue;
+      LL_FOREACH (profile->options, ed)
+        callback (ed->env, ed->value, data);
+    }
+}
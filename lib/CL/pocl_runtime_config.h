@@ -33,6 +33,23 @@ int pocl_get_int_option(const char *key, int default_value);
 int pocl_get_bool_option(const char *key, int default_value);
 const char* pocl_get_string_option(const char *key, const char *default_value);
 
+/* The options of a kernel: the overrides of its tuning profile
+   (POCL_KERNEL_PROFILES), the global options otherwise. */
+struct _cl_kernel;
+int pocl_is_kernel_option_set(struct _cl_kernel *kernel, const char *key);
+int pocl_get_kernel_int_option(struct _cl_kernel *kernel, const char *key,
+                               int default_value);
+int pocl_get_kernel_bool_option(struct _cl_kernel *kernel, const char *key,
+                                int default_value);
+const char* pocl_get_kernel_string_option(struct _cl_kernel *kernel,
+                                          const char *key,
+                                          const char *default_value);
+void pocl_foreach_kernel_option(struct _cl_kernel *kernel,
+                                void (*callback)(const char *key,
+                                                 const char *value,
+                                                 void *data),
+                                void *data);
+
 
 #ifdef __cplusplus
 }
@@ -32,6 +32,8 @@
 
 #ifndef _MSC_VER
 #  include <dirent.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
 #  include <unistd.h>
 #  include <utime.h>
 #else
@@ -294,7 +296,7 @@ cl_int pocl_create_event (cl_event *event, cl_command_queue command_queue,
   if (event != NULL)
     {
       *event = pocl_mem_manager_new_event ();
-      if (event == NULL)
+      if (*event == NULL)
         return CL_OUT_OF_HOST_MEMORY;
       
       (*event)->queue = command_queue;
@@ -336,7 +338,8 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   err = pocl_create_event(event, command_queue, command_type);
   if (err != CL_SUCCESS)
     {
-      POCL_MEM_FREE(*cmd);
+      pocl_mem_manager_free_command (*cmd);
+      *cmd = NULL;
       return err;
     }
   if (event_p)
@@ -494,6 +497,75 @@ void pocl_touch_file(const char* file_name)
 }
 
 
+/**
+ * Maps a range of a file to the host memory.
+ *
+ * The mapping is private and copy-on-write: the pages are shared with
+ * the page cache until they are written to, the writes never reach the
+ * file and the file itself needs to be readable only. It is writable
+ * regardless of the access flags of the buffer, as e.g. copies and
+ * fills into read-only buffers are legal.
+ * The mapping starts at the page containing the offset.
+ *
+ * @param size The size of the range. Replaced with the size up to the
+ * end of the file in case it is 0.
+ * @param map Set to the start of the mapping to pass to pocl_unmap_file.
+ * @return The address of the range, NULL on failure.
+ */
+void *
+pocl_map_file (const char *file_name, size_t offset, size_t *size,
+               cl_uint advice, void **map, size_t *map_size)
+{
+#ifndef _MSC_VER
+  struct stat file_stat;
+  size_t page_size = (size_t)sysconf (_SC_PAGESIZE);
+  size_t map_offset = offset & ~(page_size - 1);
+  void *ptr;
+  int fd;
+
+  fd = open (file_name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &file_stat) != 0 || offset >= (size_t)file_stat.st_size)
+    goto ERROR;
+
+  if (*size == 0)
+    *size = (size_t)file_stat.st_size - offset;
+  if (*size > (size_t)file_stat.st_size - offset)
+    goto ERROR;
+
+  *map_size = *size + (offset - map_offset);
+  ptr = mmap (NULL, *map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+              (off_t)map_offset);
+  if (ptr == MAP_FAILED)
+    goto ERROR;
+  close (fd);
+
+  if (advice == CL_MEM_FILE_ADVICE_SEQUENTIAL_POCL)
+    madvise (ptr, *map_size, MADV_SEQUENTIAL);
+  else if (advice == CL_MEM_FILE_ADVICE_RANDOM_POCL)
+    madvise (ptr, *map_size, MADV_RANDOM);
+  else if (advice == CL_MEM_FILE_ADVICE_WILLNEED_POCL)
+    madvise (ptr, *map_size, MADV_WILLNEED);
+
+  *map = ptr;
+  return (char *)ptr + (offset - map_offset);
+
+ERROR:
+  close (fd);
+#endif
+  return NULL;
+}
+
+void
+pocl_unmap_file (void *map, size_t map_size)
+{
+#ifndef _MSC_VER
+  munmap (map, map_size);
+#endif
+}
+
+
 int pocl_buffer_boundcheck(cl_mem buffer, size_t offset, size_t size) {
   POCL_RETURN_ERROR_ON((offset > buffer->size), CL_INVALID_VALUE,
             "offset(%zu) > buffer->size(%zu)", offset, buffer->size)
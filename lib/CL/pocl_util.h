@@ -73,6 +73,10 @@ void pocl_aligned_free(void* ptr);
 cl_int pocl_create_event (cl_event *event, cl_command_queue command_queue,
                           cl_command_type command_type);
 
+cl_mem pocl_create_buffer (cl_context context, cl_mem_flags flags,
+                           size_t size, void *host_ptr, void *file_map,
+                           size_t file_map_size, cl_int *errcode_ret);
+
 cl_int pocl_create_command (_cl_command_node **cmd,
                             cl_command_queue command_queue,
                             cl_command_type command_type, cl_event *event,
@@ -96,6 +100,11 @@ void pocl_check_and_invalidate_cache (cl_program program, int device_i, const ch
 /* Touch file to change last modified time */
 void pocl_touch_file(const char* file_name);
 
+/* Maps a file range for a file-backed buffer, NULL on failure */
+void *pocl_map_file (const char *file_name, size_t offset, size_t *size,
+                     cl_uint advice, void **map, size_t *map_size);
+void pocl_unmap_file (void *map, size_t map_size);
+
 /* does several sanity checks on buffer & given memory region */
 int pocl_buffer_boundcheck(cl_mem buffer, size_t offset, size_t size);
 /* same as above just 2 buffers */
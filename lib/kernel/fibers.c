@@ -0,0 +1,263 @@
+/* OpenCL built-in library: the work-item fiber scheduler
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* The runtime of the 'fibers' work-group method (see
+   lib/llvmopencl/WorkitemFibers.cc). Each work-item of the work-group
+   runs in its own fiber with a small stack. A barrier saves the state
+   of the fiber and continues the next one, the last fiber to arrive
+   at the barrier continues the first one.
+
+   The fibers are started with the ucontext API, but switched at the
+   barriers with _setjmp/_longjmp which do not save the signal mask and
+   thus avoid a system call per switch.
+
+   The stacks are mapped with an inaccessible guard page below each, so
+   a fiber overflowing its stack faults instead of corrupting the stack
+   of the next one. On top of the size bounded by the kernel compiler,
+   each stack reserves the register save area the dynamic linker and
+   the signal delivery push, which depends on the CPU. The stacks and
+   the fiber states are kept per thread for the next work-groups, and
+   unmapped when the thread exits.
+
+   The scheduler uses the host C library and is linked to the kernel
+   only after the kernel compiler passes have been run, thus its
+   globals are not seen by the passes. */
+
+/* The C library headers cannot be used with the OpenCL C type
+   overrides of the targets without the 64-bit types. */
+#if defined cl_khr_int64 && defined cl_khr_fp64 && !defined __ANDROID__
+
+/* The fortified longjmp aborts when jumping to a stack below the
+   current one, which is the case with every other fiber switch. */
+#undef _FORTIFY_SOURCE
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+typedef void (*pocl_fiber_body) (void *data, void *sched,
+                                 size_t local_x, size_t local_y,
+                                 size_t local_z);
+
+typedef struct
+{
+  pocl_fiber_body body;
+  void *data;
+  size_t local_x, local_y;
+  /* The number of work-items in the work-group. */
+  size_t count;
+  /* The usable size of a stack and the size of the guard page below. */
+  size_t stack_size;
+  size_t guard_size;
+  char *stacks;
+  /* The state of each fiber waiting at a barrier. */
+  jmp_buf *fibers;
+  /* The running fiber and the number of fibers started so far. */
+  size_t current;
+  size_t started;
+  /* The state of the scheduler while the fibers run. */
+  jmp_buf main;
+  /* The context used for starting the fibers. */
+  ucontext_t start;
+} pocl_fiber_sched;
+
+/* The stacks and the fiber states of a thread, reused for the
+   work-groups which fit them. */
+typedef struct
+{
+  char *stacks;
+  size_t map_size;
+  size_t count;
+  size_t stack_size;
+  jmp_buf *fibers;
+} pocl_fiber_stacks;
+
+static __thread pocl_fiber_stacks thread_stacks;
+static pthread_key_t stacks_key;
+static pthread_once_t stacks_once = PTHREAD_ONCE_INIT;
+
+static void fiber_entry (unsigned int sched_hi, unsigned int sched_lo);
+
+/* Continues the fiber 'next', starting it in case it has not run yet.
+   The fibers are started in order, thus the next unstarted fiber is
+   always 'started'. */
+static void
+fiber_resume (pocl_fiber_sched *sched, size_t next)
+{
+  unsigned long long s;
+
+  sched->current = next;
+  if (next < sched->started)
+    _longjmp (sched->fibers[next], 1);
+
+  sched->started = next + 1;
+  sched->start.uc_stack.ss_sp = sched->stacks + sched->guard_size +
+    next * (sched->guard_size + sched->stack_size);
+  sched->start.uc_stack.ss_size = sched->stack_size;
+  sched->start.uc_link = NULL;
+  /* makecontext() passes only int arguments portably. */
+  s = (unsigned long long)(uintptr_t)sched;
+  makecontext (&sched->start, (void (*)(void))fiber_entry, 2,
+               (unsigned int)(s >> 32), (unsigned int)s);
+  setcontext (&sched->start);
+}
+
+static void
+fiber_entry (unsigned int sched_hi, unsigned int sched_lo)
+{
+  pocl_fiber_sched *sched = (pocl_fiber_sched *)(uintptr_t)
+    (((unsigned long long)sched_hi << 32) | sched_lo);
+  size_t i = sched->current;
+
+  sched->body (sched->data, sched,
+               i % sched->local_x,
+               i / sched->local_x % sched->local_y,
+               i / (sched->local_x * sched->local_y));
+
+  /* The work-item has finished. Continue the remaining part of the next
+     one, or return to the scheduler after the last one. */
+  if (i + 1 < sched->count)
+    fiber_resume (sched, i + 1);
+  _longjmp (sched->main, 1);
+}
+
+void
+pocl_fiber_barrier (void *s)
+{
+  pocl_fiber_sched *sched = (pocl_fiber_sched *)s;
+  size_t i = sched->current;
+
+  if (_setjmp (sched->fibers[i]) == 0)
+    fiber_resume (sched, i + 1 < sched->count ? i + 1 : 0);
+}
+
+/* Returns the stack needed for saving the registers on the fiber stack,
+   as measured by the kernel for the signal frames. Falls back to the
+   default signal stack size with the C libraries not reporting it. */
+static size_t
+register_save_reserve (void)
+{
+  long size = -1;
+#ifdef _SC_MINSIGSTKSZ
+  size = sysconf (_SC_MINSIGSTKSZ);
+#endif
+  return size > 0 ? (size_t)size : (size_t)SIGSTKSZ;
+}
+
+static void
+free_fiber_stacks (void *p)
+{
+  pocl_fiber_stacks *s = (pocl_fiber_stacks *)p;
+  munmap (s->stacks, s->map_size);
+  free (s->fibers);
+  memset (s, 0, sizeof (pocl_fiber_stacks));
+}
+
+static void
+create_stacks_key (void)
+{
+  pthread_key_create (&stacks_key, free_fiber_stacks);
+}
+
+/* Returns the stacks of the thread, mapping them anew in case the
+   previous ones are too few or too small. The stacks grow to fit both
+   the previous and the new work-groups. */
+static pocl_fiber_stacks *
+thread_fiber_stacks (size_t count, size_t stack_size, size_t guard_size)
+{
+  pocl_fiber_stacks *s = &thread_stacks;
+  void *stacks;
+  size_t i;
+
+  if (s->stacks != NULL && count <= s->count && stack_size <= s->stack_size)
+    return s;
+
+  if (count < s->count)
+    count = s->count;
+  if (stack_size < s->stack_size)
+    stack_size = s->stack_size;
+  if (s->stacks != NULL)
+    free_fiber_stacks (s);
+  else
+    {
+      pthread_once (&stacks_once, create_stacks_key);
+      pthread_setspecific (stacks_key, s);
+    }
+
+  /* The pages of a stack are allocated when the fiber first touches
+     them, thus the stack size can be a generous bound. */
+  s->map_size = count * (guard_size + stack_size);
+  stacks = mmap (NULL, s->map_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  s->fibers = (jmp_buf *)malloc (count * sizeof (jmp_buf));
+  if (stacks == MAP_FAILED || s->fibers == NULL)
+    abort ();
+  s->stacks = (char *)stacks;
+  for (i = 0; i < count; ++i)
+    if (mprotect (s->stacks + i * (guard_size + stack_size),
+                  guard_size, PROT_NONE) != 0)
+      abort ();
+  s->count = count;
+  s->stack_size = stack_size;
+  return s;
+}
+
+void
+pocl_fibers_run (pocl_fiber_body body, void *data,
+                 size_t local_x, size_t local_y, size_t local_z,
+                 size_t stack_size)
+{
+  pocl_fiber_sched sched;
+  pocl_fiber_stacks *stacks;
+
+  sched.body = body;
+  sched.data = data;
+  sched.local_x = local_x;
+  sched.local_y = local_y;
+  sched.count = local_x * local_y * local_z;
+  sched.guard_size = (size_t)sysconf (_SC_PAGESIZE);
+  stack_size += register_save_reserve ();
+  stack_size = (stack_size + sched.guard_size - 1) & ~(sched.guard_size - 1);
+  stacks = thread_fiber_stacks (sched.count, stack_size, sched.guard_size);
+  sched.stack_size = stacks->stack_size;
+  sched.stacks = stacks->stacks;
+  sched.fibers = stacks->fibers;
+  sched.current = 0;
+  sched.started = 0;
+  getcontext (&sched.start);
+
+  if (_setjmp (sched.main) == 0)
+    fiber_resume (&sched, 0);
+}
+
+#endif
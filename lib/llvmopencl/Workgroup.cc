@@ -75,10 +75,11 @@ using namespace std;
 using namespace llvm;
 using namespace pocl;
 
-static Function *createLauncher(Module &M, Function *F);
+static Function *createLauncher(Module &M, Function *F, unsigned workDim);
 static void privatizeContext(Module &M, Function *F);
 static void createWorkgroup(Module &M, Function *F);
 static void createWorkgroupFast(Module &M, Function *F);
+static void createWorkgroupRange(Module &M, Function *F);
 
 // extern cl::opt<string> Header;
 // extern cl::list<int> LocalSize;
@@ -90,6 +91,15 @@ KernelName("kernel",
        cl::value_desc("kernel"),
        cl::init(""));
 
+/* The work_dim of the launch the kernel is compiled for. When set, a
+   launcher specialized for it and a zero global offset is generated in
+   addition to the generic one. */
+cl::opt<unsigned>
+WorkDim("work-dim",
+        cl::desc("Work dimensions of the specialized launcher"),
+        cl::value_desc("dim"),
+        cl::init(0));
+
 namespace llvm {
 
   typedef struct _pocl_context PoclContext;
@@ -194,7 +204,8 @@ Workgroup::runOnModule(Module &M)
 
   for (Module::iterator i = M.begin(), e = M.end(); i != e; ++i) {
     if (!isKernelToProcess(*i)) continue;
-    Function *L = createLauncher(M, i);
+    bool barrierFree = !hasWorkgroupBarriers(*i);
+    Function *L = createLauncher(M, i, 0);
       
 #if defined LLVM_3_2
     L->addFnAttr(Attributes::NoInline);
@@ -206,6 +217,26 @@ Workgroup::runOnModule(Module &M)
 
     createWorkgroup(M, L);
     createWorkgroupFast(M, L);
+    if (barrierFree)
+      createWorkgroupRange(M, L);
+
+    /* Most launches have no global offset and the same dimensions, thus
+       generate a variant where the offset and the unused dimensions are
+       constants get_global_id() etc. fold with. The device picks it in
+       case the launch matches. */
+    if (WorkDim >= 1 && WorkDim <= 3)
+      {
+        Function *S = createLauncher(M, i, WorkDim);
+#if defined LLVM_3_2
+        S->addFnAttr(Attributes::NoInline);
+#else
+        S->addFnAttr(Attribute::NoInline);
+#endif
+        privatizeContext(M, S);
+        createWorkgroup(M, S);
+        if (barrierFree)
+          createWorkgroupRange(M, S);
+      }
   }
 
   Function *barrier = cast<Function> 
@@ -218,8 +249,18 @@ Workgroup::runOnModule(Module &M)
   return true;
 }
 
+/**
+ * Creates the launcher of the kernel which sets the work-group context
+ * globals from the context struct and inlines the kernel.
+ *
+ * In case workDim is not zero, the launcher is specialized for a launch
+ * with a zero global offset and workDim dimensions: the offset, the work
+ * dimensions and the group id and count of the unused dimensions are
+ * stored as constants, and the launcher is named
+ * _<kernel>_offset0_dim<workDim>.
+ */
 static Function *
-createLauncher(Module &M, Function *F)
+createLauncher(Module &M, Function *F, unsigned workDim)
 {
   SmallVector<Type *, 8> sv;
 
@@ -235,6 +276,13 @@ createLauncher(Module &M, Function *F)
   std::string funcName = "";
   funcName = F->getName().str();
 
+  if (workDim != 0)
+    {
+      char suffix[STRING_LENGTH];
+      snprintf(suffix, STRING_LENGTH, "_offset0_dim%u", workDim);
+      funcName += suffix;
+    }
+
   Function *L = Function::Create(ft,
 				 Function::ExternalLinkage,
 				 "_" + funcName,
@@ -261,7 +309,10 @@ createLauncher(Module &M, Function *F)
 				TypeBuilder<PoclContext, true>::WORK_DIM);
   gv = M.getGlobalVariable("_work_dim");
   if (gv != NULL) {
-    v = builder.CreateLoad(builder.CreateConstGEP1_32(ptr, 0));
+    if (workDim != 0)
+      v = ConstantInt::get(gv->getType()->getElementType(), workDim);
+    else
+      v = builder.CreateLoad(builder.CreateConstGEP1_32(ptr, 0));
     builder.CreateStore(v, gv);
   }
 
@@ -280,7 +331,10 @@ createLauncher(Module &M, Function *F)
   for (int i = 0; i < 3; ++i) {
     snprintf(s, STRING_LENGTH, "_group_id_%c", 'x' + i);
     gv = M.getGlobalVariable(s);
-    if (gv != NULL) {
+    if (gv != NULL && workDim != 0 && i >= (int)workDim) {
+      builder.CreateStore
+        (ConstantInt::get(gv->getType()->getElementType(), 0), gv);
+    } else if (gv != NULL) {
       if (size_t_width == 64)
         {
           v = builder.CreateLoad(builder.CreateConstGEP2_64(ptr, 0, i));
@@ -298,7 +352,10 @@ createLauncher(Module &M, Function *F)
   for (int i = 0; i < 3; ++i) {
     snprintf(s, STRING_LENGTH, "_num_groups_%c", 'x' + i);
     gv = M.getGlobalVariable(s);
-    if (gv != NULL) {
+    if (gv != NULL && workDim != 0 && i >= (int)workDim) {
+      builder.CreateStore
+        (ConstantInt::get(gv->getType()->getElementType(), 1), gv);
+    } else if (gv != NULL) {
       if (size_t_width == 64)
         {
           v = builder.CreateLoad(builder.CreateConstGEP2_64(ptr, 0, i));
@@ -316,7 +373,10 @@ createLauncher(Module &M, Function *F)
   for (int i = 0; i < 3; ++i) {
     snprintf(s, STRING_LENGTH, "_global_offset_%c", 'x' + i);
     gv = M.getGlobalVariable(s);
-    if (gv != NULL) {
+    if (gv != NULL && workDim != 0) {
+      builder.CreateStore
+        (ConstantInt::get(gv->getType()->getElementType(), 0), gv);
+    } else if (gv != NULL) {
       if (size_t_width == 64)
         {
           v = builder.CreateLoad(builder.CreateConstGEP2_64(ptr, 0, i));
@@ -612,6 +672,95 @@ createWorkgroupFast(Module &M, Function *F)
   builder.CreateRetVoid();
 }
 
+/**
+ * Creates a launcher executing a range of work-groups in the x
+ * dimension (called KERNELNAME_workgroup_range) for kernels without
+ * work-group barriers.
+ *
+ * The range starts from the group id in the context and the y and z
+ * group ids are those of the context. The work-group function is
+ * inlined into the loop over the group ids, thus there is no call,
+ * argument unpacking or context setup per work-group, and the global
+ * ids of the work-item loop nest run unit stride through the whole
+ * range for the vectorizers and the hardware prefetchers.
+ */
+static void
+createWorkgroupRange(Module &M, Function *F)
+{
+  LLVMContext &C = M.getContext();
+
+  int size_t_width = 32;
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  if (M.getPointerSize() == llvm::Module::Pointer64)
+#else
+  if (M.getDataLayout()->getPointerSize(0) == 8)
+#endif
+    size_t_width = 64;
+  IntegerType *SizeT = IntegerType::get(C, size_t_width);
+
+  std::string funcName = F->getName().str();
+  Function *workgroup = M.getFunction(funcName + "_workgroup");
+  assert(workgroup != NULL);
+
+  SmallVector<Type *, 3> sv;
+  sv.push_back(workgroup->getFunctionType()->getParamType(0));
+  sv.push_back(workgroup->getFunctionType()->getParamType(1));
+  sv.push_back(SizeT);
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(C),
+                                       ArrayRef<Type *> (sv), false);
+  Function *range =
+    dyn_cast<Function>(M.getOrInsertFunction(funcName + "_workgroup_range",
+                                             ft));
+  assert(range != NULL);
+
+  Function::arg_iterator ai = range->arg_begin();
+  Value *args = ai++;
+  Value *pc = ai++;
+  Value *count = ai;
+
+  BasicBlock *entry = BasicBlock::Create(C, "", range);
+  BasicBlock *loop = BasicBlock::Create(C, "group.loop", range);
+  BasicBlock *exit = BasicBlock::Create(C, "group.exit", range);
+
+  IRBuilder<> builder(entry);
+  Value *ptr = builder.CreateStructGEP(pc,
+                                       TypeBuilder<PoclContext, true>::GROUP_ID);
+  Value *gidPtr;
+  if (size_t_width == 64)
+    gidPtr = builder.CreateConstGEP2_64(ptr, 0, 0);
+  else
+    gidPtr = builder.CreateConstGEP2_32(ptr, 0, 0);
+  Value *first = builder.CreateLoad(gidPtr);
+  Value *end = builder.CreateAdd(first, count);
+  builder.CreateCondBr(builder.CreateICmpULT(first, end), loop, exit);
+
+  builder.SetInsertPoint(loop);
+  PHINode *gid = builder.CreatePHI(SizeT, 2, "group_id_x");
+  gid->addIncoming(first, entry);
+  builder.CreateStore(gid, gidPtr);
+  CallInst *call = builder.CreateCall2(workgroup, args, pc);
+  Value *next = builder.CreateAdd(gid, ConstantInt::get(SizeT, 1));
+  gid->addIncoming(next, loop);
+  builder.CreateCondBr(builder.CreateICmpULT(next, end), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateStore(first, gidPtr);
+  builder.CreateRetVoid();
+
+  /* Inline the work-group function and the launcher it calls. The
+     launcher itself stays noinline for the other entry points. */
+  InlineFunctionInfo IFI;
+  InlineFunction(call, IFI);
+  for (Function::iterator i = range->begin(), e = range->end(); i != e; ++i) {
+    for (BasicBlock::iterator ii = i->begin(), ee = i->end(); ii != ee; ++ii) {
+      CallInst *c = dyn_cast<CallInst>(ii);
+      if (c != NULL && c->getCalledFunction() == F) {
+        InlineFunction(c, IFI);
+        return;
+      }
+    }
+  }
+}
 
 /**
  * Returns true in case the given function is a kernel that
@@ -0,0 +1,384 @@
+// LLVM function pass that lowers the OpenCL 2.0 work-group functions.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#define DEBUG_TYPE "workgroup-collectives"
+
+#include "WorkgroupCollectives.h"
+#include "Workgroup.h"
+#include "Barrier.h"
+#include "Kernel.h"
+#include "config.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
+#ifdef LLVM_3_2
+#include "llvm/IRBuilder.h"
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#else
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#endif
+
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+//#define DEBUG_WORKGROUP_COLLECTIVES
+
+#ifdef DEBUG_WORKGROUP_COLLECTIVES
+#include <iostream>
+#endif
+
+using namespace llvm;
+using namespace pocl;
+
+STATISTIC(LoweredCollectives, "Number of work-group functions lowered");
+
+namespace {
+  static
+  RegisterPass<WorkgroupCollectives> X("workgroup-collectives",
+                                       "Work-group function lowering pass");
+}
+
+char WorkgroupCollectives::ID = 0;
+
+namespace {
+
+/* The initial value of the accumulation, which is also the result of
+   the exclusive scan for the first work-item. */
+Constant *
+identityOf(const WorkgroupCollectives::Collective &c, Type *T)
+{
+  unsigned bits = T->getPrimitiveSizeInBits();
+  switch (c.op)
+    {
+    case WorkgroupCollectives::WG_OP_AND:
+      return ConstantInt::get(T, 1);
+    case WorkgroupCollectives::WG_OP_MIN:
+      if (T->isFloatingPointTy())
+        return ConstantFP::getInfinity(T, false);
+      return ConstantInt::get
+        (T->getContext(),
+         c.isSigned ? APInt::getSignedMaxValue(bits) : APInt::getMaxValue(bits));
+    case WorkgroupCollectives::WG_OP_MAX:
+      if (T->isFloatingPointTy())
+        return ConstantFP::getInfinity(T, true);
+      if (c.isSigned)
+        return ConstantInt::get(T->getContext(), APInt::getSignedMinValue(bits));
+      return Constant::getNullValue(T);
+    default:
+      return Constant::getNullValue(T);
+    }
+}
+
+Value *
+applyOp(IRBuilder<> &builder, const WorkgroupCollectives::Collective &c,
+        Value *a, Value *b)
+{
+  bool fp = a->getType()->isFloatingPointTy();
+  Value *takeA = NULL;
+  switch (c.op)
+    {
+    case WorkgroupCollectives::WG_OP_ADD:
+      return fp ? builder.CreateFAdd(a, b) : builder.CreateAdd(a, b);
+    case WorkgroupCollectives::WG_OP_AND:
+      return builder.CreateAnd(a, b);
+    case WorkgroupCollectives::WG_OP_OR:
+      return builder.CreateOr(a, b);
+    case WorkgroupCollectives::WG_OP_MIN:
+      if (fp)
+        takeA = builder.CreateFCmpOLT(a, b);
+      else
+        takeA = c.isSigned ?
+          builder.CreateICmpSLT(a, b) : builder.CreateICmpULT(a, b);
+      break;
+    case WorkgroupCollectives::WG_OP_MAX:
+      if (fp)
+        takeA = builder.CreateFCmpOGT(a, b);
+      else
+        takeA = c.isSigned ?
+          builder.CreateICmpSGT(a, b) : builder.CreateICmpUGT(a, b);
+      break;
+    default:
+      assert (false && "Work-group function without an operation.");
+      return NULL;
+    }
+  /* A NaN operand is ignored like in fmin() and fmax(). */
+  if (fp)
+    takeA = builder.CreateOr(takeA, builder.CreateFCmpUNO(b, b));
+  return builder.CreateSelect(takeA, a, b);
+}
+
+}
+
+void
+WorkgroupCollectives::getAnalysisUsage(AnalysisUsage &) const
+{
+}
+
+/**
+ * Parses the mangled name of a work-group function.
+ *
+ * The signedness of the integer operations comes from the mangled type of
+ * the first argument. Returns false for other functions.
+ */
+bool
+WorkgroupCollectives::parseCollective(StringRef name, Collective &c)
+{
+  if (!name.startswith("_Z"))
+    return false;
+  name = name.substr(2);
+
+  size_t digits = 0;
+  while (digits < name.size() && isdigit(name[digits]))
+    ++digits;
+  unsigned length;
+  if (digits == 0 || name.substr(0, digits).getAsInteger(10, length) ||
+      digits + length >= name.size())
+    return false;
+
+  StringRef base = name.substr(digits, length);
+  char type = name[digits + length];
+  if (!base.startswith("work_group_"))
+    return false;
+  base = base.substr(strlen("work_group_"));
+
+  c.op = WG_OP_NONE;
+  c.isSigned = type == 'i' || type == 'l';
+  if (base == "all")
+    {
+      c.kind = WG_ALL;
+      c.op = WG_OP_AND;
+      return true;
+    }
+  if (base == "any")
+    {
+      c.kind = WG_ANY;
+      c.op = WG_OP_OR;
+      return true;
+    }
+  if (base == "broadcast")
+    {
+      c.kind = WG_BROADCAST;
+      return true;
+    }
+
+  if (base.startswith("reduce_"))
+    {
+      c.kind = WG_REDUCE;
+      base = base.substr(strlen("reduce_"));
+    }
+  else if (base.startswith("scan_inclusive_"))
+    {
+      c.kind = WG_SCAN_INCLUSIVE;
+      base = base.substr(strlen("scan_inclusive_"));
+    }
+  else if (base.startswith("scan_exclusive_"))
+    {
+      c.kind = WG_SCAN_EXCLUSIVE;
+      base = base.substr(strlen("scan_exclusive_"));
+    }
+  else
+    return false;
+
+  if (base == "add")
+    c.op = WG_OP_ADD;
+  else if (base == "min")
+    c.op = WG_OP_MIN;
+  else if (base == "max")
+    c.op = WG_OP_MAX;
+  else
+    return false;
+  return true;
+}
+
+bool
+WorkgroupCollectives::runOnFunction(Function &F)
+{
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  /* The kernel is flattened at this point, thus all the work-group
+     function calls are in the kernel itself. */
+  std::vector<std::pair<CallInst*, Collective> > calls;
+  for (Function::iterator bb = F.begin(), be = F.end(); bb != be; ++bb)
+    {
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          CallInst *call = dyn_cast<CallInst>(i);
+          if (call == NULL || call->getCalledFunction() == NULL ||
+              !call->getCalledFunction()->isDeclaration())
+            continue;
+          Collective c;
+          if (parseCollective(call->getCalledFunction()->getName(), c))
+            calls.push_back(std::make_pair(call, c));
+        }
+    }
+
+  if (calls.empty())
+    return false;
+
+  Initialize(cast<Kernel>(&F));
+
+  for (unsigned i = 0; i < calls.size(); ++i)
+    lowerCollective(calls[i].first, calls[i].second);
+
+#ifdef DEBUG_WORKGROUP_COLLECTIVES
+  std::cerr << "### " << F.getName().str() << ": lowered " << calls.size()
+            << " work-group functions" << std::endl;
+#endif
+
+  LoweredCollectives += calls.size();
+  return true;
+}
+
+/**
+ * Returns the linear local id of the work-item, computed from the local
+ * id globals before the given instruction.
+ *
+ * The id is recomputed for each use instead of being kept over the
+ * barriers to avoid adding it to the context of the work-items.
+ */
+Value *
+WorkgroupCollectives::linearLocalId(Instruction *insertBefore)
+{
+  IRBuilder<> builder(insertBefore);
+  IntegerType *SizeT = IntegerType::get(insertBefore->getContext(), size_t_width);
+
+  Value *id = builder.CreateLoad(localIdX);
+  if (LocalSizeY > 1)
+    id = builder.CreateAdd
+      (id, builder.CreateMul(builder.CreateLoad(localIdY),
+                             ConstantInt::get(SizeT, LocalSizeX)));
+  if (LocalSizeZ > 1)
+    id = builder.CreateAdd
+      (id, builder.CreateMul(builder.CreateLoad(localIdZ),
+                             ConstantInt::get(SizeT, LocalSizeX * LocalSizeY)));
+  return id;
+}
+
+/**
+ * Replaces a work-group function call with the barriers and the
+ * accumulator updates.
+ *
+ * The work-group shares a variable for each call site. It is thread
+ * local, as the host devices run the work-groups in parallel threads
+ * but each work-group fully in one thread. The work-items access it in
+ * the order of their linear local id:
+ *
+ * - reduce, all, any: the last work-item resets the variable to the
+ *   identity of the operation (after all work-items have read the result
+ *   of the previous execution of the call), barrier, each work-item
+ *   accumulates its value, barrier, each work-item reads the result.
+ * - scan: barrier, the first work-item stores its value and the others
+ *   accumulate theirs, returning the running value. No second barrier
+ *   is needed as each work-item only reads the value of the preceding
+ *   ones.
+ * - broadcast: barrier, the work-item with the given local id stores its
+ *   value, barrier, each work-item reads it.
+ */
+void
+WorkgroupCollectives::lowerCollective(CallInst *call, const Collective &c)
+{
+  Module *M = call->getParent()->getParent()->getParent();
+  LLVMContext &C = M->getContext();
+  IntegerType *SizeT = IntegerType::get(C, size_t_width);
+
+  Value *arg = call->getArgOperand(0);
+  Type *T = call->getType();
+  Constant *identity = identityOf(c, T);
+
+  GlobalVariable::ThreadLocalMode tls = GlobalVariable::GeneralDynamicTLSModel;
+  if (Triple(M->getTargetTriple()).getOS() == Triple::UnknownOS)
+    tls = GlobalVariable::NotThreadLocal;
+  GlobalVariable *acc =
+    new GlobalVariable(*M, T, false, GlobalValue::InternalLinkage, identity,
+                       "_work_group_collective", NULL, tls);
+
+  IRBuilder<> builder(call);
+  Value *result = NULL;
+  switch (c.kind)
+    {
+    case WG_SCAN_INCLUSIVE:
+    case WG_SCAN_EXCLUSIVE:
+      {
+        Barrier::Create(call);
+        Value *first = builder.CreateICmpEQ
+          (linearLocalId(call), ConstantInt::get(SizeT, 0));
+        Value *old = builder.CreateLoad(acc);
+        Value *updated =
+          builder.CreateSelect(first, arg, applyOp(builder, c, old, arg));
+        builder.CreateStore(updated, acc);
+        if (c.kind == WG_SCAN_INCLUSIVE)
+          result = updated;
+        else
+          result = builder.CreateSelect(first, identity, old);
+        break;
+      }
+    case WG_BROADCAST:
+      {
+        Value *target = call->getArgOperand(1);
+        if (call->getNumArgOperands() > 2)
+          target = builder.CreateAdd
+            (target, builder.CreateMul(call->getArgOperand(2),
+                                       ConstantInt::get(SizeT, LocalSizeX)));
+        if (call->getNumArgOperands() > 3)
+          target = builder.CreateAdd
+            (target, builder.CreateMul(call->getArgOperand(3),
+                                       ConstantInt::get
+                                       (SizeT, LocalSizeX * LocalSizeY)));
+        Barrier::Create(call);
+        Value *mine = builder.CreateICmpEQ(linearLocalId(call), target);
+        builder.CreateStore
+          (builder.CreateSelect(mine, arg, builder.CreateLoad(acc)), acc);
+        Barrier::Create(call);
+        result = builder.CreateLoad(acc);
+        break;
+      }
+    default:
+      {
+        unsigned count = LocalSizeX * LocalSizeY * LocalSizeZ;
+        Value *last = builder.CreateICmpEQ
+          (linearLocalId(call), ConstantInt::get(SizeT, count - 1));
+        builder.CreateStore
+          (builder.CreateSelect(last, identity, builder.CreateLoad(acc)), acc);
+        Barrier::Create(call);
+        if (c.kind == WG_ALL || c.kind == WG_ANY)
+          arg = builder.CreateZExt
+            (builder.CreateICmpNE(arg, Constant::getNullValue(T)), T);
+        /* An unconditional update the loop vectorizer recognizes as a
+           reduction in the work-item loop. */
+        builder.CreateStore
+          (applyOp(builder, c, builder.CreateLoad(acc), arg), acc);
+        Barrier::Create(call);
+        result = builder.CreateLoad(acc);
+        break;
+      }
+    }
+
+  call->replaceAllUsesWith(result);
+  call->eraseFromParent();
+}
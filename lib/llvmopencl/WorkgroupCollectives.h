@@ -0,0 +1,81 @@
+// Header for WorkgroupCollectives function pass.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _POCL_WORKGROUP_COLLECTIVES_H
+#define _POCL_WORKGROUP_COLLECTIVES_H
+
+#include "WorkitemHandler.h"
+
+namespace llvm {
+  class CallInst;
+  class Instruction;
+}
+
+namespace pocl {
+
+  /**
+   * Lowers the OpenCL 2.0 work-group functions (work_group_reduce_*,
+   * work_group_scan_*, work_group_broadcast, work_group_all and
+   * work_group_any) of the kernel.
+   *
+   * The work-items of a work-group execute the region between two
+   * barriers one after another, in the order of their linear local id.
+   * A collective thus becomes a barrier and an update of an accumulator
+   * variable shared by the work-group, followed by a second barrier and
+   * a read of the result for the reductions and the broadcast. The
+   * scans return the running value directly. The accumulation inside
+   * the work-item loop is an ordinary reduction the loop vectorizer
+   * handles, instead of the log2(local size) barrier rounds of a tree
+   * reduction over local memory.
+   */
+  class WorkgroupCollectives : public pocl::WorkitemHandler {
+  public:
+    static char ID;
+
+    WorkgroupCollectives() : pocl::WorkitemHandler(ID) {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+    virtual bool runOnFunction(llvm::Function &F);
+
+    enum CollectiveKind {
+      WG_ALL, WG_ANY, WG_BROADCAST, WG_REDUCE,
+      WG_SCAN_INCLUSIVE, WG_SCAN_EXCLUSIVE
+    };
+    enum CollectiveOp {
+      WG_OP_NONE, WG_OP_ADD, WG_OP_MIN, WG_OP_MAX, WG_OP_AND, WG_OP_OR
+    };
+    struct Collective {
+      CollectiveKind kind;
+      CollectiveOp op;
+      bool isSigned;
+    };
+
+    static bool parseCollective(llvm::StringRef name, Collective &c);
+
+  private:
+    void lowerCollective(llvm::CallInst *call, const Collective &c);
+    llvm::Value *linearLocalId(llvm::Instruction *insertBefore);
+  };
+}
+
+#endif
@@ -0,0 +1,361 @@
+// LLVM function pass that executes the work-items of a work-group as
+// user space fibers.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#define DEBUG_TYPE "workitem-fibers"
+
+#include "WorkitemFibers.h"
+#include "WorkitemHandlerChooser.h"
+#include "Workgroup.h"
+#include "Barrier.h"
+#include "Kernel.h"
+#include "config.h"
+#include "pocl.h"
+
+#include "llvm/ADT/Statistic.h"
+#ifdef LLVM_3_2
+#include "llvm/IRBuilder.h"
+#include "llvm/DataLayout.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#else
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#endif
+
+#include <map>
+#include <set>
+#include <vector>
+
+//#define DEBUG_WORKITEM_FIBERS
+
+#ifdef DEBUG_WORKITEM_FIBERS
+#include <iostream>
+#endif
+
+/* The return address, the saved registers and the alignment of a call
+   frame, in pointers. */
+#define CALL_FRAME_POINTERS 16
+/* The stack used by the fiber scheduler at a barrier. The register
+   save area of the dynamic linker and the signals is added at run time
+   (see lib/kernel/fibers.c). */
+#define SCHEDULER_CALL_STACK 512
+/* The stack used by a call to the C library, e.g. printf(). */
+#define EXTERNAL_CALL_STACK (16 * 1024)
+#define FIBER_STACK_ALIGN 4096
+
+using namespace llvm;
+using namespace pocl;
+
+STATISTIC(FiberKernels, "Number of kernels executed with work-item fibers");
+
+namespace {
+  static
+  RegisterPass<WorkitemFibers> X("workitemfibers",
+                                 "Workitem fiber generation pass");
+}
+
+char WorkitemFibers::ID = 0;
+
+namespace {
+
+/* The work-group context globals the fiber reads from the frame. The
+   local id comes as an argument and the local size is a constant. */
+const char *frameGlobals[] = {
+  "_work_dim",
+  "_num_groups_x", "_num_groups_y", "_num_groups_z",
+  "_group_id_x", "_group_id_y", "_group_id_z",
+  "_global_offset_x", "_global_offset_y", "_global_offset_z",
+  NULL
+};
+
+/* Returns an upper bound of the stack a call to the function uses. The
+   frame holds the allocas and at most one spill slot per value, plus
+   the deepest call made from the function. The functions on the call
+   path are in 'active'. */
+size_t
+callStackBound(const DataLayout &DL, Function &F,
+               std::set<Function*> &active)
+{
+  if (F.isDeclaration())
+    {
+      if (F.isIntrinsic())
+        return 0;
+      if (F.getName() == "pocl_fiber_barrier")
+        return SCHEDULER_CALL_STACK;
+      return EXTERNAL_CALL_STACK;
+    }
+  /* OpenCL C has no recursion. */
+  if (!active.insert(&F).second)
+    return 0;
+
+  size_t frame = CALL_FRAME_POINTERS * DL.getPointerSize();
+  size_t deepestCall = 0;
+  for (Function::iterator bb = F.begin(), be = F.end(); bb != be; ++bb)
+    {
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          if (AllocaInst *alloca = dyn_cast<AllocaInst>(i))
+            {
+              size_t elements = 1;
+              if (ConstantInt *count =
+                  dyn_cast<ConstantInt>(alloca->getArraySize()))
+                elements = count->getZExtValue();
+              frame +=
+                DL.getTypeAllocSize(alloca->getAllocatedType()) * elements +
+                alloca->getAlignment();
+              continue;
+            }
+          if (!i->getType()->isVoidTy())
+            frame += DL.getTypeAllocSize(i->getType());
+
+          CallInst *call = dyn_cast<CallInst>(i);
+          if (call == NULL)
+            continue;
+          Function *callee = call->getCalledFunction();
+          size_t callStack = callee == NULL ? EXTERNAL_CALL_STACK :
+            callStackBound(DL, *callee, active);
+          if (callStack > deepestCall)
+            deepestCall = callStack;
+        }
+    }
+  active.erase(&F);
+  return frame + deepestCall;
+}
+
+}
+
+void
+WorkitemFibers::getAnalysisUsage(AnalysisUsage &AU) const
+{
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  AU.addRequired<DataLayout>();
+#else
+  AU.addRequired<DataLayoutPass>();
+#endif
+
+  AU.addRequired<pocl::WorkitemHandlerChooser>();
+  AU.addPreserved<pocl::WorkitemHandlerChooser>();
+}
+
+bool
+WorkitemFibers::runOnFunction(Function &F)
+{
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  if (getAnalysis<pocl::WorkitemHandlerChooser>().chosenHandler() !=
+      pocl::WorkitemHandlerChooser::POCL_WIH_FIBERS)
+    return false;
+
+  Initialize(cast<Kernel>(&F));
+
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  DL = &getAnalysis<DataLayout>();
+#else
+  DL = &getAnalysis<DataLayoutPass>().getDataLayout();
+#endif
+
+  return ProcessFunction(F);
+}
+
+/**
+ * Returns the stack size for the fibers executing the given fiber function.
+ *
+ * The size is bounded from the allocas and the values of the fiber
+ * function and of its callees. The calls to the C library, e.g. with
+ * printf, get a fixed reserve, thus POCL_FIBER_STACK_SIZE can override
+ * the bound for kernels calling deeper into it. The stacks are mapped
+ * lazily, so the pages of an overestimate are never touched, and a
+ * fiber overflowing its stack faults on a guard page.
+ */
+size_t
+WorkitemFibers::fiberStackSize(Function &body)
+{
+  if (getKernelOption("POCL_FIBER_STACK_SIZE") != NULL)
+    return atoi(getKernelOption("POCL_FIBER_STACK_SIZE"));
+
+  std::set<Function*> active;
+  size_t size = callStackBound(*DL, body, active);
+  return (size + FIBER_STACK_ALIGN - 1) / FIBER_STACK_ALIGN * FIBER_STACK_ALIGN;
+}
+
+bool
+WorkitemFibers::ProcessFunction(Function &F)
+{
+  Module *M = F.getParent();
+  LLVMContext &C = M->getContext();
+  IntegerType *SizeT = IntegerType::get(C, size_t_width);
+  Type *I8Ptr = Type::getInt8PtrTy(C);
+
+  /* The frame passes the kernel arguments (including the automatic
+     locals, which are thus shared by the fibers) and the work-group
+     context to the fibers. */
+  std::vector<GlobalVariable*> contextGlobals;
+  for (const char **name = frameGlobals; *name != NULL; ++name)
+    {
+      GlobalVariable *gv = M->getGlobalVariable(*name);
+      if (gv != NULL)
+        contextGlobals.push_back(gv);
+    }
+
+  std::vector<Type*> frameFields;
+  for (Function::arg_iterator a = F.arg_begin(), e = F.arg_end(); a != e; ++a)
+    frameFields.push_back(a->getType());
+  for (unsigned i = 0; i < contextGlobals.size(); ++i)
+    frameFields.push_back(contextGlobals[i]->getType()->getElementType());
+  StructType *frameType = StructType::get(C, frameFields);
+
+  std::vector<Type*> bodyArgs;
+  bodyArgs.push_back(I8Ptr);
+  bodyArgs.push_back(I8Ptr);
+  bodyArgs.push_back(SizeT);
+  bodyArgs.push_back(SizeT);
+  bodyArgs.push_back(SizeT);
+  FunctionType *bodyType =
+    FunctionType::get(Type::getVoidTy(C), bodyArgs, false);
+  Function *body =
+    Function::Create(bodyType, Function::InternalLinkage,
+                     F.getName() + "_fiber", M);
+  body->getBasicBlockList().splice
+    (body->begin(), F.getBasicBlockList());
+
+  Function::arg_iterator bodyArg = body->arg_begin();
+  Value *data = bodyArg++;
+  data->setName("data");
+  Value *sched = bodyArg++;
+  sched->setName("sched");
+  Value *localIdArgs[3];
+  for (int i = 0; i < 3; ++i)
+    {
+      localIdArgs[i] = bodyArg++;
+      localIdArgs[i]->setName(std::string("local_id_") + (char)('x' + i));
+    }
+
+  /* Unpack the frame at the beginning of the fiber. The context values
+     are placed in allocas which replace the globals in the fiber, the
+     same way Workgroup privatizes them in the launcher. */
+  IRBuilder<> builder(body->getEntryBlock().getFirstNonPHI());
+  Value *frame =
+    builder.CreateBitCast(data, PointerType::getUnqual(frameType), "frame");
+
+  unsigned field = 0;
+  for (Function::arg_iterator a = F.arg_begin(), e = F.arg_end();
+       a != e; ++a, ++field)
+    {
+      Value *v = builder.CreateLoad
+        (builder.CreateStructGEP(frame, field), a->getName());
+      a->replaceAllUsesWith(v);
+    }
+
+  std::map<Value*, Value*> privatized;
+  for (unsigned i = 0; i < contextGlobals.size(); ++i, ++field)
+    {
+      GlobalVariable *gv = contextGlobals[i];
+      AllocaInst *ai =
+        builder.CreateAlloca(gv->getType()->getElementType(), 0, gv->getName());
+      builder.CreateStore
+        (builder.CreateLoad(builder.CreateStructGEP(frame, field)), ai);
+      privatized[gv] = ai;
+    }
+
+  Value *localIds[] = {localIdX, localIdY, localIdZ};
+  int localSizes[] = {LocalSizeX, LocalSizeY, LocalSizeZ};
+  for (int i = 0; i < 3; ++i)
+    {
+      AllocaInst *ai = builder.CreateAlloca(SizeT, 0, localIds[i]->getName());
+      builder.CreateStore(localIdArgs[i], ai);
+      privatized[localIds[i]] = ai;
+
+      GlobalVariable *gv = M->getGlobalVariable
+        (std::string("_local_size_") + (char)('x' + i));
+      if (gv == NULL)
+        continue;
+      ai = builder.CreateAlloca(SizeT, 0, gv->getName());
+      builder.CreateStore(ConstantInt::get(SizeT, localSizes[i]), ai);
+      privatized[gv] = ai;
+    }
+
+  /* The kernel is flattened at this point, thus all its barriers are
+     in the fiber function. */
+  Constant *fiberBarrier =
+    M->getOrInsertFunction("pocl_fiber_barrier", Type::getVoidTy(C),
+                           I8Ptr, NULL);
+  std::vector<Instruction*> barriers;
+  for (Function::iterator bb = body->begin(), be = body->end(); bb != be; ++bb)
+    {
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          Instruction *instr = i;
+          if (isa<Barrier>(instr))
+            {
+              barriers.push_back(instr);
+              continue;
+            }
+          for (std::map<Value*, Value*>::iterator p = privatized.begin(),
+                 pe = privatized.end(); p != pe; ++p)
+            instr->replaceUsesOfWith(p->first, p->second);
+        }
+    }
+  for (unsigned i = 0; i < barriers.size(); ++i)
+    {
+      CallInst::Create(fiberBarrier, sched, "", barriers[i]);
+      barriers[i]->eraseFromParent();
+    }
+
+  /* The kernel only packs the frame and runs the fibers. */
+  builder.SetInsertPoint(BasicBlock::Create(C, "fibers", &F));
+  AllocaInst *frameAlloca = builder.CreateAlloca(frameType, 0, "fiber_frame");
+  field = 0;
+  for (Function::arg_iterator a = F.arg_begin(), e = F.arg_end();
+       a != e; ++a, ++field)
+    builder.CreateStore(a, builder.CreateStructGEP(frameAlloca, field));
+  for (unsigned i = 0; i < contextGlobals.size(); ++i, ++field)
+    builder.CreateStore
+      (builder.CreateLoad(contextGlobals[i]),
+       builder.CreateStructGEP(frameAlloca, field));
+
+  Constant *fibersRun =
+    M->getOrInsertFunction("pocl_fibers_run", Type::getVoidTy(C),
+                           body->getType(), I8Ptr, SizeT, SizeT, SizeT, SizeT,
+                           NULL);
+  size_t stackSize = fiberStackSize(*body);
+  std::vector<Value*> args;
+  args.push_back(body);
+  args.push_back(builder.CreateBitCast(frameAlloca, I8Ptr));
+  args.push_back(ConstantInt::get(SizeT, LocalSizeX));
+  args.push_back(ConstantInt::get(SizeT, LocalSizeY));
+  args.push_back(ConstantInt::get(SizeT, LocalSizeZ));
+  args.push_back(ConstantInt::get(SizeT, stackSize));
+  builder.CreateCall(fibersRun, args);
+  builder.CreateRetVoid();
+
+#ifdef DEBUG_WORKITEM_FIBERS
+  std::cerr << "### " << F.getName().str() << ": " << barriers.size()
+            << " barriers, fiber stack " << stackSize << " bytes" << std::endl;
+#endif
+
+  ++FiberKernels;
+  return true;
+}
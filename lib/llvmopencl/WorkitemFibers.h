@@ -0,0 +1,66 @@
+// Header for WorkitemFibers function pass.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _POCL_WORKITEM_FIBERS_H
+#define _POCL_WORKITEM_FIBERS_H
+
+#include "WorkitemHandler.h"
+
+namespace llvm {
+  class DataLayout;
+}
+
+namespace pocl {
+
+  /**
+   * Executes the work-items of the kernel as user space fibers.
+   *
+   * The kernel body is moved to a separate fiber function which gets the
+   * local id as arguments and reads the kernel arguments and the rest of
+   * the work-group context from a frame the kernel stores them to. The
+   * barriers become calls to the fiber scheduler of the kernel library
+   * (lib/kernel/fibers.c) which switches to the next work-item, and the
+   * kernel itself only starts the scheduler. The kernel thus has no
+   * barriers left for the following work-item handler passes.
+   *
+   * Unlike the work-item loops and the full replication, the code size
+   * and the context data do not grow with the barriers or the work-group
+   * size, at the cost of a context switch per barrier and work-item.
+   */
+  class WorkitemFibers : public pocl::WorkitemHandler {
+  public:
+    static char ID;
+
+    WorkitemFibers() : pocl::WorkitemHandler(ID) {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+    virtual bool runOnFunction(llvm::Function &F);
+
+  private:
+    bool ProcessFunction(llvm::Function &F);
+    size_t fiberStackSize(llvm::Function &body);
+
+    const llvm::DataLayout *DL;
+  };
+}
+
+#endif
@@ -23,6 +23,8 @@
 // THE SOFTWARE.
 
 #include "config.h"
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 
@@ -60,6 +62,31 @@ cl::opt<bool>
 AddWIMetadata("add-wi-metadata", cl::init(false), cl::Hidden,
   cl::desc("Adds a work item identifier to each of the instruction in work items."));
 
+/* The overrides of the POCL_* options from the tuning profile of the
+   kernel being compiled. */
+cl::list<std::string>
+KernelOptions("kernel-option",
+              cl::desc("Override a POCL_* option for the kernel (KEY=VALUE)"),
+              cl::value_desc("option"));
+
+/**
+ * Returns the value of a POCL_* option for the kernel being compiled,
+ * NULL in case it is not set.
+ */
+const char *
+getKernelOption(const char *key)
+{
+  size_t len = strlen(key);
+  for (unsigned i = 0; i < KernelOptions.size(); ++i)
+    {
+      const std::string &option = KernelOptions[i];
+      if (option.size() > len && option.compare(0, len, key) == 0 &&
+          option[len] == '=')
+        return option.c_str() + len + 1;
+    }
+  return getenv(key);
+}
+
 
 WorkitemHandler::WorkitemHandler(char& ID) : FunctionPass(ID) {
 }
@@ -78,6 +78,9 @@ namespace pocl {
 
   extern llvm::cl::opt<bool> AddWIMetadata;
   extern llvm::cl::opt<int> LockStepSIMDWidth;
+  extern llvm::cl::list<std::string> KernelOptions;
+
+  const char *getKernelOption(const char *key);
 }
 
 #endif
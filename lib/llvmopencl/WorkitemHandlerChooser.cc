@@ -30,10 +30,40 @@
 #include "CanonicalizeBarriers.h"
 #include "Kernel.h"
 
+#include "Barrier.h"
+
+#include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/LoopInfo.h"
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+#include "llvm/Support/CFG.h"
+#else
+#include "llvm/IR/CFG.h"
+#endif
 
 #include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+//#define DEBUG_WORK_ITEM_HANDLER_CHOOSER
+
+/* The weights of the cost model used for choosing between the full
+   replication, the work-item loops and the fibers, in units of an
+   average instruction. */
+
+/* The index update, compare and branch of a work-item loop iteration. */
+#define WI_LOOP_ITERATION_COST 3
+/* The context save and restore of a value that is live across a barrier. */
+#define CONTEXT_VALUE_COST 2
+/* The number of instructions the fully replicated work-group function
+   can have to still fit in a 32 KiB L1 instruction cache. */
+#define REPLICATION_ICACHE_BUDGET (32 * 1024 / 4)
+/* The minimum overhead of the work-item loops relative to the size of
+   the kernel (in percent) for preferring the full replication. */
+#define REPLICATION_MIN_OVERHEAD 25
+/* The fiber switch at a barrier, per work-item. */
+#define FIBER_SWITCH_COST 60
 
 using namespace llvm;
 using namespace pocl;
@@ -47,6 +77,139 @@ namespace {
   
 }
 
+namespace {
+
+struct CodeSize {
+  unsigned instructions;
+  unsigned barriers;
+};
+
+/**
+ * Returns the number of instructions and barriers in the function,
+ * including the ones in the called functions in case they are not yet
+ * inlined.
+ */
+CodeSize
+functionCodeSize(Function *F, std::map<Function*, CodeSize> &sizes)
+{
+  std::map<Function*, CodeSize>::iterator cached = sizes.find(F);
+  if (cached != sizes.end())
+    return cached->second;
+
+  CodeSize size = {0, 0};
+  /* Guard against (illegal) recursion. */
+  sizes[F] = size;
+  for (Function::iterator bb = F->begin(), be = F->end(); bb != be; ++bb)
+    {
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          Instruction *instr = i;
+          ++size.instructions;
+          if (isa<Barrier>(instr))
+            {
+              ++size.barriers;
+              continue;
+            }
+          CallInst *call = dyn_cast<CallInst>(instr);
+          if (call == NULL || call->getCalledFunction() == NULL ||
+              call->getCalledFunction()->isDeclaration())
+            continue;
+          CodeSize callee = functionCodeSize(call->getCalledFunction(), sizes);
+          size.instructions += callee.instructions;
+          size.barriers += callee.barriers;
+        }
+    }
+  sizes[F] = size;
+  return size;
+}
+
+void
+reachableBlocks(BasicBlock *from, bool forward, std::set<BasicBlock*> &blocks)
+{
+  std::vector<BasicBlock*> worklist(1, from);
+  blocks.insert(from);
+  while (!worklist.empty())
+    {
+      BasicBlock *bb = worklist.back();
+      worklist.pop_back();
+      std::vector<BasicBlock*> next;
+      if (forward)
+        next.insert(next.end(), succ_begin(bb), succ_end(bb));
+      else
+        next.insert(next.end(), pred_begin(bb), pred_end(bb));
+      for (unsigned i = 0; i < next.size(); ++i)
+        if (blocks.insert(next[i]).second)
+          worklist.push_back(next[i]);
+    }
+}
+
+/**
+ * Estimates the number of values that would need to be context saved by
+ * the work-item loops: the values that are used after a barrier that
+ * can be reached from their definition.
+ */
+unsigned
+estimateContextValues(Function &F, std::set<BasicBlock*> &barrierBlocks)
+{
+  std::vector<std::set<BasicBlock*> > before, after;
+  for (std::set<BasicBlock*>::iterator i = barrierBlocks.begin(),
+         e = barrierBlocks.end(); i != e; ++i)
+    {
+      before.push_back(std::set<BasicBlock*>());
+      reachableBlocks(*i, false, before.back());
+      after.push_back(std::set<BasicBlock*>());
+      reachableBlocks(*i, true, after.back());
+    }
+
+  unsigned values = 0;
+  for (Function::iterator bb = F.begin(), be = F.end(); bb != be; ++bb)
+    {
+      BasicBlock *defBB = bb;
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          Instruction *instr = i;
+          bool crossesBarrier = false;
+          for (Instruction::use_iterator ui = instr->use_begin(),
+                 ue = instr->use_end();
+               ui != ue && !crossesBarrier; ++ui) 
+            {
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+              Instruction *user = dyn_cast<Instruction>(*ui);
+#else
+              Instruction *user = dyn_cast<Instruction>(ui->getUser());
+#endif
+              if (user == NULL)
+                continue;
+              BasicBlock *useBB = user->getParent();
+              if (useBB == defBB && !isa<PHINode>(user))
+                continue;
+              for (unsigned b = 0; b < before.size() && !crossesBarrier; ++b)
+                crossesBarrier =
+                  before[b].count(defBB) > 0 && after[b].count(useBB) > 0;
+            }
+          if (crossesBarrier)
+            ++values;
+        }
+    }
+  return values;
+}
+
+/**
+ * Returns true in case the kernel library of the target has the fiber
+ * scheduler, which needs the ucontext API of the host C library.
+ */
+bool
+fibersSupported(Module &M)
+{
+  Triple triple(M.getTargetTriple());
+  if (triple.getEnvironment() == Triple::Android)
+    return false;
+  return triple.getOS() == Triple::Linux || triple.getOS() == Triple::FreeBSD ||
+    triple.getOS() == Triple::Darwin || triple.getOS() == Triple::MacOSX;
+}
+
+}
+
 namespace pocl {
 
 char WorkitemHandlerChooser::ID = 0;
@@ -74,14 +237,31 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
      FunctionPass that delegates to other passes. */    
   Initialize(K);
 
+  /* A single work-item (e.g. clEnqueueTask()) needs neither work-item
+     loops nor context arrays whatever the method. */
+  if (LocalSizeX*LocalSizeY*LocalSizeZ == 1)
+    {
+      chosenHandler_ = POCL_WIH_FULL_REPLICATION;
+      return false;
+    }
+
   std::string method = "auto";
-  if (getenv("POCL_WORK_GROUP_METHOD") != NULL)
+  if (getKernelOption("POCL_WORK_GROUP_METHOD") != NULL)
     {
-      method = getenv("POCL_WORK_GROUP_METHOD");
+      method = getKernelOption("POCL_WORK_GROUP_METHOD");
       if (method == "repl" || method == "workitemrepl")
         chosenHandler_ = POCL_WIH_FULL_REPLICATION;
-      else if (method == "loops" || method == "workitemloops" || method == "loopvec")
+      else if (method == "loops" || method == "workitemloops" || method == "loopvec" ||
+               method == "wivec")
         chosenHandler_ = POCL_WIH_LOOPS;
+      else if (method == "fibers" && fibersSupported(*F.getParent()))
+        chosenHandler_ = POCL_WIH_FIBERS;
+      else if (method == "fibers")
+        {
+          std::cerr << "The fibers are not supported by the target. "
+                    << "Using 'loops'." << std::endl;
+          chosenHandler_ = POCL_WIH_LOOPS;
+        }
       else if (method != "auto")
         {
           std::cerr << "Unknown work group generation method. Using 'auto'." << std::endl;
@@ -91,23 +271,100 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
 
   if (method == "auto") 
     {
-      int ReplThreshold = 2;
-      if (getenv("POCL_FULL_REPLICATION_THRESHOLD") != NULL) 
-      {
-        ReplThreshold = atoi(getenv("POCL_FULL_REPLICATION_THRESHOLD"));
-      }
-      
-      if (LocalSizeX*LocalSizeY*LocalSizeZ <= ReplThreshold)
+      if (getKernelOption("POCL_FULL_REPLICATION_THRESHOLD") != NULL) 
         {
-          chosenHandler_ = POCL_WIH_FULL_REPLICATION;
+          int ReplThreshold = atoi(getKernelOption("POCL_FULL_REPLICATION_THRESHOLD"));
+          if (LocalSizeX*LocalSizeY*LocalSizeZ <= ReplThreshold)
+            chosenHandler_ = POCL_WIH_FULL_REPLICATION;
+          else
+            chosenHandler_ = POCL_WIH_LOOPS;
         }
       else
         {
-          chosenHandler_ = POCL_WIH_LOOPS;
+          chosenHandler_ = chooseByCost(F);
         }
     }
 
   return false;
 }
 
+/**
+ * Chooses the work-item handler with a simple static cost model.
+ *
+ * The work-item loops execute each parallel region in a loop and
+ * save the values live across barriers to context arrays. The full
+ * replication has neither overhead, but its code grows with the
+ * work-group size. Replicate in case the replicated code is estimated
+ * to fit in the instruction cache and the loop and context overheads
+ * are significant compared to the kernel size.
+ *
+ * Kernels without barriers are always handled with the loops as they
+ * have no context to save and they are easy to vectorize.
+ *
+ * The kernels with so much context per barrier that the context saving
+ * costs more than switching a fiber at each barrier are executed with
+ * the fibers instead of the loops, in case the target supports them.
+ */
+WorkitemHandlerChooser::WorkitemHandlerType
+WorkitemHandlerChooser::chooseByCost(Function &F)
+{
+  unsigned workItems = LocalSizeX*LocalSizeY*LocalSizeZ;
+  if (workItems <= 2)
+    return POCL_WIH_FULL_REPLICATION;
+
+  std::map<Function*, CodeSize> sizes;
+  std::set<BasicBlock*> barrierBlocks;
+  CodeSize size = {0, 0};
+  for (Function::iterator bb = F.begin(), be = F.end(); bb != be; ++bb)
+    {
+      for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i)
+        {
+          Instruction *instr = i;
+          ++size.instructions;
+          if (isa<Barrier>(instr))
+            {
+              ++size.barriers;
+              barrierBlocks.insert(&*bb);
+              continue;
+            }
+          CallInst *call = dyn_cast<CallInst>(instr);
+          if (call == NULL || call->getCalledFunction() == NULL ||
+              call->getCalledFunction()->isDeclaration())
+            continue;
+          CodeSize callee = functionCodeSize(call->getCalledFunction(), sizes);
+          size.instructions += callee.instructions;
+          size.barriers += callee.barriers;
+          if (callee.barriers > 0)
+            barrierBlocks.insert(&*bb);
+        }
+    }
+
+  if (size.barriers == 0)
+    return POCL_WIH_LOOPS;
+
+  unsigned long replicatedSize = (unsigned long)workItems * size.instructions;
+  unsigned regions = size.barriers + 1;
+  unsigned contextValues = estimateContextValues(F, barrierBlocks);
+  unsigned long loopOverhead =
+    regions * WI_LOOP_ITERATION_COST + contextValues * CONTEXT_VALUE_COST;
+
+#ifdef DEBUG_WORK_ITEM_HANDLER_CHOOSER
+  std::cerr << "### " << F.getName().str() << ": " << size.instructions
+            << " instructions, " << size.barriers << " barriers, "
+            << contextValues << " context values, replicated size "
+            << replicatedSize << std::endl;
+#endif
+
+  if (replicatedSize <= REPLICATION_ICACHE_BUDGET &&
+      loopOverhead * 100 >= 
+      (unsigned long)size.instructions * REPLICATION_MIN_OVERHEAD)
+    return POCL_WIH_FULL_REPLICATION;
+
+  if (loopOverhead > (unsigned long)size.barriers * FIBER_SWITCH_COST &&
+      fibersSupported(*F.getParent()))
+    return POCL_WIH_FIBERS;
+
+  return POCL_WIH_LOOPS;
+}
+
 }
@@ -34,7 +34,8 @@ namespace pocl {
     
     enum WorkitemHandlerType {
       POCL_WIH_FULL_REPLICATION,
-      POCL_WIH_LOOPS
+      POCL_WIH_LOOPS,
+      POCL_WIH_FIBERS
     };
 
   WorkitemHandlerChooser() : pocl::WorkitemHandler(ID), 
@@ -45,6 +46,8 @@ namespace pocl {
     
     WorkitemHandlerType chosenHandler() { return chosenHandler_; }
   private:
+    WorkitemHandlerType chooseByCost(llvm::Function &F);
+
     WorkitemHandlerType chosenHandler_;
   };
 }
@@ -0,0 +1,308 @@
+// LLVM function pass that hoists the work-group uniform computation out
+// of the work-item loops.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#define DEBUG_TYPE "wiloop-hoist"
+
+#include "WorkitemLoopHoisting.h"
+#include "WorkitemHandlerChooser.h"
+#include "VariableUniformityAnalysis.h"
+#include "Workgroup.h"
+#include "Kernel.h"
+#include "config.h"
+#include "pocl.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+#include "llvm/Analysis/Dominators.h"
+#endif
+#ifdef LLVM_3_2
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Module.h"
+#else
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#endif
+
+#include <vector>
+
+//#define DEBUG_WI_LOOP_HOISTING
+
+#ifdef DEBUG_WI_LOOP_HOISTING
+#include <iostream>
+#endif
+
+using namespace llvm;
+using namespace pocl;
+
+STATISTIC(HoistedInstructions,
+          "Number of uniform instructions hoisted out of the work-item loops");
+STATISTIC(HoistedLoads,
+          "Number of uniform loads hoisted out of the work-item loops");
+
+namespace {
+  static
+  RegisterPass<WorkitemLoopHoisting> X("wiloop-hoist",
+                                       "Work-item loop uniform hoisting");
+}
+
+char WorkitemLoopHoisting::ID = 0;
+
+namespace {
+
+/* Returns true in case the object is a stack object of which address does
+   not escape, thus it can be accessed only through pointers based on it. */
+bool
+isLocalStackObject(Value *object)
+{
+  return isa<AllocaInst>(object) && !PointerMayBeCaptured(object, true, true);
+}
+
+/* Returns true in case the memory accessed through pointers based on the
+   two underlying objects cannot overlap. */
+bool
+isDisjointMemory(Value *a, Value *b)
+{
+  if (a == b)
+    return false;
+  if (isIdentifiedObject(a) && isIdentifiedObject(b))
+    return true;
+  return isLocalStackObject(a) || isLocalStackObject(b);
+}
+
+}
+
+void
+WorkitemLoopHoisting::getAnalysisUsage(AnalysisUsage &AU) const
+{
+  AU.addRequired<LoopInfo>();
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  AU.addRequired<DominatorTree>();
+#else
+  AU.addRequired<DominatorTreeWrapperPass>();
+#endif
+
+  AU.addRequired<VariableUniformityAnalysis>();
+  AU.addPreserved<pocl::VariableUniformityAnalysis>();
+
+  AU.addRequired<pocl::WorkitemHandlerChooser>();
+  AU.addPreserved<pocl::WorkitemHandlerChooser>();
+}
+
+/**
+ * Returns true in case the loop is a work-item loop (of any dimension)
+ * created by WorkitemLoops::CreateLoopAround.
+ */
+bool
+WorkitemLoopHoisting::isWorkitemLoop(Loop *L)
+{
+  BasicBlock *latch = L->getLoopLatch();
+  if (latch == NULL)
+    return false;
+  BranchInst *br = dyn_cast<BranchInst>(latch->getTerminator());
+  if (br == NULL || !br->isConditional() ||
+      br->getSuccessor(0) != L->getHeader())
+    return false;
+  ICmpInst *cmp = dyn_cast<ICmpInst>(br->getCondition());
+  if (cmp == NULL || cmp->getPredicate() != ICmpInst::ICMP_ULT)
+    return false;
+  LoadInst *id = dyn_cast<LoadInst>(cmp->getOperand(0));
+  ConstantInt *size = dyn_cast<ConstantInt>(cmp->getOperand(1));
+  if (id == NULL || size == NULL)
+    return false;
+  Value *idVar = id->getPointerOperand();
+  uint64_t trips = size->getZExtValue();
+  return (idVar == localIdX && trips == (uint64_t)LocalSizeX) ||
+    (idVar == localIdY && trips == (uint64_t)LocalSizeY) ||
+    (idVar == localIdZ && trips == (uint64_t)LocalSizeZ);
+}
+
+void
+WorkitemLoopHoisting::findOutermostWorkitemLoops
+(Loop *L, std::vector<Loop*> &loops)
+{
+  if (isWorkitemLoop(L))
+    {
+      loops.push_back(L);
+      return;
+    }
+  for (Loop::iterator i = L->begin(), e = L->end(); i != e; ++i)
+    findOutermostWorkitemLoops(*i, loops);
+}
+
+/**
+ * Returns true in case the instruction is executed in every iteration of
+ * the loop, thus at least once when the preheader is executed (the
+ * work-item loops are never entered with a zero trip count).
+ */
+bool
+WorkitemLoopHoisting::isGuaranteedToExecute(Instruction *I, Loop *L)
+{
+  SmallVector<BasicBlock*, 8> exitingBlocks;
+  L->getExitingBlocks(exitingBlocks);
+  for (unsigned i = 0; i < exitingBlocks.size(); ++i)
+    if (!DT->dominates(I->getParent(), exitingBlocks[i]))
+      return false;
+  return true;
+}
+
+/**
+ * Hoists the uniform instructions of the work-item loop nest to its
+ * preheader.
+ */
+bool
+WorkitemLoopHoisting::hoistUniforms(Function &F, Loop *L)
+{
+  VariableUniformityAnalysis &VUA = getAnalysis<VariableUniformityAnalysis>();
+
+  BasicBlock *preheader = L->getLoopPreheader();
+  if (preheader == NULL)
+    return false;
+
+  /* Collect the memory written in the loop nest. These include at least
+     the local id variables and the context arrays. */
+  std::vector<Value*> writtenObjects;
+  bool writesUnknownMemory = false;
+  for (Loop::block_iterator b = L->block_begin(), be = L->block_end();
+       b != be; ++b)
+    {
+      for (BasicBlock::iterator i = (*b)->begin(), e = (*b)->end();
+           i != e; ++i)
+        {
+          Instruction *instr = i;
+          if (!instr->mayWriteToMemory())
+            continue;
+          StoreInst *store = dyn_cast<StoreInst>(instr);
+          if (store != NULL && store->isSimple())
+            writtenObjects.push_back
+              (GetUnderlyingObject(store->getPointerOperand()));
+          else
+            writesUnknownMemory = true;
+        }
+    }
+
+  /* Hoist until a fixed point as hoisting an instruction can make its
+     users loop invariant. */
+  bool changed = false;
+  bool hoisted = true;
+  while (hoisted)
+    {
+      hoisted = false;
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end();
+           b != be; ++b)
+        {
+          for (BasicBlock::iterator i = (*b)->begin(); i != (*b)->end();)
+            {
+              Instruction *instr = i;
+              ++i;
+
+              if (isa<PHINode>(instr) || isa<TerminatorInst>(instr) ||
+                  isa<AllocaInst>(instr) || isa<LandingPadInst>(instr) ||
+                  isa<DbgInfoIntrinsic>(instr))
+                continue;
+
+              if (!L->hasLoopInvariantOperands(instr) ||
+                  !VUA.isUniform(&F, instr))
+                continue;
+
+              if (LoadInst *load = dyn_cast<LoadInst>(instr))
+                {
+                  if (!load->isSimple())
+                    continue;
+                  if (!isSafeToSpeculativelyExecute(load) &&
+                      !isGuaranteedToExecute(load, L))
+                    continue;
+                  /* The kernel cannot write to the constant memory. */
+                  Value *ptr = load->getPointerOperand();
+                  if (ptr->getType()->getPointerAddressSpace() !=
+                      POCL_ADDRESS_SPACE_CONSTANT)
+                    {
+                      if (writesUnknownMemory)
+                        continue;
+                      Value *object = GetUnderlyingObject(ptr);
+                      bool clobbered = false;
+                      for (unsigned w = 0;
+                           w < writtenObjects.size() && !clobbered; ++w)
+                        clobbered = !isDisjointMemory(object, writtenObjects[w]);
+                      if (clobbered)
+                        continue;
+                    }
+                  ++HoistedLoads;
+                }
+              else
+                {
+                  if (instr->mayReadFromMemory() ||
+                      instr->mayHaveSideEffects())
+                    continue;
+                  if (!isSafeToSpeculativelyExecute(instr) &&
+                      !isGuaranteedToExecute(instr, L))
+                    continue;
+                }
+
+#ifdef DEBUG_WI_LOOP_HOISTING
+              std::cerr << "### wiloop-hoist: hoisting ";
+              instr->dump();
+#endif
+              instr->moveBefore(preheader->getTerminator());
+              ++HoistedInstructions;
+              hoisted = changed = true;
+            }
+        }
+    }
+  return changed;
+}
+
+bool
+WorkitemLoopHoisting::runOnFunction(Function &F)
+{
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  if (getAnalysis<pocl::WorkitemHandlerChooser>().chosenHandler() !=
+      pocl::WorkitemHandlerChooser::POCL_WIH_LOOPS)
+    return false;
+
+  Initialize(cast<Kernel>(&F));
+
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  DT = &getAnalysis<DominatorTree>();
+#else
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+#endif
+  LoopInfo &LI = getAnalysis<LoopInfo>();
+
+  std::vector<Loop*> loops;
+  for (LoopInfo::iterator i = LI.begin(), e = LI.end(); i != e; ++i)
+    findOutermostWorkitemLoops(*i, loops);
+
+  bool changed = false;
+  for (std::vector<Loop*>::iterator i = loops.begin(); i != loops.end(); ++i)
+    changed |= hoistUniforms(F, *i);
+  return changed;
+}
@@ -0,0 +1,71 @@
+// Header for WorkitemLoopHoisting, a pass that hoists the work-group
+// uniform computation out of the work-item loops.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _POCL_WORKITEM_LOOP_HOISTING_H
+#define _POCL_WORKITEM_LOOP_HOISTING_H
+
+#include "WorkitemHandler.h"
+
+#include <vector>
+
+namespace llvm {
+  class DominatorTree;
+  class Loop;
+  class Instruction;
+}
+
+namespace pocl {
+
+  /**
+   * Hoists the work-group uniform instructions out of the work-item loops
+   * created by WorkitemLoops to the preheader of the outermost work-item
+   * loop of each parallel region, so they are executed once per
+   * work-group instead of once per work-item.
+   *
+   * The uniformity comes from VariableUniformityAnalysis. Unlike the
+   * generic LICM, uniform loads are hoisted also when the loop contains
+   * stores, in case the stores provably cannot modify the loaded memory
+   * (e.g. the loads from the constant address space or from restrict
+   * pointers, and the stores to the context arrays).
+   */
+  class WorkitemLoopHoisting : public pocl::WorkitemHandler {
+  public:
+    static char ID;
+
+    WorkitemLoopHoisting() : pocl::WorkitemHandler(ID) {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+    virtual bool runOnFunction(llvm::Function &F);
+
+  private:
+    bool isWorkitemLoop(llvm::Loop *L);
+    void findOutermostWorkitemLoops
+      (llvm::Loop *L, std::vector<llvm::Loop*> &loops);
+    bool hoistUniforms(llvm::Function &F, llvm::Loop *L);
+    bool isGuaranteedToExecute(llvm::Instruction *I, llvm::Loop *L);
+
+    llvm::DominatorTree *DT;
+  };
+}
+
+#endif
@@ -0,0 +1,1529 @@
+// LLVM function pass that vectorizes the work-item loops across the
+// work-items.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#define DEBUG_TYPE "wiloop-vectorize"
+
+#include "WorkitemLoopVectorizer.h"
+#include "WorkitemHandlerChooser.h"
+#include "VariableUniformityAnalysis.h"
+#include "Workgroup.h"
+#include "Kernel.h"
+#include "config.h"
+#include "pocl.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#ifdef LLVM_3_2
+#include "llvm/IRBuilder.h"
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Module.h"
+#else
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#endif
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+//#define DEBUG_WI_LOOP_VECTORIZER
+
+#ifdef DEBUG_WI_LOOP_VECTORIZER
+#include <iostream>
+#endif
+
+/* The maximum number of work-items executed in one vector iteration. Wider
+   vectors only inflate the per-lane (scalarized) parts of the loops. */
+#define MAX_VECTOR_WIDTH 16
+
+using namespace llvm;
+using namespace pocl;
+
+namespace {
+  static
+  RegisterPass<WorkitemLoopVectorizer> X("wiloop-vectorize",
+                                         "Work-item loop vectorizer");
+}
+
+char WorkitemLoopVectorizer::ID = 0;
+
+namespace {
+
+/* How a value in the work-item loop body varies across the work-items
+   executed in the same vector iteration. */
+enum ValueShape {
+  /* The same for all the work-items. Kept scalar. */
+  SHAPE_UNIFORM,
+  /* The value of the first work-item plus the lane index (in elements in
+     case of pointers), wrapping around in the width of the type. Kept as
+     the scalar of the first lane. */
+  SHAPE_CONSECUTIVE,
+  /* Anything else. Widened to a vector or scalarized per lane. */
+  SHAPE_VARYING
+};
+
+/* A diverging branch and the blocks before its immediate post-dominator.
+   The blocks are if-converted to a straight line of masked blocks. */
+struct DivergentRegion {
+  llvm::BasicBlock *entry;
+  llvm::BasicBlock *join;
+  /* The region blocks excluding the entry, in reverse post order. */
+  std::vector<llvm::BasicBlock*> blocks;
+};
+
+/**
+ * Vectorizes the body of a single work-item loop.
+ *
+ * The analysis is done first on the whole body, vectorize() is called only
+ * if it succeeds, thus a loop is either vectorized fully or left intact.
+ */
+class WorkitemLoopBody {
+public:
+  WorkitemLoopBody(Function &F, Loop *L, LoopInfo *LI, PostDominatorTree *PDT,
+                   VariableUniformityAnalysis &VUA, Value *localIdX,
+                   Value *localIdY, Value *localIdZ) :
+    F(F), L(L), LI(LI), PDT(PDT), VUA(VUA), localIdX(localIdX),
+    localIdY(localIdY), localIdZ(localIdZ), builder(F.getContext()),
+    incBB(NULL), latchBB(NULL), increment(NULL), VF(1) {}
+
+  bool analyze(unsigned localSizeX, unsigned registerWidth);
+  void vectorize();
+
+  unsigned vectorWidth() const { return VF; }
+
+private:
+  typedef SmallVector<Value*, MAX_VECTOR_WIDTH> LaneValues;
+
+  bool findBody();
+  bool analyzeShapes();
+  bool computeShape(Instruction *I, ValueShape &shape);
+  bool findDivergentRegions(std::set<BasicBlock*> &masked);
+  bool chooseVectorWidth(unsigned localSizeX, unsigned registerWidth);
+  bool isWidened(Instruction *I) const;
+
+  ValueShape shapeOf(Value *V) const;
+  bool cannotWrap(Value *V, bool isSigned) const;
+  bool isNarrowIndex(Value *V) const;
+  bool isDivergent(BasicBlock *BB) const;
+  bool needsPredication(Instruction *I) const;
+  AllocaInst *contextArrayOf(Value *ptr) const;
+
+  Value *splat(Value *V);
+  Value *buildVector(LaneValues &lanes);
+  Value *getVector(Value *V);
+  Value *getLane(Value *V, unsigned lane);
+  Value *vectorPointer(Value *ptr, Type *elementType);
+  unsigned vectorAlignment(Value *ptr, unsigned alignment, Type *elementType);
+  Value *laneBits(Value *mask);
+  BasicBlock *splitBlock(Value *cond, BasicBlock *&thenBB,
+                         BasicBlock **elseBB);
+
+  void computeBlockMask(BasicBlock *BB);
+  void computeEdgeMasks(BasicBlock *BB);
+  void linearize(DivergentRegion &region);
+
+  void vectorizeInstruction(Instruction *I, Value *mask);
+  void vectorizeLoad(LoadInst *load, Value *mask);
+  void vectorizeStore(StoreInst *store, Value *mask);
+  bool vectorizeCall(CallInst *call);
+  void guardUniform(Instruction *I, Value *mask);
+  void scalarize(Instruction *I, Value *mask, LaneValues &results);
+
+  Function &F;
+  Loop *L;
+  LoopInfo *LI;
+  PostDominatorTree *PDT;
+  VariableUniformityAnalysis &VUA;
+  Value *localIdX, *localIdY, *localIdZ;
+  IRBuilder<> builder;
+
+  BasicBlock *incBB, *latchBB;
+  /* The add that increments the local id x in the end of an iteration. */
+  BinaryOperator *increment;
+  /* The loop body blocks in reverse post order. */
+  std::vector<BasicBlock*> body;
+  std::set<BasicBlock*> bodyBlocks;
+  std::map<BasicBlock*, std::vector<BasicBlock*> > predecessors;
+  std::map<BasicBlock*, TerminatorInst*> terminators;
+
+  std::map<Value*, ValueShape> shapes;
+  std::vector<DivergentRegion> regions;
+  std::set<BasicBlock*> regionEntries;
+  std::set<BasicBlock*> maskedBlocks;
+  /* Context arrays written in masked blocks. Their contents might differ
+     between the lanes even when a uniform value is stored. */
+  std::set<Value*> maskedContextArrays;
+  unsigned VF;
+
+  std::map<Value*, Value*> vectors;
+  std::map<Value*, LaneValues> laneValues;
+  std::map<BasicBlock*, Value*> blockMasks;
+  std::map<std::pair<BasicBlock*, BasicBlock*>, Value*> edgeMasks;
+  std::vector<Instruction*> replaced;
+};
+
+bool
+isVectorizableType(Type *T)
+{
+  if (T->isFloatTy() || T->isDoubleTy())
+    return true;
+  if (!T->isIntegerTy())
+    return false;
+  unsigned bits = T->getIntegerBitWidth();
+  return bits == 1 || bits == 8 || bits == 16 || bits == 32 || bits == 64;
+}
+
+/* Types that can be loaded and stored as vectors. Vectors of i1 are bit
+   packed in memory unlike arrays of them. */
+bool
+isVectorizableMemoryType(Type *T)
+{
+  return isVectorizableType(T) && T->getPrimitiveSizeInBits() >= 8;
+}
+
+bool
+isVectorizableIntrinsic(unsigned id)
+{
+  switch (id)
+    {
+    case Intrinsic::sqrt:
+    case Intrinsic::sin:
+    case Intrinsic::cos:
+    case Intrinsic::pow:
+    case Intrinsic::exp:
+    case Intrinsic::exp2:
+    case Intrinsic::log:
+    case Intrinsic::log2:
+    case Intrinsic::log10:
+    case Intrinsic::fabs:
+    case Intrinsic::floor:
+    case Intrinsic::fma:
+    case Intrinsic::fmuladd:
+#ifndef LLVM_3_2
+    case Intrinsic::ceil:
+    case Intrinsic::trunc:
+    case Intrinsic::rint:
+    case Intrinsic::nearbyint:
+#endif
+      return true;
+    default:
+      return false;
+    }
+}
+
+bool
+isDivRem(Instruction *I)
+{
+  switch (I->getOpcode())
+    {
+    case Instruction::UDiv:
+    case Instruction::SDiv:
+    case Instruction::URem:
+    case Instruction::SRem:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Returns true in case the pointer points to a scalar that is a single
+   element step away from its neighbor in the last GEP index. */
+bool
+isScalarPointer(Type *T)
+{
+  PointerType *PT = dyn_cast<PointerType>(T);
+  if (PT == NULL)
+    return false;
+  Type *E = PT->getElementType();
+  return E->isIntegerTy() || E->isFloatingPointTy() || E->isPointerTy();
+}
+
+ValueShape
+WorkitemLoopBody::shapeOf(Value *V) const
+{
+  /* Everything defined outside the loop body, including the values
+     defined by the instructions that moved to the blocks split during
+     vectorization, is analyzed via the shape index. */
+  std::map<Value*, ValueShape>::const_iterator i = shapes.find(V);
+  if (i == shapes.end())
+    return SHAPE_UNIFORM;
+  return i->second;
+}
+
+/**
+ * Tells whether the lanes of a consecutive integer cannot wrap around
+ * inside a vector, as a signed or unsigned value. Holds for the local
+ * id and the values computed from it without wrapping, as told by the
+ * nsw/nuw flags. Truncated values can wrap.
+ */
+bool
+WorkitemLoopBody::cannotWrap(Value *V, bool isSigned) const
+{
+  if (LoadInst *load = dyn_cast<LoadInst>(V))
+    return load->getPointerOperand() == localIdX;
+
+  if (isa<ZExtInst>(V))
+    return cannotWrap(cast<ZExtInst>(V)->getOperand(0), false);
+  if (isa<SExtInst>(V))
+    return isSigned && cannotWrap(cast<SExtInst>(V)->getOperand(0), true);
+
+  BinaryOperator *binop = dyn_cast<BinaryOperator>(V);
+  if (binop == NULL || (binop->getOpcode() != Instruction::Add &&
+                        binop->getOpcode() != Instruction::Sub))
+    return false;
+  if (isSigned ? !binop->hasNoSignedWrap() : !binop->hasNoUnsignedWrap())
+    return false;
+  Value *consecutive = binop->getOperand(0);
+  if (shapeOf(consecutive) != SHAPE_CONSECUTIVE)
+    consecutive = binop->getOperand(1);
+  return cannotWrap(consecutive, isSigned);
+}
+
+/**
+ * Tells whether an integer is narrower than size_t, i.e. the pointers.
+ * The lanes of such a consecutive value can wrap around inside a vector
+ * also where the wider ones would wrap around the address space.
+ */
+bool
+WorkitemLoopBody::isNarrowIndex(Value *V) const
+{
+  Type *sizeT = cast<PointerType>(localIdX->getType())->getElementType();
+  return V->getType()->getScalarSizeInBits() <
+    sizeT->getPrimitiveSizeInBits();
+}
+
+/**
+ * Finds the loop body blocks and the local id increment. Returns false
+ * in case the loop is not a plain (non-peeled, non-unrolled) work-item
+ * loop.
+ */
+bool
+WorkitemLoopBody::findBody()
+{
+  latchBB = L->getLoopLatch();
+  incBB = latchBB->getSinglePredecessor();
+  if (incBB == NULL || !L->contains(incBB))
+    return false;
+
+  for (BasicBlock::iterator i = incBB->begin(), e = incBB->end(); i != e; ++i)
+    {
+      StoreInst *store = dyn_cast<StoreInst>(i);
+      if (store == NULL || store->getPointerOperand() != localIdX)
+        continue;
+      BinaryOperator *add = dyn_cast<BinaryOperator>(store->getValueOperand());
+      if (add == NULL || add->getOpcode() != Instruction::Add)
+        continue;
+      LoadInst *id = dyn_cast<LoadInst>(add->getOperand(0));
+      ConstantInt *one = dyn_cast<ConstantInt>(add->getOperand(1));
+      if (id != NULL && id->getPointerOperand() == localIdX &&
+          one != NULL && one->isOne())
+        increment = add;
+    }
+  if (increment == NULL)
+    return false;
+
+  /* The loop must start from the work-item 0, not from the first
+     iteration variable of a peeled loop. */
+  BasicBlock *preheader = L->getLoopPreheader();
+  if (preheader == NULL)
+    return false;
+  StoreInst *init = NULL;
+  for (BasicBlock::iterator i = preheader->begin(), e = preheader->end();
+       i != e; ++i)
+    {
+      StoreInst *store = dyn_cast<StoreInst>(i);
+      if (store != NULL && store->getPointerOperand() == localIdX)
+        init = store;
+    }
+  if (init == NULL || !isa<ConstantInt>(init->getValueOperand()) ||
+      !cast<ConstantInt>(init->getValueOperand())->isZero())
+    return false;
+
+  /* Collect the body in reverse post order. */
+  std::vector<BasicBlock*> postOrder;
+  std::vector<std::pair<BasicBlock*, unsigned> > stack;
+  std::set<BasicBlock*> visited;
+  stack.push_back(std::make_pair(L->getHeader(), 0u));
+  visited.insert(L->getHeader());
+  while (!stack.empty())
+    {
+      BasicBlock *bb = stack.back().first;
+      TerminatorInst *t = bb->getTerminator();
+      unsigned next = stack.back().second++;
+      if (next == t->getNumSuccessors())
+        {
+          postOrder.push_back(bb);
+          stack.pop_back();
+          continue;
+        }
+      BasicBlock *succ = t->getSuccessor(next);
+      if (succ == incBB)
+        continue;
+      /* The body should be exited only via the increment block. */
+      if (succ == latchBB || !L->contains(succ))
+        return false;
+      if (visited.insert(succ).second)
+        stack.push_back(std::make_pair(succ, 0u));
+    }
+  body.assign(postOrder.rbegin(), postOrder.rend());
+  bodyBlocks.insert(body.begin(), body.end());
+  if (body.size() + 2 != L->getNumBlocks())
+    return false;
+
+  for (std::vector<BasicBlock*>::iterator i = body.begin(); i != body.end();
+       ++i)
+    {
+      BasicBlock *bb = *i;
+      TerminatorInst *t = bb->getTerminator();
+      terminators[bb] = t;
+      for (unsigned s = 0; s < t->getNumSuccessors(); ++s)
+        predecessors[t->getSuccessor(s)].push_back(bb);
+    }
+  return true;
+}
+
+bool
+WorkitemLoopBody::computeShape(Instruction *I, ValueShape &shape)
+{
+  shape = SHAPE_VARYING;
+
+  if (LoadInst *load = dyn_cast<LoadInst>(I))
+    {
+      Value *ptr = load->getPointerOperand();
+      if (!load->isSimple())
+        return true;
+      if (ptr == localIdX)
+        shape = SHAPE_CONSECUTIVE;
+      else if (ptr == localIdY || ptr == localIdZ)
+        shape = SHAPE_UNIFORM;
+      else if (shapeOf(ptr) == SHAPE_UNIFORM)
+        shape = SHAPE_UNIFORM;
+      /* The loop iteration variables of the uniform loops are stored to
+         all the lanes of their context arrays (due to -phistoallocas).
+         Any of the lanes can be used to read them. */
+      else if (shapeOf(ptr) == SHAPE_CONSECUTIVE &&
+               contextArrayOf(ptr) != NULL &&
+               maskedContextArrays.count(contextArrayOf(ptr)) == 0 &&
+               VUA.isUniform(&F, load))
+        shape = SHAPE_UNIFORM;
+      return true;
+    }
+
+  if (StoreInst *store = dyn_cast<StoreInst>(I))
+    {
+      Value *ptr = store->getPointerOperand();
+      if (ptr == localIdX || ptr == localIdY || ptr == localIdZ)
+        return false;
+      if (store->isSimple() && shapeOf(ptr) == SHAPE_UNIFORM &&
+          shapeOf(store->getValueOperand()) == SHAPE_UNIFORM)
+        shape = SHAPE_UNIFORM;
+      /* A varying value stored to a uniform location the loop also reads
+         passes a value from a work-item to the next one (e.g. the
+         accumulators of the work-group functions). */
+      else if (shapeOf(ptr) == SHAPE_UNIFORM)
+        {
+          for (Value::use_iterator u = ptr->use_begin(), e = ptr->use_end();
+               u != e; ++u)
+            {
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+              LoadInst *load = dyn_cast<LoadInst>(*u);
+#else
+              LoadInst *load = dyn_cast<LoadInst>(u->getUser());
+#endif
+              if (load != NULL && bodyBlocks.count(load->getParent()) != 0)
+                return false;
+            }
+        }
+      return true;
+    }
+
+  if (isa<PHINode>(I) || isa<AllocaInst>(I) || isa<VAArgInst>(I) ||
+      isa<LandingPadInst>(I))
+    return false;
+
+  if (isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I))
+    return true;
+
+  if (isa<FenceInst>(I))
+    {
+      shape = SHAPE_UNIFORM;
+      return true;
+    }
+
+  if (CallInst *call = dyn_cast<CallInst>(I))
+    {
+      if (isa<DbgInfoIntrinsic>(call))
+        {
+          shape = SHAPE_UNIFORM;
+          return true;
+        }
+      if (!call->doesNotAccessMemory())
+        return true;
+      for (unsigned i = 0; i < call->getNumArgOperands(); ++i)
+        if (shapeOf(call->getArgOperand(i)) != SHAPE_UNIFORM)
+          return true;
+      shape = SHAPE_UNIFORM;
+      return true;
+    }
+
+  bool allUniform = true;
+  for (unsigned i = 0; i < I->getNumOperands(); ++i)
+    allUniform = allUniform && shapeOf(I->getOperand(i)) == SHAPE_UNIFORM;
+
+  if (allUniform)
+    {
+      /* A division in a masked block would be executed also for the
+         lanes that should not, which might trap. Divisions are thus
+         widened to be able to mask the divisor. */
+      if (!(maskedBlocks.count(I->getParent()) && isDivRem(I)))
+        shape = SHAPE_UNIFORM;
+      return true;
+    }
+
+  if (BinaryOperator *binop = dyn_cast<BinaryOperator>(I))
+    {
+      ValueShape a = shapeOf(binop->getOperand(0));
+      ValueShape b = shapeOf(binop->getOperand(1));
+      /* E.g. 'uchar i = get_local_id(0) + 250' wraps inside a vector. */
+      if (isNarrowIndex(binop) && !binop->hasNoSignedWrap() &&
+          !binop->hasNoUnsignedWrap())
+        return true;
+      if (binop->getOpcode() == Instruction::Add &&
+          ((a == SHAPE_CONSECUTIVE && b == SHAPE_UNIFORM) ||
+           (a == SHAPE_UNIFORM && b == SHAPE_CONSECUTIVE)))
+        shape = SHAPE_CONSECUTIVE;
+      else if (binop->getOpcode() == Instruction::Sub &&
+               a == SHAPE_CONSECUTIVE && b == SHAPE_UNIFORM)
+        shape = SHAPE_CONSECUTIVE;
+      return true;
+    }
+
+  if (CastInst *castInst = dyn_cast<CastInst>(I))
+    {
+      Type *src = castInst->getSrcTy(), *dst = castInst->getDestTy();
+      Value *op = castInst->getOperand(0);
+      if (shapeOf(op) != SHAPE_CONSECUTIVE)
+        return true;
+      /* The lanes of the extended value are consecutive only in case
+         the narrower ones do not wrap around. */
+      if ((isa<ZExtInst>(castInst) && cannotWrap(op, false)) ||
+          (isa<SExtInst>(castInst) && cannotWrap(op, true)))
+        shape = SHAPE_CONSECUTIVE;
+      else if (isa<BitCastInst>(castInst) && isScalarPointer(src) &&
+               isScalarPointer(dst))
+        {
+          Type *from = cast<PointerType>(src)->getElementType();
+          Type *to = cast<PointerType>(dst)->getElementType();
+          if (from->getPrimitiveSizeInBits() != 0 &&
+              from->getPrimitiveSizeInBits() == to->getPrimitiveSizeInBits())
+            shape = SHAPE_CONSECUTIVE;
+        }
+      return true;
+    }
+
+  if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(I))
+    {
+      /* The context array accesses ([0][z][y][x]) and the array accesses
+         indexed with the global id end up here. */
+      unsigned last = gep->getNumOperands() - 1;
+      if (last == 0 || shapeOf(gep->getOperand(last)) != SHAPE_CONSECUTIVE ||
+          !isScalarPointer(gep->getType()))
+        return true;
+      /* The narrower indices are sign extended. */
+      if (isNarrowIndex(gep->getOperand(last)) &&
+          !cannotWrap(gep->getOperand(last), true))
+        return true;
+      for (unsigned i = 0; i < last; ++i)
+        if (shapeOf(gep->getOperand(i)) != SHAPE_UNIFORM)
+          return true;
+      shape = SHAPE_CONSECUTIVE;
+      return true;
+    }
+
+  return true;
+}
+
+bool
+WorkitemLoopBody::analyzeShapes()
+{
+  shapes.clear();
+
+  for (std::vector<BasicBlock*>::iterator i = body.begin(); i != body.end();
+       ++i)
+    {
+      BasicBlock *bb = *i;
+      for (BasicBlock::iterator ii = bb->begin(), ie = bb->end(); ii != ie;
+           ++ii)
+        {
+          Instruction *instr = ii;
+          if (isa<TerminatorInst>(instr))
+            continue;
+          /* Dead allocas are left behind by the context array creation. */
+          if (isa<AllocaInst>(instr) && instr->use_empty())
+            continue;
+          ValueShape shape;
+          if (!computeShape(instr, shape))
+            return false;
+          shapes[instr] = shape;
+        }
+
+      TerminatorInst *t = bb->getTerminator();
+      if (isa<SwitchInst>(t))
+        {
+          if (shapeOf(cast<SwitchInst>(t)->getCondition()) != SHAPE_UNIFORM)
+            return false;
+        }
+      else if (!isa<BranchInst>(t))
+        return false;
+    }
+
+  /* The lanes other than the first are known only inside the body. */
+  for (std::map<Value*, ValueShape>::iterator i = shapes.begin();
+       i != shapes.end(); ++i)
+    {
+      if (i->second == SHAPE_UNIFORM)
+        continue;
+      Instruction *instr = cast<Instruction>(i->first);
+      for (Instruction::use_iterator ui = instr->use_begin(),
+             ue = instr->use_end();
+           ui != ue; ++ui)
+        {
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+          Instruction *user = dyn_cast<Instruction>(*ui);
+#else
+          Instruction *user = dyn_cast<Instruction>(ui->getUser());
+#endif
+          if (user == NULL || bodyBlocks.count(user->getParent()) == 0)
+            return false;
+        }
+    }
+  return true;
+}
+
+bool
+WorkitemLoopBody::isDivergent(BasicBlock *BB) const
+{
+  BranchInst *br = dyn_cast<BranchInst>(BB->getTerminator());
+  return br != NULL && br->isConditional() &&
+    br->getSuccessor(0) != br->getSuccessor(1) &&
+    shapeOf(br->getCondition()) != SHAPE_UNIFORM;
+}
+
+/**
+ * Finds the regions controlled by diverging branches. Only acyclic single
+ * entry regions are supported: loops with a diverging exit condition are
+ * left for the scalar work-item loop.
+ */
+bool
+WorkitemLoopBody::findDivergentRegions(std::set<BasicBlock*> &masked)
+{
+  regions.clear();
+  regionEntries.clear();
+  masked.clear();
+
+  for (std::vector<BasicBlock*>::iterator i = body.begin(); i != body.end();
+       ++i)
+    {
+      BasicBlock *entry = *i;
+      if (masked.count(entry) || !isDivergent(entry))
+        continue;
+
+      DomTreeNode *node = PDT->getNode(entry);
+      if (node == NULL || node->getIDom() == NULL ||
+          node->getIDom()->getBlock() == NULL)
+        return false;
+      BasicBlock *join = node->getIDom()->getBlock();
+      if (join != incBB && bodyBlocks.count(join) == 0)
+        return false;
+
+      Loop *loop = LI->getLoopFor(entry);
+      std::set<BasicBlock*> blocks;
+      std::vector<BasicBlock*> worklist;
+      TerminatorInst *t = entry->getTerminator();
+      for (unsigned s = 0; s < t->getNumSuccessors(); ++s)
+        worklist.push_back(t->getSuccessor(s));
+      while (!worklist.empty())
+        {
+          BasicBlock *bb = worklist.back();
+          worklist.pop_back();
+          if (bb == join || blocks.count(bb))
+            continue;
+          if (bodyBlocks.count(bb) == 0 || LI->getLoopFor(bb) != loop ||
+              bb == loop->getHeader() ||
+              !isa<BranchInst>(bb->getTerminator()))
+            return false;
+          blocks.insert(bb);
+          t = bb->getTerminator();
+          for (unsigned s = 0; s < t->getNumSuccessors(); ++s)
+            worklist.push_back(t->getSuccessor(s));
+        }
+
+      DivergentRegion region;
+      region.entry = entry;
+      region.join = join;
+      for (std::vector<BasicBlock*>::iterator bi = body.begin();
+           bi != body.end(); ++bi)
+        {
+          BasicBlock *bb = *bi;
+          if (blocks.count(bb) == 0)
+            continue;
+          std::vector<BasicBlock*> &preds = predecessors[bb];
+          for (std::vector<BasicBlock*>::iterator p = preds.begin();
+               p != preds.end(); ++p)
+            if (*p != entry && blocks.count(*p) == 0)
+              return false;
+          region.blocks.push_back(bb);
+          masked.insert(bb);
+        }
+      regions.push_back(region);
+      regionEntries.insert(entry);
+    }
+  return true;
+}
+
+/* Returns true for the varying instructions that become vector
+   instructions, false for the ones that are scalarized. */
+bool
+WorkitemLoopBody::isWidened(Instruction *I) const
+{
+  if (LoadInst *load = dyn_cast<LoadInst>(I))
+    return load->isSimple() &&
+      shapeOf(load->getPointerOperand()) == SHAPE_CONSECUTIVE &&
+      isVectorizableMemoryType(load->getType());
+
+  if (StoreInst *store = dyn_cast<StoreInst>(I))
+    return store->isSimple() &&
+      shapeOf(store->getPointerOperand()) == SHAPE_CONSECUTIVE &&
+      isVectorizableMemoryType(store->getValueOperand()->getType());
+
+  if (isa<BinaryOperator>(I) || isa<SelectInst>(I))
+    return isVectorizableType(I->getType());
+
+  if (isa<CmpInst>(I))
+    return isVectorizableType(I->getOperand(0)->getType());
+
+  if (CastInst *castInst = dyn_cast<CastInst>(I))
+    return isVectorizableType(castInst->getSrcTy()) &&
+      isVectorizableType(castInst->getDestTy());
+
+  if (CallInst *call = dyn_cast<CallInst>(I))
+    {
+      Function *callee = call->getCalledFunction();
+      if (callee == NULL || !isVectorizableIntrinsic(callee->getIntrinsicID()) ||
+          !call->getType()->isFloatingPointTy() ||
+          !isVectorizableType(call->getType()))
+        return false;
+      for (unsigned i = 0; i < call->getNumArgOperands(); ++i)
+        if (call->getArgOperand(i)->getType() != call->getType())
+          return false;
+      return true;
+    }
+  return false;
+}
+
+/**
+ * Picks the number of work-items per vector from the widest varying
+ * scalar type and the vector register width. Returns false in case
+ * vectorizing does not seem worthwhile.
+ */
+bool
+WorkitemLoopBody::chooseVectorWidth(unsigned localSizeX, unsigned registerWidth)
+{
+  unsigned widest = 8;
+  unsigned widened = 0, scalarized = 0;
+  for (std::map<Value*, ValueShape>::iterator i = shapes.begin();
+       i != shapes.end(); ++i)
+    {
+      if (i->second != SHAPE_VARYING)
+        continue;
+      Instruction *instr = cast<Instruction>(i->first);
+      Type *T = instr->getType();
+      if (StoreInst *store = dyn_cast<StoreInst>(instr))
+        T = store->getValueOperand()->getType();
+      if (isVectorizableType(T))
+        widest = std::max(widest, T->getPrimitiveSizeInBits());
+      if (isWidened(instr))
+        ++widened;
+      else
+        ++scalarized;
+    }
+
+#ifdef DEBUG_WI_LOOP_VECTORIZER
+  std::cerr << "### wiloop-vectorize: " << widened << " widened, "
+            << scalarized << " scalarized, widest type " << widest
+            << " bits" << std::endl;
+#endif
+
+  if (widened == 0 || scalarized > widened)
+    return false;
+
+  VF = std::min(registerWidth / widest, (unsigned)MAX_VECTOR_WIDTH);
+  while (VF > 1 && localSizeX % VF != 0)
+    VF /= 2;
+  return VF > 1;
+}
+
+bool
+WorkitemLoopBody::analyze(unsigned localSizeX, unsigned registerWidth)
+{
+  if (!findBody())
+    return false;
+
+  /* The masked blocks affect the shapes (divisions, writes to context
+     arrays) which in turn affect which branches diverge. Iterate until
+     stable, the set of masked blocks only grows. */
+  for (;;)
+    {
+      if (!analyzeShapes())
+        return false;
+      std::set<BasicBlock*> masked;
+      if (!findDivergentRegions(masked))
+        return false;
+
+      std::set<Value*> maskedArrays;
+      for (std::set<BasicBlock*>::iterator i = masked.begin();
+           i != masked.end(); ++i)
+        for (BasicBlock::iterator ii = (*i)->begin(), ie = (*i)->end();
+             ii != ie; ++ii)
+          if (StoreInst *store = dyn_cast<StoreInst>(ii))
+            if (AllocaInst *array = contextArrayOf(store->getPointerOperand()))
+              maskedArrays.insert(array);
+
+      if (masked == maskedBlocks && maskedArrays == maskedContextArrays)
+        break;
+      maskedBlocks = masked;
+      maskedContextArrays = maskedArrays;
+    }
+
+  return chooseVectorWidth(localSizeX, registerWidth);
+}
+
+/**
+ * Returns the context array in case the pointer is a context array access
+ * of the current work-item ([0][z][y][x] or [0][row + x]), NULL otherwise.
+ * These are known to be in bounds for all the lanes.
+ */
+AllocaInst *
+WorkitemLoopBody::contextArrayOf(Value *ptr) const
+{
+  GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(ptr);
+  if (gep == NULL || (gep->getNumIndices() != 4 && gep->getNumIndices() != 2))
+    return NULL;
+  Value *base = gep->getPointerOperand();
+  /* Context arrays sharing the storage of another one access it through
+     a bitcast. Use the storage to be conservative. */
+  if (BitCastInst *view = dyn_cast<BitCastInst>(base))
+    base = view->getOperand(0);
+  AllocaInst *array = dyn_cast<AllocaInst>(base);
+  if (array == NULL || !array->getName().endswith(".pocl_context"))
+    return NULL;
+  /* In the linear context layout the index is the local id X added to
+     the (padded) row offset. */
+  Value *index = gep->getOperand(gep->getNumIndices());
+  BinaryOperator *rowOffset = dyn_cast<BinaryOperator>(index);
+  if (gep->getNumIndices() == 2 && rowOffset != NULL &&
+      rowOffset->getOpcode() == Instruction::Add)
+    index = rowOffset->getOperand(1);
+  LoadInst *id = dyn_cast<LoadInst>(index);
+  if (id == NULL || id->getPointerOperand() != localIdX)
+    return NULL;
+  return array;
+}
+
+Value *
+WorkitemLoopBody::splat(Value *V)
+{
+  if (Constant *C = dyn_cast<Constant>(V))
+    return ConstantVector::getSplat(VF, C);
+  Type *VT = VectorType::get(V->getType(), VF);
+  Value *first =
+    builder.CreateInsertElement(UndefValue::get(VT), V, builder.getInt32(0));
+  return builder.CreateShuffleVector
+    (first, UndefValue::get(VT),
+     ConstantAggregateZero::get(VectorType::get(builder.getInt32Ty(), VF)));
+}
+
+Value *
+WorkitemLoopBody::buildVector(LaneValues &lanes)
+{
+  Value *vec = UndefValue::get(VectorType::get(lanes[0]->getType(), VF));
+  for (unsigned lane = 0; lane < VF; ++lane)
+    vec = builder.CreateInsertElement(vec, lanes[lane], builder.getInt32(lane));
+  return vec;
+}
+
+Value *
+WorkitemLoopBody::getVector(Value *V)
+{
+  switch (shapeOf(V))
+    {
+    case SHAPE_UNIFORM:
+      return splat(V);
+    case SHAPE_CONSECUTIVE:
+      {
+        assert (V->getType()->isIntegerTy());
+        SmallVector<Constant*, MAX_VECTOR_WIDTH> steps;
+        for (unsigned lane = 0; lane < VF; ++lane)
+          steps.push_back(ConstantInt::get(V->getType(), lane));
+        return builder.CreateAdd(splat(V), ConstantVector::get(steps));
+      }
+    default:
+      break;
+    }
+
+  std::map<Value*, Value*>::iterator v = vectors.find(V);
+  if (v != vectors.end())
+    return v->second;
+
+  /* Do not cache the vector built of the scalarized lanes: the next use
+     might not be dominated by this one. */
+  std::map<Value*, LaneValues>::iterator l = laneValues.find(V);
+  assert (l != laneValues.end() && "Varying value used before vectorized.");
+  return buildVector(l->second);
+}
+
+Value *
+WorkitemLoopBody::getLane(Value *V, unsigned lane)
+{
+  switch (shapeOf(V))
+    {
+    case SHAPE_UNIFORM:
+      return V;
+    case SHAPE_CONSECUTIVE:
+      if (lane == 0)
+        return V;
+      if (V->getType()->isPointerTy())
+        return builder.CreateGEP(V, builder.getInt32(lane));
+      return builder.CreateAdd(V, ConstantInt::get(V->getType(), lane));
+    default:
+      break;
+    }
+
+  std::map<Value*, LaneValues>::iterator l = laneValues.find(V);
+  if (l != laneValues.end())
+    return l->second[lane];
+
+  std::map<Value*, Value*>::iterator v = vectors.find(V);
+  assert (v != vectors.end() && "Varying value used before vectorized.");
+  return builder.CreateExtractElement(v->second, builder.getInt32(lane));
+}
+
+Value *
+WorkitemLoopBody::vectorPointer(Value *ptr, Type *elementType)
+{
+  unsigned AS = cast<PointerType>(ptr->getType())->getAddressSpace();
+  return builder.CreateBitCast
+    (ptr, PointerType::get(VectorType::get(elementType, VF), AS));
+}
+
+unsigned
+WorkitemLoopBody::vectorAlignment(Value *ptr, unsigned alignment,
+                                  Type *elementType)
+{
+  unsigned size = elementType->getPrimitiveSizeInBits() / 8;
+  if (alignment == 0)
+    alignment = size;
+  /* The context arrays are aligned and the first lane of each vector is
+     at a multiple of the vector width. */
+  if (AllocaInst *array = contextArrayOf(ptr))
+    alignment = std::max(alignment, std::min(array->getAlignment(), size * VF));
+  return alignment;
+}
+
+/* Returns the lane mask bits as an integer for testing if any or all of
+   the lanes are active. */
+Value *
+WorkitemLoopBody::laneBits(Value *mask)
+{
+  Value *bytes =
+    builder.CreateSExt(mask, VectorType::get(builder.getInt8Ty(), VF));
+  return builder.CreateBitCast
+    (bytes, IntegerType::get(F.getContext(), 8 * VF));
+}
+
+/**
+ * Splits the current block at the builder's insertion point to a
+ * conditionally executed part. Returns the block where the control
+ * joins. The builder is left to point to the same instruction, now in
+ * the join block.
+ */
+BasicBlock *
+WorkitemLoopBody::splitBlock(Value *cond, BasicBlock *&thenBB,
+                             BasicBlock **elseBB)
+{
+  LLVMContext &C = F.getContext();
+  BasicBlock *head = builder.GetInsertBlock();
+  BasicBlock *tail =
+    head->splitBasicBlock(builder.GetInsertPoint(), "wiloop_vec.join");
+
+  thenBB = BasicBlock::Create(C, "wiloop_vec.then", &F, tail);
+  BranchInst::Create(tail, thenBB);
+  BasicBlock *falseBB = tail;
+  if (elseBB != NULL)
+    {
+      *elseBB = BasicBlock::Create(C, "wiloop_vec.else", &F, tail);
+      BranchInst::Create(tail, *elseBB);
+      falseBB = *elseBB;
+    }
+  head->getTerminator()->eraseFromParent();
+  BranchInst::Create(thenBB, falseBB, cond, head);
+
+  builder.SetInsertPoint(tail, tail->begin());
+  return tail;
+}
+
+/**
+ * Executes the instruction separately for each lane. In case the
+ * instruction has side effects or might trap, it is executed only for
+ * the lanes active in the mask.
+ */
+void
+WorkitemLoopBody::scalarize(Instruction *I, Value *mask, LaneValues &results)
+{
+  bool predicated = mask != NULL && needsPredication(I);
+  for (unsigned lane = 0; lane < VF; ++lane)
+    {
+      BasicBlock *head = builder.GetInsertBlock();
+      BasicBlock *laneBB = NULL;
+      BasicBlock *tail = NULL;
+      if (predicated)
+        {
+          Value *active =
+            builder.CreateExtractElement(mask, builder.getInt32(lane));
+          tail = splitBlock(active, laneBB, NULL);
+          builder.SetInsertPoint(laneBB->getTerminator());
+        }
+
+      Instruction *clone = I->clone();
+      for (unsigned i = 0; i < I->getNumOperands(); ++i)
+        clone->setOperand(i, getLane(I->getOperand(i), lane));
+      builder.Insert(clone);
+      Value *result = clone;
+
+      if (predicated)
+        {
+          builder.SetInsertPoint(tail, tail->begin());
+          if (!I->getType()->isVoidTy())
+            {
+              PHINode *phi = builder.CreatePHI(I->getType(), 2);
+              phi->addIncoming(clone, laneBB);
+              phi->addIncoming(UndefValue::get(I->getType()), head);
+              result = phi;
+            }
+          builder.SetInsertPoint(tail, tail->getFirstInsertionPt());
+        }
+      results.push_back(result);
+    }
+}
+
+bool
+WorkitemLoopBody::needsPredication(Instruction *I) const
+{
+  return I->mayHaveSideEffects() || I->mayReadFromMemory() || isDivRem(I);
+}
+
+/**
+ * Executes a uniform instruction in a masked block only in case any of
+ * the lanes are active. Needed for loads which might access an invalid
+ * address otherwise.
+ */
+void
+WorkitemLoopBody::guardUniform(Instruction *I, Value *mask)
+{
+  BasicBlock *head = builder.GetInsertBlock();
+  Value *any = builder.CreateICmpNE
+    (laneBits(mask), ConstantInt::get(F.getContext(), APInt(8 * VF, 0)));
+  BasicBlock *thenBB = NULL;
+  BasicBlock *tail = splitBlock(any, thenBB, NULL);
+  I->moveBefore(thenBB->getTerminator());
+  if (!I->getType()->isVoidTy())
+    {
+      PHINode *phi = PHINode::Create(I->getType(), 2, "", &tail->front());
+      I->replaceAllUsesWith(phi);
+      phi->addIncoming(I, thenBB);
+      phi->addIncoming(UndefValue::get(I->getType()), head);
+    }
+  builder.SetInsertPoint(tail, tail->getFirstInsertionPt());
+}
+
+void
+WorkitemLoopBody::vectorizeLoad(LoadInst *load, Value *mask)
+{
+  Value *ptr = load->getPointerOperand();
+  Type *T = load->getType();
+  if (!isWidened(load))
+    {
+      scalarize(load, mask, laneValues[load]);
+      return;
+    }
+
+  Value *vptr = vectorPointer(ptr, T);
+  unsigned alignment = vectorAlignment(ptr, load->getAlignment(), T);
+  if (mask == NULL || contextArrayOf(ptr) != NULL)
+    {
+      LoadInst *vload = builder.CreateLoad(vptr, load->getName());
+      vload->setAlignment(alignment);
+      vectors[load] = vload;
+      return;
+    }
+
+  /* Load the whole vector in case all the lanes are active, otherwise
+     only the elements of the active lanes. */
+  Value *all = builder.CreateICmpEQ
+    (laneBits(mask), ConstantInt::get(F.getContext(), APInt::getAllOnesValue(8 * VF)));
+  BasicBlock *vectorBB = NULL, *laneBB = NULL;
+  BasicBlock *tail = splitBlock(all, vectorBB, &laneBB);
+
+  builder.SetInsertPoint(vectorBB->getTerminator());
+  LoadInst *vload = builder.CreateLoad(vptr, load->getName());
+  vload->setAlignment(alignment);
+
+  builder.SetInsertPoint(laneBB->getTerminator());
+  LaneValues lanes;
+  scalarize(load, mask, lanes);
+  Value *partial = buildVector(lanes);
+  BasicBlock *laneEndBB = builder.GetInsertBlock();
+
+  builder.SetInsertPoint(tail, tail->begin());
+  PHINode *phi = builder.CreatePHI(vload->getType(), 2);
+  phi->addIncoming(vload, vectorBB);
+  phi->addIncoming(partial, laneEndBB);
+  builder.SetInsertPoint(tail, tail->getFirstInsertionPt());
+  vectors[load] = phi;
+}
+
+void
+WorkitemLoopBody::vectorizeStore(StoreInst *store, Value *mask)
+{
+  Value *ptr = store->getPointerOperand();
+  Value *val = store->getValueOperand();
+  Type *T = val->getType();
+
+  if (shapeOf(store) == SHAPE_UNIFORM)
+    {
+      if (mask != NULL)
+        guardUniform(store, mask);
+      return;
+    }
+  replaced.push_back(store);
+
+  if (!isWidened(store))
+    {
+      LaneValues dummy;
+      if (mask == NULL && store->isSimple() &&
+          shapeOf(ptr) == SHAPE_UNIFORM)
+        {
+          /* All the work-items store to the same location, the last one
+             wins. */
+          StoreInst *last = cast<StoreInst>(store->clone());
+          last->setOperand(0, getLane(val, VF - 1));
+          builder.Insert(last);
+        }
+      else
+        scalarize(store, mask, dummy);
+      return;
+    }
+
+  Value *vec = getVector(val);
+  Value *vptr = vectorPointer(ptr, T);
+  unsigned alignment = vectorAlignment(ptr, store->getAlignment(), T);
+  if (mask == NULL)
+    {
+      builder.CreateStore(vec, vptr)->setAlignment(alignment);
+      return;
+    }
+
+  if (contextArrayOf(ptr) != NULL)
+    {
+      /* The context array slots of the inactive lanes can be safely
+         rewritten with their old contents. */
+      LoadInst *old = builder.CreateLoad(vptr);
+      old->setAlignment(alignment);
+      builder.CreateStore
+        (builder.CreateSelect(mask, vec, old), vptr)->setAlignment(alignment);
+      return;
+    }
+
+  Value *all = builder.CreateICmpEQ
+    (laneBits(mask), ConstantInt::get(F.getContext(), APInt::getAllOnesValue(8 * VF)));
+  BasicBlock *vectorBB = NULL, *laneBB = NULL;
+  BasicBlock *tail = splitBlock(all, vectorBB, &laneBB);
+
+  builder.SetInsertPoint(vectorBB->getTerminator());
+  builder.CreateStore(vec, vptr)->setAlignment(alignment);
+
+  builder.SetInsertPoint(laneBB->getTerminator());
+  LaneValues dummy;
+  scalarize(store, mask, dummy);
+
+  builder.SetInsertPoint(tail, tail->getFirstInsertionPt());
+}
+
+bool
+WorkitemLoopBody::vectorizeCall(CallInst *call)
+{
+  if (!isWidened(call))
+    return false;
+  SmallVector<Value*, 4> args;
+  for (unsigned i = 0; i < call->getNumArgOperands(); ++i)
+    args.push_back(getVector(call->getArgOperand(i)));
+  Function *vectorIntrinsic =
+    Intrinsic::getDeclaration
+    (F.getParent(), (Intrinsic::ID)call->getCalledFunction()->getIntrinsicID(),
+     VectorType::get(call->getType(), VF));
+  vectors[call] = builder.CreateCall(vectorIntrinsic, args, call->getName());
+  return true;
+}
+
+void
+WorkitemLoopBody::vectorizeInstruction(Instruction *I, Value *mask)
+{
+  if (StoreInst *store = dyn_cast<StoreInst>(I))
+    {
+      vectorizeStore(store, mask);
+      return;
+    }
+
+  ValueShape shape = shapeOf(I);
+  if (shape == SHAPE_UNIFORM)
+    {
+      LoadInst *load = dyn_cast<LoadInst>(I);
+      if (mask != NULL && load != NULL &&
+          !isa<GlobalVariable>(load->getPointerOperand()) &&
+          contextArrayOf(load->getPointerOperand()) == NULL)
+        guardUniform(I, mask);
+      return;
+    }
+  /* The consecutive values are kept as the value of the first lane. */
+  if (shape == SHAPE_CONSECUTIVE)
+    return;
+
+  replaced.push_back(I);
+
+  if (LoadInst *load = dyn_cast<LoadInst>(I))
+    {
+      vectorizeLoad(load, mask);
+      return;
+    }
+
+  if (CallInst *call = dyn_cast<CallInst>(I))
+    {
+      if (!vectorizeCall(call))
+        scalarize(I, mask, laneValues[I]);
+      return;
+    }
+
+  if (!isWidened(I))
+    {
+      scalarize(I, mask, laneValues[I]);
+      return;
+    }
+
+  Value *result = NULL;
+  if (BinaryOperator *binop = dyn_cast<BinaryOperator>(I))
+    {
+      Value *a = getVector(binop->getOperand(0));
+      Value *b = getVector(binop->getOperand(1));
+      /* Divide the inactive lanes by one to avoid trapping. */
+      if (mask != NULL && isDivRem(binop))
+        b = builder.CreateSelect
+          (mask, b, splat(ConstantInt::get(binop->getType(), 1)));
+      result = builder.CreateBinOp(binop->getOpcode(), a, b);
+    }
+  else if (CmpInst *cmp = dyn_cast<CmpInst>(I))
+    {
+      Value *a = getVector(cmp->getOperand(0));
+      Value *b = getVector(cmp->getOperand(1));
+      if (isa<ICmpInst>(cmp))
+        result = builder.CreateICmp(cmp->getPredicate(), a, b);
+      else
+        result = builder.CreateFCmp(cmp->getPredicate(), a, b);
+    }
+  else if (SelectInst *select = dyn_cast<SelectInst>(I))
+    {
+      Value *cond = select->getCondition();
+      if (shapeOf(cond) != SHAPE_UNIFORM)
+        cond = getVector(cond);
+      result = builder.CreateSelect
+        (cond, getVector(select->getTrueValue()),
+         getVector(select->getFalseValue()));
+    }
+  else
+    {
+      CastInst *castInst = dyn_cast<CastInst>(I);
+      result = builder.CreateCast
+        (castInst->getOpcode(), getVector(castInst->getOperand(0)),
+         VectorType::get(castInst->getDestTy(), VF));
+    }
+  result->setName(I->getName());
+  vectors[I] = result;
+}
+
+void
+WorkitemLoopBody::computeBlockMask(BasicBlock *BB)
+{
+  builder.SetInsertPoint(BB, BB->getFirstInsertionPt());
+  Value *mask = NULL;
+  std::vector<BasicBlock*> &preds = predecessors[BB];
+  for (std::vector<BasicBlock*>::iterator i = preds.begin(); i != preds.end();
+       ++i)
+    {
+      Value *edge = edgeMasks[std::make_pair(*i, BB)];
+      assert (edge != NULL);
+      mask = mask == NULL ? edge : builder.CreateOr(mask, edge);
+    }
+  blockMasks[BB] = mask;
+}
+
+void
+WorkitemLoopBody::computeEdgeMasks(BasicBlock *BB)
+{
+  BranchInst *br = cast<BranchInst>(terminators[BB]);
+  Value *mask = maskedBlocks.count(BB) ? blockMasks[BB] : NULL;
+  builder.SetInsertPoint(br);
+  if (br->isUnconditional() || br->getSuccessor(0) == br->getSuccessor(1))
+    {
+      if (mask == NULL)
+        mask = ConstantVector::getSplat(VF, builder.getTrue());
+      for (unsigned s = 0; s < br->getNumSuccessors(); ++s)
+        edgeMasks[std::make_pair(BB, br->getSuccessor(s))] = mask;
+      return;
+    }
+  Value *cond = getVector(br->getCondition());
+  Value *notCond = builder.CreateNot(cond);
+  if (mask != NULL)
+    {
+      cond = builder.CreateAnd(mask, cond);
+      notCond = builder.CreateAnd(mask, notCond);
+    }
+  edgeMasks[std::make_pair(BB, br->getSuccessor(0))] = cond;
+  edgeMasks[std::make_pair(BB, br->getSuccessor(1))] = notCond;
+}
+
+/**
+ * Chains the blocks of the region to execute unconditionally in reverse
+ * post order.
+ */
+void
+WorkitemLoopBody::linearize(DivergentRegion &region)
+{
+  BasicBlock *from = region.entry;
+  for (unsigned i = 0; i <= region.blocks.size(); ++i)
+    {
+      BasicBlock *to =
+        i < region.blocks.size() ? region.blocks[i] : region.join;
+      TerminatorInst *t = terminators[from];
+      BranchInst::Create(to, t);
+      t->eraseFromParent();
+      from = to;
+    }
+}
+
+void
+WorkitemLoopBody::vectorize()
+{
+  for (std::vector<BasicBlock*>::iterator i = body.begin(); i != body.end();
+       ++i)
+    {
+      BasicBlock *bb = *i;
+      Value *mask = NULL;
+      if (maskedBlocks.count(bb))
+        {
+          computeBlockMask(bb);
+          mask = blockMasks[bb];
+        }
+
+      /* The block is split while vectorizing, collect the original
+         instructions first. */
+      std::vector<Instruction*> instructions;
+      for (BasicBlock::iterator ii = bb->begin(), ie = bb->end(); ii != ie;
+           ++ii)
+        if (!isa<TerminatorInst>(ii))
+          instructions.push_back(ii);
+
+      for (std::vector<Instruction*>::iterator ii = instructions.begin();
+           ii != instructions.end(); ++ii)
+        {
+          if (shapes.count(*ii) == 0)
+            continue;
+          builder.SetInsertPoint(*ii);
+          vectorizeInstruction(*ii, mask);
+        }
+
+      if (maskedBlocks.count(bb) || regionEntries.count(bb))
+        computeEdgeMasks(bb);
+    }
+
+  for (std::vector<DivergentRegion>::iterator i = regions.begin();
+       i != regions.end(); ++i)
+    linearize(*i);
+
+  /* Proceed a vector of work-items per iteration. */
+  increment->setOperand(1, ConstantInt::get(increment->getType(), VF));
+
+  for (std::vector<Instruction*>::iterator i = replaced.begin();
+       i != replaced.end(); ++i)
+    (*i)->dropAllReferences();
+  for (std::vector<Instruction*>::iterator i = replaced.begin();
+       i != replaced.end(); ++i)
+    {
+      Instruction *instr = *i;
+      if (!instr->use_empty())
+        instr->replaceAllUsesWith(UndefValue::get(instr->getType()));
+      instr->eraseFromParent();
+    }
+}
+
+}
+
+void
+WorkitemLoopVectorizer::getAnalysisUsage(AnalysisUsage &AU) const
+{
+  AU.addRequired<PostDominatorTree>();
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  AU.addRequired<DominatorTree>();
+#else
+  AU.addRequired<DominatorTreeWrapperPass>();
+#endif
+  AU.addRequired<LoopInfo>();
+#ifndef LLVM_3_2
+  AU.addRequired<TargetTransformInfo>();
+#endif
+
+  AU.addRequired<VariableUniformityAnalysis>();
+
+  AU.addRequired<pocl::WorkitemHandlerChooser>();
+  AU.addPreserved<pocl::WorkitemHandlerChooser>();
+}
+
+/**
+ * Returns true in case the loop is a dimension 0 work-item loop created
+ * by WorkitemLoops::CreateLoopAround.
+ */
+bool
+WorkitemLoopVectorizer::isWorkitemLoop(Loop *L)
+{
+  BasicBlock *latch = L->getLoopLatch();
+  if (latch == NULL)
+    return false;
+  BranchInst *br = dyn_cast<BranchInst>(latch->getTerminator());
+  if (br == NULL || !br->isConditional() ||
+      br->getSuccessor(0) != L->getHeader())
+    return false;
+  ICmpInst *cmp = dyn_cast<ICmpInst>(br->getCondition());
+  if (cmp == NULL || cmp->getPredicate() != ICmpInst::ICMP_ULT)
+    return false;
+  LoadInst *id = dyn_cast<LoadInst>(cmp->getOperand(0));
+  ConstantInt *size = dyn_cast<ConstantInt>(cmp->getOperand(1));
+  return id != NULL && id->getPointerOperand() == localIdX &&
+    size != NULL && size->getZExtValue() == (uint64_t)LocalSizeX;
+}
+
+void
+WorkitemLoopVectorizer::findWorkitemLoops(Loop *L, std::vector<Loop*> &loops)
+{
+  if (isWorkitemLoop(L))
+    loops.push_back(L);
+  for (Loop::iterator i = L->begin(), e = L->end(); i != e; ++i)
+    findWorkitemLoops(*i, loops);
+}
+
+bool
+WorkitemLoopVectorizer::runOnFunction(Function &F)
+{
+  if (!Workgroup::isKernelToProcess(F))
+    return false;
+
+  if (getAnalysis<pocl::WorkitemHandlerChooser>().chosenHandler() !=
+      pocl::WorkitemHandlerChooser::POCL_WIH_LOOPS)
+    return false;
+
+#ifdef LLVM_3_2
+  /* The vector register width is not available via TTI. */
+  return false;
+#else
+  Initialize(cast<Kernel>(&F));
+
+  if (LocalSizeX < 2)
+    return false;
+  unsigned registerWidth =
+    getAnalysis<TargetTransformInfo>().getRegisterBitWidth(true);
+
+  LoopInfo &LI = getAnalysis<LoopInfo>();
+  PostDominatorTree &PDT = getAnalysis<PostDominatorTree>();
+  VariableUniformityAnalysis &VUA = getAnalysis<VariableUniformityAnalysis>();
+
+  /* The headers of the loops already analyzed. The blocks split by the
+     vectorization of a loop invalidate the loop info and the dominator
+     trees, thus they are recomputed and the loops searched again after
+     each vectorized loop. */
+  std::set<BasicBlock*> analyzed;
+  bool changed = false, vectorized;
+  do
+    {
+      std::vector<Loop*> loops;
+      for (LoopInfo::iterator i = LI.begin(), e = LI.end(); i != e; ++i)
+        findWorkitemLoops(*i, loops);
+
+      vectorized = false;
+      for (std::vector<Loop*>::iterator i = loops.begin();
+           i != loops.end() && !vectorized; ++i)
+        {
+          if (!analyzed.insert((*i)->getHeader()).second)
+            continue;
+          WorkitemLoopBody loop(F, *i, &LI, &PDT, VUA, localIdX, localIdY,
+                                localIdZ);
+          if (!loop.analyze(LocalSizeX, registerWidth))
+            continue;
+#ifdef DEBUG_WI_LOOP_VECTORIZER
+          std::cerr << "### wiloop-vectorize: vectorizing a loop of "
+                    << F.getName().str() << " by " << loop.vectorWidth()
+                    << std::endl;
+#endif
+          loop.vectorize();
+          changed = vectorized = true;
+        }
+
+      if (vectorized)
+        {
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+          getAnalysis<DominatorTree>().runOnFunction(F);
+#else
+          getAnalysis<DominatorTreeWrapperPass>().runOnFunction(F);
+#endif
+          LI.runOnFunction(F);
+          PDT.runOnFunction(F);
+        }
+    }
+  while (vectorized);
+  return changed;
+#endif
+}
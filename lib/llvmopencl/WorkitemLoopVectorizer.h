@@ -0,0 +1,67 @@
+// Header for WorkitemLoopVectorizer, an explicit cross-work-item
+// vectorizer for the work-item loops.
+//
+// Copyright (c) 2014 Tampere University of Technology
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _POCL_WORKITEM_LOOP_VECTORIZER_H
+#define _POCL_WORKITEM_LOOP_VECTORIZER_H
+
+#include "WorkitemHandler.h"
+
+#include <vector>
+
+namespace llvm {
+  class Loop;
+}
+
+namespace pocl {
+
+  /**
+   * Vectorizes the innermost (dimension 0) work-item loops produced by
+   * WorkitemLoops across the work-items.
+   *
+   * Instead of relying on the generic LLVM loop vectorizer to rediscover
+   * the parallelism, the work-item loop is known to be parallel and its
+   * work-item variance is known from VariableUniformityAnalysis. Each
+   * value in the loop is classified as uniform (kept scalar), consecutive
+   * (the local id and values affine to it, kept as the scalar of the first
+   * lane) or varying (widened to a vector or scalarized per lane).
+   * Diverging branches are if-converted with lane masks.
+   *
+   * Loops the pass cannot handle are left untouched for the generic
+   * LLVM vectorizers.
+   */
+  class WorkitemLoopVectorizer : public pocl::WorkitemHandler {
+  public:
+    static char ID;
+
+    WorkitemLoopVectorizer() : pocl::WorkitemHandler(ID) {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+    virtual bool runOnFunction(llvm::Function &F);
+
+  private:
+    bool isWorkitemLoop(llvm::Loop *L);
+    void findWorkitemLoops(llvm::Loop *L, std::vector<llvm::Loop*> &loops);
+  };
+}
+
+#endif
@@ -32,6 +32,7 @@
 
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Support/CommandLine.h"
 #ifdef LLVM_3_1
 #include "llvm/Support/IRBuilder.h"
@@ -60,8 +61,10 @@
 
 #include "WorkitemHandlerChooser.h"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <set>
 #include <sstream>
 #include <vector>
 
@@ -86,6 +89,16 @@ namespace {
 
 char WorkitemLoops::ID = 0;
 
+static cl::opt<bool>
+ShareContextStorage("wiloops-share-context", cl::init(true), cl::Hidden,
+  cl::desc("Share the context arrays of variables with disjoint lifetimes."));
+
+STATISTIC(ContextArrays, "Number of context arrays created");
+STATISTIC(SharedContextArrays,
+          "Number of context arrays merged to the storage of another one");
+STATISTIC(CompactedContextArrays,
+          "Number of context arrays narrowed to a smaller integer type");
+
 void
 WorkitemLoops::getAnalysisUsage(AnalysisUsage &AU) const
 {
@@ -129,6 +142,14 @@ WorkitemLoops::runOnFunction(Function &F)
   #endif
   LI = &getAnalysis<LoopInfo>();
   PDT = &getAnalysis<PostDominatorTree>();
+  linearContextLayout = 
+    getKernelOption("POCL_WILOOPS_LINEAR_CONTEXT") != NULL &&
+    atoi(getKernelOption("POCL_WILOOPS_LINEAR_CONTEXT")) == 1;
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  DL = &getAnalysis<DataLayout>();
+#else
+  DL = &getAnalysis<DataLayoutPass>().getDataLayout();
+#endif
 
   tempInstructionIndex = 0;
 
@@ -158,6 +179,8 @@ WorkitemLoops::runOnFunction(Function &F)
   F.viewCFG();
 #endif
   contextArrays.clear();
+  compactedContextArrays.clear();
+  contextIndices.clear();
   tempInstructionIds.clear();
 
   return changed;
@@ -214,9 +237,10 @@ WorkitemLoops::CreateLoopAround
 
     for.end:
 
-    OPTIMIZE: Use a separate iteration variable across all the loops to iterate the context 
-    data arrays to avoid needing multiplications to find the correct location, and to 
-    enable easy vectorization of loading the context data when there are parallel iterations.
+    The context data arrays are indexed with the local ids, or in the linear
+    context layout (POCL_WILOOPS_LINEAR_CONTEXT=1) with a single index that
+    increases with the local id x and has the row offset hoistable out of the
+    innermost loop. See AddContextArrayIndices().
   */     
 
   llvm::BasicBlock *loopBodyEntryBB = entryBB;
@@ -358,6 +382,17 @@ WorkitemLoops::ProcessFunction(Function &F)
   Initialize(K);
   unsigned workItemCount = LocalSizeX*LocalSizeY*LocalSizeZ;
 
+  /* Pad the context array rows in the linear layout to a multiple of
+     the SIMD width (up to 16 work-items) so each row starts at an
+     aligned address for any vector width dividing the local size X. */
+  contextRowLength = LocalSizeX;
+  if (LocalSizeY * LocalSizeZ > 1)
+    {
+      size_t padding = 1;
+      while (padding < LocalSizeX && padding < 16) padding *= 2;
+      contextRowLength = (LocalSizeX + padding - 1) / padding * padding;
+    }
+
   if (workItemCount == 1)
     {
       K->addLocalSizeInitCode(LocalSizeX, LocalSizeY, LocalSizeZ);
@@ -416,6 +451,13 @@ WorkitemLoops::ProcessFunction(Function &F)
     entryCounts[region->entryBB()]++;
   }
 
+  /* The context save/restore code is now in place but the work-item
+     loops are not yet created, thus the CFG still describes the execution
+     of a single work-item. Use it to find context arrays that can share
+     their storage. */
+  if (ShareContextStorage)
+    ShareContextArrays(F);
+
 #if 0
   std::cerr << "### After context code addition:" << std::endl;
   F.viewCFG();
@@ -485,8 +527,8 @@ WorkitemLoops::ProcessFunction(Function &F)
           }
 
         int unrollCount;
-        if (getenv("POCL_WILOOPS_MAX_UNROLL_COUNT") != NULL)
-            unrollCount = atoi(getenv("POCL_WILOOPS_MAX_UNROLL_COUNT"));
+        if (getKernelOption("POCL_WILOOPS_MAX_UNROLL_COUNT") != NULL)
+            unrollCount = atoi(getKernelOption("POCL_WILOOPS_MAX_UNROLL_COUNT"));
         else
             unrollCount = 1;
         /* Find a two's exponent unroll count, if available. */
@@ -693,11 +735,17 @@ WorkitemLoops::AddContextSave
   assert ("Adding context save outside any region produces illegal code." && 
           region != NULL);
 
-  gepArgs.push_back(region->LocalIDZLoad());
-  gepArgs.push_back(region->LocalIDYLoad());
-  gepArgs.push_back(region->LocalIDXLoad());
+  AddContextArrayIndices(region, gepArgs);
 
-  return builder.CreateStore(instruction, builder.CreateGEP(alloca, gepArgs));
+  llvm::Value *gep = builder.CreateGEP(alloca, gepArgs);
+  llvm::Value *savedValue = instruction;
+  if (compactedContextArrays.find(alloca) != compactedContextArrays.end())
+    {
+      /* The array stores only the significant bits of the value. */
+      savedValue = builder.CreateTrunc
+        (instruction, cast<PointerType>(gep->getType())->getElementType());
+    }
+  return builder.CreateStore(savedValue, gep);
 }
 
 llvm::Instruction *
@@ -732,10 +780,7 @@ WorkitemLoops::AddContextRestore
   assert ("Adding context save outside any region produces illegal code." && 
           region != NULL);
 
-  gepArgs.push_back(region->LocalIDZLoad());
-  gepArgs.push_back(region->LocalIDYLoad());
-  gepArgs.push_back(region->LocalIDXLoad());
-
+  AddContextArrayIndices(region, gepArgs);
 
   llvm::Instruction *gep = 
     dyn_cast<Instruction>(builder.CreateGEP(alloca, gepArgs));
@@ -786,6 +831,8 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
   IRBuilder<> builder(instruction->getParent()->getParent()->getEntryBlock().getFirstInsertionPt());
 
   llvm::Type *elementType;
+  llvm::Type *compactType = NULL;
+  bool isSigned = false;
   if (isa<AllocaInst>(instruction))
     {
       /* If the variable to be context saved was itself an alloca,
@@ -802,15 +849,28 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
   else 
     {
       elementType = instruction->getType();
+      compactType = CompactContextType(instruction, isSigned);
+      if (compactType != NULL) 
+        elementType = compactType;
     }
 
-  /* 3D context array. */
-  llvm::Type *contextArrayType = 
-    ArrayType::get(
+  llvm::Type *contextArrayType;
+  if (linearContextLayout)
+    {
+      /* Linear context array with padded rows. */
+      contextArrayType = 
+        ArrayType::get(elementType, contextRowLength * LocalSizeY * LocalSizeZ);
+    }
+  else
+    {
+      /* 3D context array. */
+      contextArrayType = 
         ArrayType::get(
             ArrayType::get(
-                elementType, LocalSizeX), 
-            LocalSizeY), LocalSizeZ);
+                ArrayType::get(
+                    elementType, LocalSizeX), 
+                LocalSizeY), LocalSizeZ);
+    }
 
   /* Allocate the context data array for the variable. */
   llvm::AllocaInst *alloca = 
@@ -821,10 +881,370 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
      size. */
   alloca->setAlignment(CONTEXT_ARRAY_ALIGN);
 
+  if (compactType != NULL)
+    {
+      compactedContextArrays[alloca] = isSigned;
+      ++CompactedContextArrays;
+    }
+  ++ContextArrays;
+
   contextArrays[varName] = alloca;
   return alloca;
 }
 
+/**
+ * Adds the indices of the current work-item's element in the context
+ * arrays.
+ *
+ * In the linear context layout the element is found with a single
+ * index computed once in the beginning of the region. It is the local
+ * id X plus a row offset that is invariant in the innermost work-item
+ * loop, thus the context data of consecutive work-items is accessed
+ * with consecutive addresses without per-access multiplications.
+ */
+void
+WorkitemLoops::AddContextArrayIndices
+(ParallelRegion *region, std::vector<llvm::Value *> &gepArgs)
+{
+  if (!linearContextLayout)
+    {
+      gepArgs.push_back(region->LocalIDZLoad());
+      gepArgs.push_back(region->LocalIDYLoad());
+      gepArgs.push_back(region->LocalIDXLoad());
+      return;
+    }
+
+  std::map<ParallelRegion*, llvm::Value*>::iterator cached =
+    contextIndices.find(region);
+  if (cached != contextIndices.end())
+    {
+      gepArgs.push_back(cached->second);
+      return;
+    }
+
+  llvm::Instruction *localIdZLoad = region->LocalIDZLoad();
+  llvm::Instruction *localIdYLoad = region->LocalIDYLoad();
+  llvm::Instruction *localIdXLoad = region->LocalIDXLoad();
+
+  /* Compute the index after all the id loads. */
+  llvm::BasicBlock *entry = region->entryBB();
+  llvm::BasicBlock::iterator insertPoint = entry->getFirstInsertionPt();
+  for (llvm::BasicBlock::iterator i = entry->begin(); i != entry->end(); ++i)
+    {
+      llvm::Instruction *instr = i;
+      if (instr == localIdZLoad || instr == localIdYLoad ||
+          instr == localIdXLoad)
+        {
+          insertPoint = i;
+          ++insertPoint;
+        }
+    }
+
+  IRBuilder<> builder(insertPoint);
+  llvm::Type *sizeT = IntegerType::get(entry->getContext(), size_t_width);
+  llvm::Value *index = localIdXLoad;
+  if (LocalSizeY * LocalSizeZ > 1)
+    {
+      llvm::Value *row = localIdYLoad;
+      if (LocalSizeZ > 1)
+        row = builder.CreateAdd
+          (builder.CreateMul
+           (localIdZLoad, ConstantInt::get(sizeT, LocalSizeY)), row);
+      index = builder.CreateAdd
+        (builder.CreateMul
+         (row, ConstantInt::get(sizeT, contextRowLength)), localIdXLoad,
+         "context_index");
+    }
+  contextIndices[region] = index;
+  gepArgs.push_back(index);
+}
+
+/**
+ * Returns a narrower integer type that can hold all the possible values
+ * of the given instruction, or NULL if its context array cannot be
+ * compacted.
+ *
+ * Sets isSigned in case the narrowed value must be sign extended back
+ * to the original width when restored.
+ */
+llvm::Type *
+WorkitemLoops::CompactContextType
+(llvm::Instruction *instruction, bool &isSigned)
+{
+  llvm::IntegerType *type = dyn_cast<IntegerType>(instruction->getType());
+  if (type == NULL || type->getBitWidth() <= 8) return NULL;
+
+  unsigned bitWidth = type->getBitWidth();
+  APInt knownZero(bitWidth, 0), knownOne(bitWidth, 0);
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  ComputeMaskedBits(instruction, knownZero, knownOne, DL);
+#else
+  computeKnownBits(instruction, knownZero, knownOne, DL);
+#endif
+
+  /* The number of bits needed to restore the value with a zero and
+     a sign extension, respectively. */
+  unsigned unsignedBits = bitWidth - knownZero.countLeadingOnes();
+  unsigned signedBits = bitWidth - ComputeNumSignBits(instruction, DL) + 1;
+
+  for (unsigned width = 8; width < bitWidth; width *= 2)
+    {
+      if (unsignedBits <= width || signedBits <= width)
+        {
+          isSigned = unsignedBits > width;
+          return IntegerType::get(instruction->getContext(), width);
+        }
+    }
+  return NULL;
+}
+
+namespace {
+
+/**
+ * The accesses to a context array from the point of view of a single
+ * work-item, used for computing the liveness of its context slot.
+ */
+struct ContextArrayAccesses
+{
+  llvm::AllocaInst *array;
+  uint64_t size;
+  /* The size of the slot of a work-item. */
+  uint64_t elementSize;
+  std::set<llvm::Instruction*> loads;
+  std::set<llvm::Instruction*> stores;
+  /* The blocks at the end of which the slot holds a value that is
+     still going to be loaded. */
+  std::set<llvm::BasicBlock*> liveOut;
+};
+
+bool
+largerContextArray(const ContextArrayAccesses *a, const ContextArrayAccesses *b)
+{
+  return a->size > b->size;
+}
+
+/**
+ * Collects the loads and stores of the context array. Returns false if
+ * the array is accessed in some other way, e.g. its address escapes, in
+ * which case its lifetime cannot be analyzed.
+ */
+bool
+collectContextArrayAccesses(ContextArrayAccesses &accesses)
+{
+  llvm::AllocaInst *array = accesses.array;
+  llvm::Type *elementType = array->getAllocatedType();
+  while (isa<ArrayType>(elementType))
+    elementType = elementType->getArrayElementType();
+
+  for (Instruction::use_iterator ui = array->use_begin(),
+         ue = array->use_end();
+       ui != ue; ++ui) 
+    {
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+      GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(*ui);
+#else
+      GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(ui->getUser());
+#endif
+      if (gep == NULL || gep->getPointerOperand() != array ||
+          gep->getType()->getPointerElementType() != elementType)
+        return false;
+
+      for (Instruction::use_iterator gi = gep->use_begin(),
+             ge = gep->use_end();
+           gi != ge; ++gi) 
+        {
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+          llvm::Instruction *user = dyn_cast<Instruction>(*gi);
+#else
+          llvm::Instruction *user = dyn_cast<Instruction>(gi->getUser());
+#endif
+          LoadInst *load = dyn_cast_or_null<LoadInst>(user);
+          StoreInst *store = dyn_cast_or_null<StoreInst>(user);
+          if (load != NULL && load->isSimple())
+            accesses.loads.insert(load);
+          else if (store != NULL && store->isSimple() &&
+                   store->getPointerOperand() == gep)
+            accesses.stores.insert(store);
+          else
+            return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * Computes the blocks where the context slot of a work-item is live at
+ * the exit. The slot is live when there is a path to a load of it
+ * without an intervening store.
+ */
+void
+computeContextArrayLiveness(ContextArrayAccesses &accesses)
+{
+  /* Classify the blocks by their first access to the array: a load
+     makes the slot live at the block entry, a store kills it. */
+  std::set<llvm::BasicBlock*> liveIn, killed;
+  std::set<llvm::BasicBlock*> accessed;
+  for (std::set<llvm::Instruction*>::iterator i = accesses.loads.begin(),
+         e = accesses.loads.end(); i != e; ++i)
+    accessed.insert((*i)->getParent());
+  for (std::set<llvm::Instruction*>::iterator i = accesses.stores.begin(),
+         e = accesses.stores.end(); i != e; ++i)
+    accessed.insert((*i)->getParent());
+
+  for (std::set<llvm::BasicBlock*>::iterator i = accessed.begin(),
+         e = accessed.end(); i != e; ++i)
+    {
+      llvm::BasicBlock *bb = *i;
+      for (llvm::BasicBlock::iterator instr = bb->begin();
+           instr != bb->end(); ++instr) 
+        {
+          llvm::Instruction *instruction = instr;
+          if (accesses.loads.count(instruction))
+            {
+              liveIn.insert(bb);
+              break;
+            }
+          if (accesses.stores.count(instruction))
+            {
+              killed.insert(bb);
+              break;
+            }
+        }
+    }
+
+  /* Propagate the liveness backwards until the killing stores. */
+  std::vector<llvm::BasicBlock*> worklist(liveIn.begin(), liveIn.end());
+  while (!worklist.empty())
+    {
+      llvm::BasicBlock *bb = worklist.back();
+      worklist.pop_back();
+      for (llvm::pred_iterator PI = llvm::pred_begin(bb),
+             E = llvm::pred_end(bb); PI != E; ++PI)
+        {
+          llvm::BasicBlock *pred = *PI;
+          if (!accesses.liveOut.insert(pred).second) continue;
+          if (killed.count(pred) == 0 && liveIn.insert(pred).second)
+            worklist.push_back(pred);
+        }
+    }
+}
+
+/**
+ * Returns true if the context slot is live right after the given
+ * instruction.
+ */
+bool
+isLiveAfter(ContextArrayAccesses &accesses, llvm::Instruction *instruction)
+{
+  llvm::BasicBlock *bb = instruction->getParent();
+  llvm::BasicBlock::iterator instr = instruction;
+  for (++instr; instr != bb->end(); ++instr)
+    {
+      llvm::Instruction *next = instr;
+      if (accesses.loads.count(next)) return true;
+      if (accesses.stores.count(next)) return false;
+    }
+  return accesses.liveOut.count(bb) > 0;
+}
+
+/**
+ * Two context arrays can share their storage if neither of them is
+ * stored to while the other one still holds a live value.
+ */
+bool
+contextArraysInterfere(ContextArrayAccesses &a, ContextArrayAccesses &b)
+{
+  for (std::set<llvm::Instruction*>::iterator i = a.stores.begin(),
+         e = a.stores.end(); i != e; ++i)
+    if (isLiveAfter(b, *i)) return true;
+  for (std::set<llvm::Instruction*>::iterator i = b.stores.begin(),
+         e = b.stores.end(); i != e; ++i)
+    if (isLiveAfter(a, *i)) return true;
+  return false;
+}
+
+}
+
+/**
+ * Merges the context arrays with disjoint lifetimes to share the same
+ * stack storage.
+ *
+ * Each work-item accesses only its own slot of the context arrays, thus
+ * the lifetimes are those of the single work-item program. They are
+ * computed from the CFG before the work-item loops are added around
+ * the parallel regions. The arrays are assigned greedily to the first
+ * non-interfering storage with the same slot size and access it via a
+ * bitcast. The slots of different sizes would overlap the slots of
+ * the other work-items, whose lifetimes are not analyzed.
+ */
+void
+WorkitemLoops::ShareContextArrays(llvm::Function &F)
+{
+  std::vector<ContextArrayAccesses> arrays;
+  for (StrInstructionMap::iterator i = contextArrays.begin(),
+         e = contextArrays.end(); i != e; ++i)
+    {
+      ContextArrayAccesses accesses;
+      accesses.array = dyn_cast<AllocaInst>(i->second);
+      if (accesses.array == NULL ||
+          !collectContextArrayAccesses(accesses))
+        continue;
+      accesses.size = DL->getTypeAllocSize(accesses.array->getAllocatedType());
+      llvm::Type *element = accesses.array->getAllocatedType();
+      for (int dim = linearContextLayout ? 1 : 3; dim > 0; --dim)
+        element = cast<ArrayType>(element)->getElementType();
+      accesses.elementSize = DL->getTypeAllocSize(element);
+      computeContextArrayLiveness(accesses);
+      arrays.push_back(accesses);
+    }
+
+  std::vector<ContextArrayAccesses*> candidates;
+  for (size_t i = 0; i < arrays.size(); ++i)
+    candidates.push_back(&arrays[i]);
+  std::stable_sort(candidates.begin(), candidates.end(), largerContextArray);
+
+  std::vector<std::vector<ContextArrayAccesses*> > storages;
+  for (size_t c = 0; c < candidates.size(); ++c)
+    {
+      ContextArrayAccesses *candidate = candidates[c];
+      size_t s = 0;
+      for (; s < storages.size(); ++s)
+        {
+          bool interferes =
+            storages[s][0]->elementSize != candidate->elementSize;
+          for (size_t m = 0; m < storages[s].size() && !interferes; ++m)
+            interferes = contextArraysInterfere(*candidate, *storages[s][m]);
+          if (!interferes) break;
+        }
+      if (s == storages.size())
+        storages.push_back(std::vector<ContextArrayAccesses*>());
+      storages[s].push_back(candidate);
+    }
+
+  for (size_t s = 0; s < storages.size(); ++s)
+    {
+      llvm::AllocaInst *storage = storages[s][0]->array;
+      for (size_t m = 1; m < storages[s].size(); ++m)
+        {
+          llvm::AllocaInst *array = storages[s][m]->array;
+          std::string name = array->getName().str();
+          llvm::BasicBlock::iterator insertPoint = storage;
+          ++insertPoint;
+          llvm::Instruction *view =
+            new BitCastInst(storage, array->getType(), "", insertPoint);
+          array->replaceAllUsesWith(view);
+          array->eraseFromParent();
+          view->setName(name);
+          contextArrays[name] = view;
+          ++SharedContextArrays;
+#ifdef DEBUG_WORK_ITEM_LOOPS
+          std::cerr << "### " << name << " shares the storage of "
+                    << storage->getName().str() << std::endl;
+#endif
+        }
+    }
+}
+
 
 /**
  * Adds context save/restore code for the value produced by the
@@ -876,6 +1296,9 @@ WorkitemLoops::AddContextSaveRestore
 #endif
       if (user == NULL) continue;
       if (user == theStore) continue;
+      /* The truncation of a compacted context save. */
+      if (theStore != NULL &&
+          user == cast<StoreInst>(theStore)->getValueOperand()) continue;
       uses.push_back(user);
     }
 
@@ -928,6 +1351,16 @@ WorkitemLoops::AddContextSaveRestore
       llvm::Value *loadedValue = 
         AddContextRestore
         (user, alloca, contextRestoreLocation, isa<AllocaInst>(instruction));
+      std::map<llvm::Instruction*, bool>::iterator compacted =
+        compactedContextArrays.find(alloca);
+      if (compacted != compactedContextArrays.end())
+        {
+          IRBuilder<> builder(contextRestoreLocation);
+          if (compacted->second)
+            loadedValue = builder.CreateSExt(loadedValue, instruction->getType());
+          else
+            loadedValue = builder.CreateZExt(loadedValue, instruction->getType());
+        }
       user->replaceUsesOfWith(instruction, loadedValue);
 #ifdef DEBUG_WORK_ITEM_LOOPS
       std::cerr << "### done, the user was converted to:" << std::endl;
@@ -37,6 +37,7 @@
 
 namespace llvm {
   struct PostDominatorTree;
+  class DataLayout;
 }
 
 namespace pocl {
@@ -65,10 +66,23 @@ namespace pocl {
 #if ! (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
     llvm::DominatorTreeWrapperPass *DTP;
 #endif
+    const llvm::DataLayout *DL;
 
     ParallelRegion::ParallelRegionVector *original_parallel_regions;
 
     StrInstructionMap contextArrays;
+    // The context arrays which store a narrower integer than the
+    // context saved value. True in case the value is restored with
+    // a sign extension, false in case of a zero extension.
+    std::map<llvm::Instruction*, bool> compactedContextArrays;
+
+    // Index the context arrays with a single linear work-item index
+    // instead of the 3D local id. The rows (the X dimension) are padded
+    // to contextRowLength elements.
+    bool linearContextLayout;
+    size_t contextRowLength;
+    // The linear context array index computed in each region.
+    std::map<ParallelRegion*, llvm::Value*> contextIndices;
 
     virtual bool ProcessFunction(llvm::Function &F);
 
@@ -81,6 +95,10 @@ namespace pocl {
          llvm::Instruction *before=NULL, 
          bool isAlloca=false);
     llvm::Instruction *GetContextArray(llvm::Instruction *val);
+    void AddContextArrayIndices
+        (ParallelRegion *region, std::vector<llvm::Value *> &gepArgs);
+    llvm::Type *CompactContextType(llvm::Instruction *instruction, bool &isSigned);
+    void ShareContextArrays(llvm::Function &F);
 
     std::pair<llvm::BasicBlock *, llvm::BasicBlock *>
     CreateLoopAround
@@ -288,5 +288,89 @@ link(llvm::Module *krn, const llvm::Module *lib)
     }
 }
 
+void
+link_functions(llvm::Module *krn, const llvm::Module *lib)
+{
+    assert(krn);
+    assert(lib);
+    ValueToValueMapTy vvm;
+    std::list<llvm::StringRef> declared;
+
+    llvm::Module::iterator fi,fe;
+    for (fi=krn->begin(), fe=krn->end();
+         fi != fe;
+         fi++) {
+        if (!fi->isDeclaration())
+            continue;
+        llvm::Function *libfunc=lib->getFunction(fi->getName());
+        if (libfunc == NULL || libfunc->isDeclaration())
+            continue;
+        DB_PRINT("%s is not defined, linking it in\n", fi->getName().data());
+        declared.push_back(fi->getName());
+    }
+    if (declared.empty())
+        return;
+
+    // map the globals of lib to the ones already in krn
+    llvm::Module::const_global_iterator gi,ge;
+    for (gi=lib->global_begin(), ge=lib->global_end();
+         gi != ge;
+         gi++) {
+        GlobalVariable *GV=krn->getNamedGlobal(gi->getName());
+        if (GV != NULL)
+            vvm[gi]=GV;
+    }
+
+    // Collect the call graphs of the missing functions. The functions
+    // krn already defines are reused instead of cloned again.
+    std::list<llvm::StringRef> funcs;
+    std::list<llvm::StringRef>::iterator di,de;
+    for (di=declared.begin(), de=declared.end();
+         di != de;
+         di++) {
+        find_called_functions(lib->getFunction(*di), funcs);
+        funcs.push_back(*di);
+    }
+    funcs.sort(stringref_cmp);
+    funcs.unique(stringref_equal);
+
+    // First map all the functions so the calls between them are
+    // remapped regardless of the cloning order.
+    std::list<llvm::StringRef> to_clone;
+    for (di=funcs.begin(), de=funcs.end();
+         di != de;
+         di++) {
+        llvm::Function *SrcFunc=lib->getFunction(*di);
+        if (SrcFunc == NULL)
+            continue;
+        llvm::Function *DstFunc=krn->getFunction(*di);
+        if (DstFunc != NULL && !DstFunc->isDeclaration()) {
+            vvm[SrcFunc]=DstFunc;
+            continue;
+        }
+        if (DstFunc == NULL) {
+            DstFunc=
+                Function::Create(cast<FunctionType>(
+                                     SrcFunc->getType()->getElementType()),
+                                 SrcFunc->getLinkage(),
+                                 SrcFunc->getName(),
+                                 krn);
+            DstFunc->copyAttributesFrom(SrcFunc);
+        }
+        vvm[SrcFunc]=DstFunc;
+        if (!SrcFunc->isDeclaration())
+            to_clone.push_back(*di);
+    }
+
+    for (di=to_clone.begin(), de=to_clone.end();
+         di != de;
+         di++) {
+        CopyFunc(*di, lib, krn, vvm);
+        // The work-group functions have been generated already, thus
+        // the linked in functions need not be visible outside.
+        krn->getFunction(*di)->setLinkage(GlobalValue::InternalLinkage);
+    }
+}
+
 /* vim: set expandtab ts=4 : */
 
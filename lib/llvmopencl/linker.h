@@ -17,4 +17,13 @@
  */
 void link(llvm::Module *krn, const llvm::Module *lib);
 
+/**
+ * Link in the functions of lib that krn calls but does not define,
+ * without cloning the globals of lib again. Used for linking the
+ * runtime functions the kernel compiler passes introduce calls to
+ * after the initial link. The linked in functions must not refer to
+ * globals that krn does not have.
+ */
+void link_functions(llvm::Module *krn, const llvm::Module *lib);
+
 #endif
@@ -0,0 +1,234 @@
+/* Tests clCreateBufferFromFilePOCL: a kernel reads and writes a buffer
+   backed by a range of a read-only file, and the host writes to a
+   CL_MEM_READ_ONLY one. The writes must stay private to the buffers and
+   never reach the file.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <CL/cl.h>
+#include <CL/cl_ext.h>
+#include "poclu.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FILE_NAME "test_buffer_from_file.tmp"
+/* The buffer starts in the middle of a page of the file. */
+#define OFFSET_INTS 100
+#define NUM_INTS 4096
+#define FILE_INTS (OFFSET_INTS + NUM_INTS + 20)
+
+const char* kernel_src =
+"__kernel void update(__global int *data) {\n"
+"  size_t i = get_global_id(0);\n"
+"  data[i] = data[i] * 2 + 1;\n"
+"}\n";
+
+static int
+check_file_unchanged(void)
+{
+  static cl_int contents[FILE_INTS];
+  FILE *f = fopen(FILE_NAME, "rb");
+  int i;
+
+  if (f == NULL || fread(contents, sizeof(cl_int), FILE_INTS, f) != FILE_INTS)
+    {
+      printf("could not read back " FILE_NAME "\n");
+      if (f != NULL)
+        fclose(f);
+      return 1;
+    }
+  fclose(f);
+  for (i = 0; i < FILE_INTS; ++i)
+    if (contents[i] != i)
+      {
+        printf("the file was modified at %d: %d\n", i, contents[i]);
+        return 1;
+      }
+  return 0;
+}
+
+int main() {
+    static cl_int contents[FILE_INTS];
+    static cl_int result[NUM_INTS];
+    clCreateBufferFromFilePOCL_fn create_from_file;
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue command_queue;
+    cl_program program;
+    cl_kernel kernel;
+    cl_mem buf, rest;
+    cl_int err;
+    cl_int *mapped;
+    cl_int value = -1;
+    size_t rest_size = 0;
+    size_t length = strlen(kernel_src);
+    size_t global_size = NUM_INTS;
+    FILE *f;
+    int i;
+
+    poclu_get_any_device(&context, &device, &command_queue);
+
+    create_from_file = (clCreateBufferFromFilePOCL_fn)
+      clGetExtensionFunctionAddress("clCreateBufferFromFilePOCL");
+    if (create_from_file == NULL)
+      {
+        printf("clCreateBufferFromFilePOCL not found\n");
+        return 1;
+      }
+
+    for (i = 0; i < FILE_INTS; ++i)
+      contents[i] = i;
+    remove(FILE_NAME);
+    f = fopen(FILE_NAME, "wb");
+    if (f == NULL
+        || fwrite(contents, sizeof(cl_int), FILE_INTS, f) != FILE_INTS)
+      {
+        printf("could not write " FILE_NAME "\n");
+        return 1;
+      }
+    fclose(f);
+    /* Writable buffers must not need write access to the file. */
+    chmod(FILE_NAME, S_IRUSR);
+
+    buf = create_from_file(context, CL_MEM_READ_WRITE, FILE_NAME,
+                           OFFSET_INTS * sizeof(cl_int),
+                           NUM_INTS * sizeof(cl_int),
+                           CL_MEM_FILE_ADVICE_SEQUENTIAL_POCL, &err);
+    if (check_cl_error(err, __LINE__, "clCreateBufferFromFilePOCL"))
+      return 1;
+
+    program = clCreateProgramWithSource(context, 1, &kernel_src, &length,
+                                        &err);
+    if (check_cl_error(err, __LINE__, "clCreateProgramWithSource"))
+      return 1;
+    err = clBuildProgram(program, 1, &device, "", NULL, NULL);
+    if (check_cl_error(err, __LINE__, "clBuildProgram"))
+      return 1;
+    kernel = clCreateKernel(program, "update", &err);
+    if (check_cl_error(err, __LINE__, "clCreateKernel"))
+      return 1;
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf);
+    err |= clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
+                                  &global_size, NULL, 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(command_queue, buf, CL_TRUE, 0,
+                               NUM_INTS * sizeof(cl_int), result,
+                               0, NULL, NULL);
+    if (check_cl_error(err, __LINE__, "clEnqueueReadBuffer"))
+      return 1;
+
+    for (i = 0; i < NUM_INTS; ++i)
+      if (result[i] != (OFFSET_INTS + i) * 2 + 1)
+        {
+          printf("wrong value at %d: %d\n", i, result[i]);
+          return 1;
+        }
+
+    clReleaseMemObject(buf);
+    clFinish(command_queue);
+    if (check_file_unchanged())
+      return 1;
+
+    /* A zero size maps the rest of the file. */
+    rest = create_from_file(context, CL_MEM_READ_ONLY, FILE_NAME,
+                            OFFSET_INTS * sizeof(cl_int), 0,
+                            CL_MEM_FILE_ADVICE_NORMAL_POCL, &err);
+    if (check_cl_error(err, __LINE__, "clCreateBufferFromFilePOCL"))
+      return 1;
+    err = clGetMemObjectInfo(rest, CL_MEM_SIZE, sizeof(size_t), &rest_size,
+                             NULL);
+    if (check_cl_error(err, __LINE__, "clGetMemObjectInfo"))
+      return 1;
+    if (rest_size != (FILE_INTS - OFFSET_INTS) * sizeof(cl_int))
+      {
+        printf("wrong size for the rest of the file: %zu\n", rest_size);
+        return 1;
+      }
+
+    /* CL_MEM_READ_ONLY restricts only the kernel accesses, the host can
+       still write the buffer. */
+    err = clEnqueueWriteBuffer(command_queue, rest, CL_TRUE, 0,
+                               sizeof(cl_int), &value, 0, NULL, NULL);
+    if (check_cl_error(err, __LINE__, "clEnqueueWriteBuffer"))
+      return 1;
+    mapped = (cl_int *)clEnqueueMapBuffer(command_queue, rest, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE,
+                                          0, rest_size, 0, NULL, NULL, &err);
+    if (check_cl_error(err, __LINE__, "clEnqueueMapBuffer"))
+      return 1;
+    if (mapped[0] != -1 || mapped[1] != OFFSET_INTS + 1)
+      {
+        printf("wrong values after the host write: %d %d\n", mapped[0],
+               mapped[1]);
+        return 1;
+      }
+    mapped[1] = -2;
+    err = clEnqueueUnmapMemObject(command_queue, rest, mapped, 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(command_queue, rest, CL_TRUE, sizeof(cl_int),
+                               sizeof(cl_int), &value, 0, NULL, NULL);
+    if (check_cl_error(err, __LINE__, "clEnqueueReadBuffer"))
+      return 1;
+    if (value != -2)
+      {
+        printf("wrong value after the mapped write: %d\n", value);
+        return 1;
+      }
+    clReleaseMemObject(rest);
+    clFinish(command_queue);
+    if (check_file_unchanged())
+      return 1;
+
+    /* Ranges past the end of the file and host pointer flags fail. */
+    create_from_file(context, CL_MEM_READ_ONLY, FILE_NAME,
+                     FILE_INTS * sizeof(cl_int), 0,
+                     CL_MEM_FILE_ADVICE_NORMAL_POCL, &err);
+    if (err != CL_INVALID_VALUE)
+      {
+        printf("an offset past the end of the file was accepted\n");
+        return 1;
+      }
+    create_from_file(context, CL_MEM_READ_ONLY, FILE_NAME, 0,
+                     (FILE_INTS + 1) * sizeof(cl_int),
+                     CL_MEM_FILE_ADVICE_NORMAL_POCL, &err);
+    if (err != CL_INVALID_VALUE)
+      {
+        printf("a size past the end of the file was accepted\n");
+        return 1;
+      }
+    create_from_file(context, CL_MEM_USE_HOST_PTR, FILE_NAME, 0, 0,
+                     CL_MEM_FILE_ADVICE_NORMAL_POCL, &err);
+    if (err != CL_INVALID_VALUE)
+      {
+        printf("CL_MEM_USE_HOST_PTR was accepted\n");
+        return 1;
+      }
+
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+    clReleaseCommandQueue(command_queue);
+    clReleaseContext(context);
+
+    chmod(FILE_NAME, S_IRUSR | S_IWUSR);
+    remove(FILE_NAME);
+    return 0;
+}
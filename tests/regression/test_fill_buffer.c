@@ -0,0 +1,161 @@
+/* Tests clEnqueueFillBuffer with each of the pattern sizes, at an offset
+   of the buffer, and the rejection of the sizes and offsets which are
+   not multiples of the pattern size.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <CL/cl.h>
+#include "poclu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_SIZE 4096
+/* Large enough to be split across the threads of the pthread device. */
+#define LARGE_BUFFER_SIZE (8 * 1024 * 1024)
+#define MAX_PATTERN_SIZE 128
+#define INITIAL_BYTE 0xAA
+
+/* Fills size bytes at offset of a buffer of buffer_size bytes with the
+   pattern and checks the bytes outside the range stay unchanged.
+   Returns 0 on success. */
+static int
+test_fill (cl_context context, cl_command_queue queue, size_t buffer_size,
+           size_t pattern_size, size_t offset, size_t size)
+{
+  unsigned char pattern[MAX_PATTERN_SIZE];
+  unsigned char *contents = (unsigned char*) malloc (buffer_size);
+  cl_mem buf;
+  cl_int err;
+  size_t i;
+  int ret = 0;
+
+  if (contents == NULL)
+    return 1;
+  for (i = 0; i < pattern_size; ++i)
+    pattern[i] = (unsigned char)(i * 7 + pattern_size);
+  memset (contents, INITIAL_BYTE, buffer_size);
+
+  buf = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                        buffer_size, contents, &err);
+  if (check_cl_error (err, __LINE__, "clCreateBuffer"))
+    {
+      free (contents);
+      return 1;
+    }
+
+  err = clEnqueueFillBuffer (queue, buf, pattern, pattern_size, offset, size,
+                             0, NULL, NULL);
+  if (check_cl_error (err, __LINE__, "clEnqueueFillBuffer"))
+    ret = 1;
+  /* The pattern can be reused right after the call. */
+  memset (pattern, 0, sizeof (pattern));
+  err = clEnqueueReadBuffer (queue, buf, CL_TRUE, 0, buffer_size, contents,
+                             0, NULL, NULL);
+  if (check_cl_error (err, __LINE__, "clEnqueueReadBuffer"))
+    ret = 1;
+
+  for (i = 0; i < buffer_size && ret == 0; ++i)
+    {
+      unsigned char expected = INITIAL_BYTE;
+      if (i >= offset && i < offset + size)
+        expected = (unsigned char)(((i - offset) % pattern_size) * 7
+                                   + pattern_size);
+      if (contents[i] != expected)
+        {
+          printf ("pattern size %zu: wrong byte at %zu: %d, expected %d\n",
+                  pattern_size, i, contents[i], expected);
+          ret = 1;
+        }
+    }
+
+  clReleaseMemObject (buf);
+  free (contents);
+  return ret;
+}
+
+/* Returns 0 in case the fill is rejected with CL_INVALID_VALUE. */
+static int
+test_invalid_fill (cl_context context, cl_command_queue queue,
+                   size_t pattern_size, size_t offset, size_t size)
+{
+  unsigned char pattern[MAX_PATTERN_SIZE * 2] = { 0 };
+  cl_mem buf;
+  cl_int err;
+
+  buf = clCreateBuffer (context, CL_MEM_READ_WRITE, BUFFER_SIZE, NULL, &err);
+  if (check_cl_error (err, __LINE__, "clCreateBuffer"))
+    return 1;
+  err = clEnqueueFillBuffer (queue, buf, pattern, pattern_size, offset, size,
+                             0, NULL, NULL);
+  clReleaseMemObject (buf);
+  if (err != CL_INVALID_VALUE)
+    {
+      printf ("pattern size %zu, offset %zu, size %zu: expected "
+              "CL_INVALID_VALUE, got %d\n", pattern_size, offset, size, err);
+      return 1;
+    }
+  return 0;
+}
+
+int main() {
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue queue;
+    size_t pattern_size;
+    int ret = 0;
+
+    if (poclu_get_any_device (&context, &device, &queue) != CL_SUCCESS)
+      return 1;
+
+    for (pattern_size = 1; pattern_size <= MAX_PATTERN_SIZE; pattern_size *= 2)
+      {
+        /* The whole buffer, and a range at an offset leaving bytes
+           unchanged at both ends. */
+        ret |= test_fill (context, queue, BUFFER_SIZE, pattern_size,
+                          0, BUFFER_SIZE);
+        ret |= test_fill (context, queue, BUFFER_SIZE, pattern_size,
+                          pattern_size * 3, BUFFER_SIZE - pattern_size * 5);
+
+        if (pattern_size > 1)
+          {
+            ret |= test_invalid_fill (context, queue, pattern_size,
+                                      0, pattern_size + 1);
+            ret |= test_invalid_fill (context, queue, pattern_size,
+                                      1, pattern_size);
+          }
+      }
+
+    ret |= test_fill (context, queue, LARGE_BUFFER_SIZE, 16,
+                      16 * 1000, LARGE_BUFFER_SIZE - 16 * 2000);
+
+    /* The pattern sizes which are not powers of two or exceed 128. */
+    ret |= test_invalid_fill (context, queue, 3, 0, 3 * 16);
+    ret |= test_invalid_fill (context, queue, 256, 0, 256);
+    /* Empty fills and ones past the end of the buffer. */
+    ret |= test_invalid_fill (context, queue, 4, 0, 0);
+    ret |= test_invalid_fill (context, queue, 4, 4, BUFFER_SIZE);
+
+    clReleaseCommandQueue (queue);
+    clReleaseContext (context);
+    return ret;
+}
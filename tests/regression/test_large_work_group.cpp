@@ -0,0 +1,168 @@
+/* Tests a work-group of many work-items reducing a local array in a
+   loop with a barrier, with private arrays live across the barriers.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+// Enable OpenCL C++ exceptions
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#define LOCAL_SIZE 256
+#define NUM_GROUPS 4
+#define WORK_ITEMS (LOCAL_SIZE * NUM_GROUPS)
+#define PRIVATE_SIZE 8
+
+static char
+kernelSourceCode[] =
+"#define LOCAL_SIZE 256\n"
+"#define PRIVATE_SIZE 8\n"
+"kernel \n"
+"void test_kernel(__global const int *input, \n"
+"                 __global int *result) {\n"
+"  __local int tmp[LOCAL_SIZE];\n"
+"  size_t lid = get_local_id(0);\n"
+"  int priv[PRIVATE_SIZE];\n"
+"  for (int i = 0; i < PRIVATE_SIZE; ++i)\n"
+"    priv[i] = input[get_global_id(0)] + i;\n"
+"  tmp[lid] = priv[0];\n"
+"  for (size_t s = LOCAL_SIZE / 2; s > 0; s /= 2) {\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"    if (lid < s)\n"
+"      tmp[lid] += tmp[lid + s];\n"
+"  }\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  result[get_global_id(0)] = tmp[0] + priv[lid % PRIVATE_SIZE];\n"
+"}\n";
+
+int
+main(void)
+{
+    cl_int input[WORK_ITEMS];
+    cl_int expected[WORK_ITEMS];
+
+    srand(7);
+    for (int i = 0; i < WORK_ITEMS; i++)
+        input[i] = rand() & 0xffff;
+    for (int group = 0; group < WORK_ITEMS; group += LOCAL_SIZE) {
+        cl_int sum = 0;
+        for (int lid = 0; lid < LOCAL_SIZE; lid++)
+            sum += input[group + lid];
+        for (int lid = 0; lid < LOCAL_SIZE; lid++)
+            expected[group + lid] =
+                sum + input[group + lid] + lid % PRIVATE_SIZE;
+    }
+
+    try {
+        std::vector<cl::Platform> platformList;
+
+        // Pick platform
+        cl::Platform::get(&platformList);
+
+        // Pick first platform
+        cl_context_properties cprops[] = {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(), 0};
+        cl::Context context(CL_DEVICE_TYPE_ALL, cprops);
+
+        // Query the set of devices attched to the context
+        std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+        if (devices[0].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() < LOCAL_SIZE) {
+            std::cout << "the device does not support work-groups of "
+                      << LOCAL_SIZE << " work-items" << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        // Create and program from source
+        cl::Program::Sources sources(1, std::make_pair(kernelSourceCode, 0));
+        cl::Program program(context, sources);
+
+        // Build program
+        program.build(devices);
+
+        cl::Buffer inputBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            WORK_ITEMS * sizeof(cl_int),
+            (void *) &input[0]);
+
+        cl::Buffer resultBuffer = cl::Buffer(
+            context,
+            CL_MEM_WRITE_ONLY,
+            WORK_ITEMS * sizeof(cl_int));
+
+        // Create kernel object
+        cl::Kernel kernel(program, "test_kernel");
+
+        // Set kernel args
+        kernel.setArg(0, inputBuffer);
+        kernel.setArg(1, resultBuffer);
+
+        // Create command queue
+        cl::CommandQueue queue(context, devices[0], 0);
+
+        // Do the work
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(WORK_ITEMS),
+            cl::NDRange(LOCAL_SIZE));
+
+        cl_int result[WORK_ITEMS];
+        queue.enqueueReadBuffer(
+            resultBuffer,
+            CL_TRUE,
+            0,
+            WORK_ITEMS * sizeof(cl_int),
+            (void *) &result[0]);
+
+        bool ok = true;
+        for (int i = 0; i < WORK_ITEMS; i++) {
+            if (result[i] != expected[i]) {
+                std::cout
+                    << "F(" << i << ": " << expected[i] << " != "
+                    << result[i] << ") ";
+                ok = false;
+            }
+        }
+        if (ok)
+          return EXIT_SUCCESS;
+        else
+          return EXIT_FAILURE;
+    }
+    catch (cl::Error err) {
+         std::cerr
+             << "ERROR: "
+             << err.what()
+             << "("
+             << err.err()
+             << ")"
+             << std::endl;
+
+         return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
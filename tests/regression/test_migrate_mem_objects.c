@@ -0,0 +1,187 @@
+/* Tests clEnqueueMigrateMemObjects: the contents of the buffers survive
+   the migrations to the host and back to the device, and the invalid
+   arguments are rejected.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <CL/cl.h>
+#include "poclu.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Spans several pages, thus whole pages are moved between the nodes of
+   a NUMA bound device. */
+#define NUM_INTS (64 * 1024)
+
+const char* kernel_src =
+"__kernel void increment(__global int *data) {\n"
+"  size_t i = get_global_id(0);\n"
+"  data[i] += 1;\n"
+"}\n";
+
+/* Returns 0 in case the migration is rejected with the expected error. */
+static int
+test_invalid_migrate (cl_command_queue queue, cl_uint num_mem_objects,
+                      const cl_mem *mem_objects, cl_mem_migration_flags flags,
+                      cl_uint num_events, const cl_event *events,
+                      cl_int expected, const char *what)
+{
+  cl_int err = clEnqueueMigrateMemObjects (queue, num_mem_objects,
+                                           mem_objects, flags, num_events,
+                                           events, NULL);
+  if (err != expected)
+    {
+      printf ("%s: expected %d, got %d\n", what, expected, err);
+      return 1;
+    }
+  return 0;
+}
+
+int main() {
+    static cl_int contents[NUM_INTS];
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel kernel;
+    cl_mem bufs[2];
+    cl_mem null_buf = NULL;
+    cl_event event;
+    cl_int err;
+    cl_int *mapped;
+    size_t length = strlen (kernel_src);
+    size_t global_size = NUM_INTS;
+    int ret = 0;
+    int i;
+
+    if (poclu_get_any_device (&context, &device, &queue) != CL_SUCCESS)
+      return 1;
+
+    for (i = 0; i < NUM_INTS; ++i)
+      contents[i] = i;
+    bufs[0] = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                              sizeof (contents), contents, &err);
+    if (check_cl_error (err, __LINE__, "clCreateBuffer"))
+      return 1;
+    bufs[1] = clCreateBuffer (context, CL_MEM_READ_WRITE, sizeof (contents),
+                              NULL, &err);
+    if (check_cl_error (err, __LINE__, "clCreateBuffer"))
+      return 1;
+
+    program = clCreateProgramWithSource (context, 1, &kernel_src, &length,
+                                         &err);
+    if (check_cl_error (err, __LINE__, "clCreateProgramWithSource"))
+      return 1;
+    err = clBuildProgram (program, 1, &device, "", NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clBuildProgram"))
+      return 1;
+    kernel = clCreateKernel (program, "increment", &err);
+    if (check_cl_error (err, __LINE__, "clCreateKernel"))
+      return 1;
+    err = clSetKernelArg (kernel, 0, sizeof (cl_mem), &bufs[0]);
+    if (check_cl_error (err, __LINE__, "clSetKernelArg"))
+      return 1;
+
+    /* To the device, where a kernel updates the buffer, to the host, where
+       the host updates it through a mapping, and back to the device. The
+       contents of the second buffer are not needed. */
+    err = clEnqueueMigrateMemObjects (queue, 2, bufs,
+                                      CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED,
+                                      0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueMigrateMemObjects"))
+      return 1;
+    err = clEnqueueMigrateMemObjects (queue, 1, bufs, 0, 0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueMigrateMemObjects"))
+      return 1;
+    err = clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global_size, NULL,
+                                  0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueNDRangeKernel"))
+      return 1;
+    err = clEnqueueMigrateMemObjects (queue, 1, bufs,
+                                      CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL,
+                                      &event);
+    if (check_cl_error (err, __LINE__, "clEnqueueMigrateMemObjects"))
+      return 1;
+    mapped = (cl_int *) clEnqueueMapBuffer (queue, bufs[0], CL_TRUE,
+                                            CL_MAP_READ | CL_MAP_WRITE, 0,
+                                            sizeof (contents), 1, &event,
+                                            NULL, &err);
+    if (check_cl_error (err, __LINE__, "clEnqueueMapBuffer"))
+      return 1;
+    clReleaseEvent (event);
+    for (i = 0; i < NUM_INTS && ret == 0; ++i)
+      {
+        if (mapped[i] != i + 1)
+          {
+            printf ("wrong value on the host at %d: %d\n", i, mapped[i]);
+            ret = 1;
+          }
+        mapped[i] *= 2;
+      }
+    err = clEnqueueUnmapMemObject (queue, bufs[0], mapped, 0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueUnmapMemObject"))
+      return 1;
+
+    err = clEnqueueMigrateMemObjects (queue, 1, bufs, 0, 0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueMigrateMemObjects"))
+      return 1;
+    err = clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global_size, NULL,
+                                  0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueNDRangeKernel"))
+      return 1;
+    err = clEnqueueReadBuffer (queue, bufs[0], CL_TRUE, 0, sizeof (contents),
+                               contents, 0, NULL, NULL);
+    if (check_cl_error (err, __LINE__, "clEnqueueReadBuffer"))
+      return 1;
+    for (i = 0; i < NUM_INTS && ret == 0; ++i)
+      {
+        if (contents[i] != (i + 1) * 2 + 1)
+          {
+            printf ("wrong value on the device at %d: %d\n", i, contents[i]);
+            ret = 1;
+          }
+      }
+
+    ret |= test_invalid_migrate (queue, 1, bufs, 1 << 5, 0, NULL,
+                                 CL_INVALID_VALUE, "unknown flags");
+    ret |= test_invalid_migrate (queue, 0, bufs, 0, 0, NULL,
+                                 CL_INVALID_VALUE, "no mem objects");
+    ret |= test_invalid_migrate (queue, 1, NULL, 0, 0, NULL,
+                                 CL_INVALID_VALUE, "NULL mem object list");
+    ret |= test_invalid_migrate (queue, 1, &null_buf, 0, 0, NULL,
+                                 CL_INVALID_MEM_OBJECT, "NULL mem object");
+    ret |= test_invalid_migrate (queue, 1, bufs, 0, 1, NULL,
+                                 CL_INVALID_EVENT_WAIT_LIST,
+                                 "NULL event wait list");
+    ret |= test_invalid_migrate (queue, 1, bufs, 0, 0, &event,
+                                 CL_INVALID_EVENT_WAIT_LIST,
+                                 "empty event wait list");
+
+    clFinish (queue);
+    clReleaseMemObject (bufs[0]);
+    clReleaseMemObject (bufs[1]);
+    clReleaseKernel (kernel);
+    clReleaseProgram (program);
+    clReleaseCommandQueue (queue);
+    clReleaseContext (context);
+    return ret;
+}
@@ -0,0 +1,182 @@
+/* Tests values of different widths live across barriers with disjoint
+   lifetimes, whose context arrays must not share storage with each other.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+// Enable OpenCL C++ exceptions
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#define LOCAL_X 8
+#define LOCAL_Y 4
+#define GLOBAL_X (LOCAL_X * 4)
+#define GLOBAL_Y (LOCAL_Y * 2)
+#define WORK_ITEMS (GLOBAL_X * GLOBAL_Y)
+
+/* The int 'b' dies in the second region which stores the char 'a' and
+   the short 'c', which in turn die in the third region storing 'd'. The
+   lifetimes of a work-item's values are disjoint but the narrow values
+   are stored while the other work-items still hold their 'b'. The
+   global loads keep the values from being moved across the barriers. */
+static char
+kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(__global const int *ints, \n"
+"                 __global const char *chars, \n"
+"                 __global const short *shorts, \n"
+"                 __global int *result) {\n"
+"  size_t gid = get_global_id(1) * get_global_size(0) + get_global_id(0);\n"
+"  int b = ints[gid];\n"
+"  barrier(CLK_GLOBAL_MEM_FENCE);\n"
+"  char a = chars[gid] + (char)b;\n"
+"  short c = shorts[gid] - (short)b;\n"
+"  int e = ints[gid] & 0xff;\n"
+"  barrier(CLK_GLOBAL_MEM_FENCE);\n"
+"  int d = ints[gid] * a + e;\n"
+"  barrier(CLK_GLOBAL_MEM_FENCE);\n"
+"  result[gid] = d + c;\n"
+"}\n";
+
+int
+main(void)
+{
+    cl_int ints[WORK_ITEMS];
+    cl_char chars[WORK_ITEMS];
+    cl_short shorts[WORK_ITEMS];
+    cl_int expected[WORK_ITEMS];
+
+    srand(4);
+    for (int i = 0; i < WORK_ITEMS; i++) {
+        /* Small enough for the products not to overflow. */
+        ints[i] = rand() & 0xfffff;
+        chars[i] = (cl_char)rand();
+        shorts[i] = (cl_short)rand();
+
+        cl_char a = (cl_char)(chars[i] + (cl_char)ints[i]);
+        cl_short c = (cl_short)(shorts[i] - (cl_short)ints[i]);
+        cl_int e = ints[i] & 0xff;
+        expected[i] = ints[i] * a + e + c;
+    }
+
+    try {
+        std::vector<cl::Platform> platformList;
+
+        // Pick platform
+        cl::Platform::get(&platformList);
+
+        // Pick first platform
+        cl_context_properties cprops[] = {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(), 0};
+        cl::Context context(CL_DEVICE_TYPE_ALL, cprops);
+
+        // Query the set of devices attched to the context
+        std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+        // Create and program from source
+        cl::Program::Sources sources(1, std::make_pair(kernelSourceCode, 0));
+        cl::Program program(context, sources);
+
+        // Build program
+        program.build(devices);
+
+        cl::Buffer intBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            WORK_ITEMS * sizeof(cl_int),
+            (void *) &ints[0]);
+
+        cl::Buffer charBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            WORK_ITEMS * sizeof(cl_char),
+            (void *) &chars[0]);
+
+        cl::Buffer shortBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            WORK_ITEMS * sizeof(cl_short),
+            (void *) &shorts[0]);
+
+        cl::Buffer resultBuffer = cl::Buffer(
+            context,
+            CL_MEM_WRITE_ONLY,
+            WORK_ITEMS * sizeof(cl_int));
+
+        // Create kernel object
+        cl::Kernel kernel(program, "test_kernel");
+
+        // Set kernel args
+        kernel.setArg(0, intBuffer);
+        kernel.setArg(1, charBuffer);
+        kernel.setArg(2, shortBuffer);
+        kernel.setArg(3, resultBuffer);
+
+        // Create command queue
+        cl::CommandQueue queue(context, devices[0], 0);
+
+        // Do the work
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(GLOBAL_X, GLOBAL_Y),
+            cl::NDRange(LOCAL_X, LOCAL_Y));
+
+        cl_int result[WORK_ITEMS];
+        queue.enqueueReadBuffer(
+            resultBuffer,
+            CL_TRUE,
+            0,
+            WORK_ITEMS * sizeof(cl_int),
+            (void *) &result[0]);
+
+        bool ok = true;
+        for (int i = 0; i < WORK_ITEMS; i++) {
+            if (result[i] != expected[i]) {
+                std::cout
+                    << "F(" << i << ": " << expected[i] << " != "
+                    << result[i] << ") ";
+                ok = false;
+            }
+        }
+        if (ok)
+          return EXIT_SUCCESS;
+        else
+          return EXIT_FAILURE;
+    }
+    catch (cl::Error err) {
+         std::cerr
+             << "ERROR: "
+             << err.what()
+             << "("
+             << err.err()
+             << ")"
+             << std::endl;
+
+         return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/* Tests narrow indices computed from the local id which wrap around
+   inside a work-group, thus also inside the vectors of the work-items.
+
+   Copyright (c) 2014 Tampere University of Technology
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+// Enable OpenCL C++ exceptions
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#define LOCAL_SIZE 16
+#define NUM_GROUPS 4
+#define GLOBAL_SIZE (LOCAL_SIZE * NUM_GROUPS)
+#define TABLE_SIZE 256
+
+/* 'i' wraps from 255 to 0 and 'c' from 127 to -128 in the middle of
+   the work-group. */
+static char
+kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(__global const int *table, \n"
+"                 __global int *result, \n"
+"                 __global int *scattered) {\n"
+"  size_t gid = get_global_id(0);\n"
+"  uchar i = get_local_id(0) + 250;\n"
+"  char c = get_local_id(0) + 120;\n"
+"  result[gid] = table[i] + table[c + 128] * 1000;\n"
+"  scattered[get_group_id(0) * 256 + i] = (int)gid;\n"
+"}\n";
+
+int
+main(void)
+{
+    cl_int table[TABLE_SIZE];
+    cl_int scattered[NUM_GROUPS * TABLE_SIZE];
+    cl_int expected[GLOBAL_SIZE];
+    cl_int expectedScattered[NUM_GROUPS * TABLE_SIZE];
+
+    for (int i = 0; i < TABLE_SIZE; i++)
+        table[i] = i;
+    for (int i = 0; i < NUM_GROUPS * TABLE_SIZE; i++)
+        scattered[i] = expectedScattered[i] = -1;
+    for (int gid = 0; gid < GLOBAL_SIZE; gid++) {
+        int lid = gid % LOCAL_SIZE;
+        cl_uchar i = (cl_uchar)(lid + 250);
+        cl_char c = (cl_char)(lid + 120);
+        expected[gid] = i + (c + 128) * 1000;
+        expectedScattered[(gid / LOCAL_SIZE) * TABLE_SIZE + i] = gid;
+    }
+
+    try {
+        std::vector<cl::Platform> platformList;
+
+        // Pick platform
+        cl::Platform::get(&platformList);
+
+        // Pick first platform
+        cl_context_properties cprops[] = {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(), 0};
+        cl::Context context(CL_DEVICE_TYPE_ALL, cprops);
+
+        // Query the set of devices attched to the context
+        std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+        // Create and program from source
+        cl::Program::Sources sources(1, std::make_pair(kernelSourceCode, 0));
+        cl::Program program(context, sources);
+
+        // Build program
+        program.build(devices);
+
+        cl::Buffer tableBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            TABLE_SIZE * sizeof(cl_int),
+            (void *) &table[0]);
+
+        cl::Buffer resultBuffer = cl::Buffer(
+            context,
+            CL_MEM_WRITE_ONLY,
+            GLOBAL_SIZE * sizeof(cl_int));
+
+        cl::Buffer scatteredBuffer = cl::Buffer(
+            context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            NUM_GROUPS * TABLE_SIZE * sizeof(cl_int),
+            (void *) &scattered[0]);
+
+        // Create kernel object
+        cl::Kernel kernel(program, "test_kernel");
+
+        // Set kernel args
+        kernel.setArg(0, tableBuffer);
+        kernel.setArg(1, resultBuffer);
+        kernel.setArg(2, scatteredBuffer);
+
+        // Create command queue
+        cl::CommandQueue queue(context, devices[0], 0);
+
+        // Do the work
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(GLOBAL_SIZE),
+            cl::NDRange(LOCAL_SIZE));
+
+        cl_int result[GLOBAL_SIZE];
+        queue.enqueueReadBuffer(
+            resultBuffer,
+            CL_TRUE,
+            0,
+            GLOBAL_SIZE * sizeof(cl_int),
+            (void *) &result[0]);
+        queue.enqueueReadBuffer(
+            scatteredBuffer,
+            CL_TRUE,
+            0,
+            NUM_GROUPS * TABLE_SIZE * sizeof(cl_int),
+            (void *) &scattered[0]);
+
+        bool ok = true;
+        for (int i = 0; i < GLOBAL_SIZE; i++) {
+            if (result[i] != expected[i]) {
+                std::cout
+                    << "F(" << i << ": " << expected[i] << " != "
+                    << result[i] << ") ";
+                ok = false;
+            }
+        }
+        for (int i = 0; i < NUM_GROUPS * TABLE_SIZE; i++) {
+            if (scattered[i] != expectedScattered[i]) {
+                std::cout
+                    << "S(" << i << ": " << expectedScattered[i] << " != "
+                    << scattered[i] << ") ";
+                ok = false;
+            }
+        }
+        if (ok)
+          return EXIT_SUCCESS;
+        else
+          return EXIT_FAILURE;
+    }
+    catch (cl::Error err) {
+         std::cerr
+             << "ERROR: "
+             << err.what()
+             << "("
+             << err.err()
+             << ")"
+             << std::endl;
+
+         return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/* Tests the work-group functions of OpenCL 2.0.
+
+   Copyright (c) 2014 Tampere University of Technology
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+// Enable OpenCL C++ exceptions
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#define LOCAL_SIZE 16
+#define WORK_ITEMS (2 * LOCAL_SIZE)
+#define RESULTS 6
+
+/* The collectives are also called in a loop to check the accumulators
+   are reset between the executions. */
+static char
+kernelSourceCode[] = 
+"kernel \n"
+"void test_kernel(__global int *input, \n"
+"                 __global int *result) {\n"
+"   size_t gid = get_global_id(0); \n"
+"   int v = input[gid]; \n"
+"   __global int *r = result + gid * 6; \n"
+"   r[0] = work_group_reduce_add(v); \n"
+"   r[1] = work_group_scan_inclusive_add(v); \n"
+"   r[2] = work_group_scan_exclusive_max(v); \n"
+"   r[3] = work_group_broadcast(v, 3); \n"
+"   r[4] = work_group_any(v > 10) + 2 * work_group_all(v > -6); \n"
+"   int m = 0; \n"
+"   for (int i = 0; i < 3; ++i) \n"
+"     m += work_group_reduce_min(v + i); \n"
+"   r[5] = m; \n"
+"}\n";
+
+int
+main(void)
+{
+    int A[WORK_ITEMS];
+    int R[WORK_ITEMS * RESULTS];
+    int E[WORK_ITEMS * RESULTS];
+
+    for (int i = 0; i < WORK_ITEMS; i++) {
+        A[i] = (i * 7) % 23 - 5;
+    }
+
+    for (int i = 0; i < WORK_ITEMS * RESULTS; i++) {
+        R[i] = 0;
+    }
+
+    for (int g = 0; g < WORK_ITEMS; g += LOCAL_SIZE) {
+        int sum = 0, min = A[g], max = A[g];
+        bool any = false, all = true;
+        for (int i = g; i < g + LOCAL_SIZE; i++) {
+            sum += A[i];
+            min = std::min(min, A[i]);
+            max = std::max(max, A[i]);
+            any = any || A[i] > 10;
+            all = all && A[i] > -6;
+        }
+        int scan = 0, scanMax = INT_MIN;
+        for (int i = g; i < g + LOCAL_SIZE; i++) {
+            int *e = E + i * RESULTS;
+            scan += A[i];
+            e[0] = sum;
+            e[1] = scan;
+            e[2] = scanMax;
+            e[3] = A[g + 3];
+            e[4] = (any ? 1 : 0) + 2 * (all ? 1 : 0);
+            e[5] = 3 * min + 3;
+            scanMax = std::max(scanMax, A[i]);
+        }
+    }
+
+    try {
+        std::vector<cl::Platform> platformList;
+
+        // Pick platform
+        cl::Platform::get(&platformList);
+
+        // Pick first platform
+        cl_context_properties cprops[] = {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)(platformList[0])(), 0};
+        cl::Context context(CL_DEVICE_TYPE_ALL, cprops);
+
+        // Query the set of devices attched to the context
+        std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+        // Create and program from source
+        cl::Program::Sources sources(1, std::make_pair(kernelSourceCode, 0));
+        cl::Program program(context, sources);
+
+        // Build program
+        program.build(devices);
+
+        cl::Buffer aBuffer = cl::Buffer(
+            context, 
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+            WORK_ITEMS * sizeof(int), 
+            (void *) &A[0]);
+
+        cl::Buffer cBuffer = cl::Buffer(
+            context, 
+            CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, 
+            WORK_ITEMS * RESULTS * sizeof(int), 
+            (void *) &R[0]);
+
+        cl::Kernel kernel(program, "test_kernel");
+
+        kernel.setArg(0, aBuffer);
+        kernel.setArg(1, cBuffer);
+
+        cl::CommandQueue queue(context, devices[0], 0);
+ 
+        queue.enqueueNDRangeKernel(
+            kernel, 
+            cl::NullRange, 
+            cl::NDRange(WORK_ITEMS),
+            cl::NDRange(LOCAL_SIZE));
+
+        int * output = (int *) queue.enqueueMapBuffer(
+            cBuffer,
+            CL_TRUE, // block 
+            CL_MAP_READ,
+            0,
+            WORK_ITEMS * RESULTS * sizeof(int));
+
+        bool ok = true;
+        for (int i = 0; i < WORK_ITEMS * RESULTS; i++) {
+            if (output[i] != E[i]) {
+                std::cout 
+                    << "F(" << i / RESULTS << "." << i % RESULTS << ": "
+                    << output[i] << " != " << E[i] << ") ";
+                ok = false;
+            }
+        }
+
+        queue.enqueueUnmapMemObject(
+            cBuffer,
+            (void *) output);
+        queue.finish();
+
+        if (!ok) {
+            std::cout << std::endl;
+            return EXIT_FAILURE;
+        }
+    } 
+    catch (cl::Error err) {
+         std::cerr
+             << "ERROR: "
+             << err.what()
+             << "("
+             << err.err()
+             << ")"
+             << std::endl;
+
+         return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}